@@ -0,0 +1,211 @@
+// What the debugger costs, end to end: the debugger runs in batch mode against the
+// synthetic debuggees, once with the commands being measured and once without, and
+// the difference is put down to those commands. Every timed run is repeated and the
+// fastest one kept. The debugger's own system calls are counted in separate runs,
+// by tracing it with PTRACE_SYSCALL, which would distort the timing.
+//
+//   bench [--stops N] [--repeat N] [--json file] [--debugger path]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/ptrace.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+namespace
+{
+    struct Scenario {
+        std::string name;
+        std::string program;
+        std::string setup;        // commands run before the measured ones, and in the baseline
+        std::string command;      // the measured command, `count` times
+        std::uint64_t count;
+        std::uint64_t per;        // units per command, e.g. breakpoints per break-file
+        std::string unit;
+    };
+
+    struct Result {
+        Scenario scenario;
+        double seconds;
+        double syscalls;          // per unit
+    };
+
+    std::string write_script( Scenario const & s, std::uint64_t const count )
+    {
+        char path[]{ "/tmp/bench-XXXXXX" };
+        auto const fd{ mkstemp( path ) };
+        if ( fd < 0 ) return {};
+        close( fd );
+
+        std::ofstream out{ path };
+        out << s.setup;
+        for ( std::uint64_t i{}; i < count; ++i ) out << s.command << '\n';
+        return path;
+    }
+
+    // the debugger's system calls, from syscall-entry-stops; other stops are passed through
+    std::uint64_t count_syscalls( pid_t const child )
+    {
+        int status{};
+        waitpid( child, &status, 0 );
+        ptrace( PTRACE_SETOPTIONS, child, nullptr, PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL );
+
+        std::uint64_t syscalls{};
+        int signal{};
+        while ( ptrace( PTRACE_SYSCALL, child, nullptr, signal ) == 0 && waitpid( child, &status, 0 ) == child && WIFSTOPPED( status ) ) {
+            signal = 0;
+            if ( WSTOPSIG( status ) == ( SIGTRAP | 0x80 ) ) {
+                __ptrace_syscall_info info{};
+                ptrace( PTRACE_GET_SYSCALL_INFO, child, sizeof( info ), &info );
+                if ( info.op == PTRACE_SYSCALL_INFO_ENTRY ) ++syscalls;
+            } else if ( status >> 16 == 0 ) {
+                signal = WSTOPSIG( status );
+            }
+        }
+        return syscalls;
+    }
+
+    struct Run {
+        double seconds;
+        std::uint64_t syscalls;
+    };
+
+    Run run_debugger( std::string const & debugger, std::string const & program, std::string const & script, bool const traced )
+    {
+        auto const start{ std::chrono::steady_clock::now() };
+        auto const child{ fork() };
+        if ( child == 0 ) {
+            auto const null{ open( "/dev/null", O_RDWR ) };
+            dup2( null, STDIN_FILENO );
+            dup2( null, STDOUT_FILENO );
+            dup2( null, STDERR_FILENO );
+            if ( traced ) {
+                ptrace( PTRACE_TRACEME, 0, nullptr, nullptr );
+                raise( SIGSTOP );
+            }
+            execl( debugger.c_str(), debugger.c_str(), "--batch", script.c_str(), program.c_str(), nullptr );
+            _exit( 127 );
+        }
+
+        Run run{};
+        if ( traced ) {
+            run.syscalls = count_syscalls( child );
+        }
+        int status{};
+        waitpid( child, &status, 0 );
+        run.seconds = std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+        return run;
+    }
+
+    Result measure( std::string const & debugger, Scenario const & s, unsigned const repeat )
+    {
+        auto const with{ write_script( s, s.count ) };
+        auto const without{ write_script( s, 0 ) };
+
+        auto fastest{ [&]( std::string const & script ) {
+            auto best{ 1e300 };
+            for ( unsigned i{}; i < repeat; ++i ) best = std::min( best, run_debugger( debugger, s.program, script, false ).seconds );
+            return best;
+        } };
+        auto const seconds{ std::max( 0.0, fastest( with ) - fastest( without ) ) };
+
+        // fewer commands when counting, every system call is two stops of the debugger
+        auto counted{ s };
+        counted.count = std::min< std::uint64_t >( s.count, 2000 );
+        auto const few{ write_script( counted, counted.count ) };
+        auto const syscalls{ run_debugger( debugger, s.program, few, true ).syscalls };
+        auto const baseline{ run_debugger( debugger, s.program, without, true ).syscalls };
+        auto const units{ static_cast< double >( counted.count * s.per ) };
+
+        unlink( with.c_str() );
+        unlink( without.c_str() );
+        unlink( few.c_str() );
+        return { s, seconds, ( static_cast< double >( syscalls ) - static_cast< double >( baseline ) ) / units };
+    }
+
+    void write_json( std::ostream & out, std::string const & debugger, unsigned const repeat, std::vector< Result > const & results )
+    {
+        out << std::fixed << std::setprecision( 2 );
+        out << "{\"debugger\":\"" << debugger << "\",\"repeat\":" << repeat << ",\"results\":[";
+        for ( std::size_t i{}; i < results.size(); ++i ) {
+            auto const & r{ results[ i ] };
+            auto const units{ static_cast< double >( r.scenario.count * r.scenario.per ) };
+            out << ( i ? "," : "" ) << "\n  {\"name\":\"" << r.scenario.name << "\",\"unit\":\"" << r.scenario.unit << "\""
+                << ",\"count\":" << r.scenario.count * r.scenario.per
+                << ",\"seconds\":" << std::setprecision( 6 ) << r.seconds << std::setprecision( 2 )
+                << ",\"per_second\":" << ( r.seconds > 0 ? units / r.seconds : 0.0 )
+                << ",\"ns_per_unit\":" << r.seconds * 1e9 / units
+                << ",\"syscalls_per_unit\":" << r.syscalls << '}';
+        }
+        out << "\n]}\n";
+    }
+}
+
+int main( int const argc, char const * argv[] )
+{
+    std::string debugger{ BENCH_DEBUGGER };
+    std::string json{};
+    std::uint64_t stops{ 20000 };
+    unsigned repeat{ 3 };
+    for ( auto i{ 1 }; i + 1 < argc; i += 2 ) {
+        std::string_view const option{ argv[ i ] };
+        if ( option == "--stops" ) stops = std::strtoull( argv[ i + 1 ], nullptr, 10 );
+        else if ( option == "--repeat" ) repeat = static_cast< unsigned >( std::strtoul( argv[ i + 1 ], nullptr, 10 ) );
+        else if ( option == "--json" ) json = argv[ i + 1 ];
+        else if ( option == "--debugger" ) debugger = argv[ i + 1 ];
+        else {
+            std::fprintf( stderr, "Usage: %s [--stops N] [--repeat N] [--json file] [--debugger path]\n", argv[ 0 ] );
+            return 1;
+        }
+    }
+    if ( stops == 0 || repeat == 0 ) {
+        std::fprintf( stderr, "--stops and --repeat have to be at least 1\n" );
+        return 1;
+    }
+
+    std::vector< Scenario > const scenarios{
+        // a breakpoint hit and the continue after it: stop, report, step over, resume
+        { "breakpoint_loop",    BENCH_LOOP,    "break bench_hit\n",                   "continue",       stops,     1,                     "stop"       },
+        // the same with eight threads, all of them stopped and resumed for every hit
+        { "breakpoint_threads", BENCH_THREADS, "break bench_hit\n",                   "continue",       stops / 4, 1,                     "stop"       },
+        { "single_step",        BENCH_LOOP,    "break bench_hit\ncontinue\ndelete\n", "stepi",          stops,     1,                     "step"       },
+        // the registers of a stopped thread, formatted: what a register dump costs on top of the stop
+        { "register_print",     BENCH_LOOP,    "break bench_hit\ncontinue\n",         "register print", stops,     1,                     "dump"       },
+        // arming: resolving and writing an int3 for every function of a large binary
+        { "arm_breakpoints",    BENCH_LARGE,   "",                                    "break-file " BENCH_LARGE_BREAKPOINTS, 1, BENCH_LARGE_FUNCTIONS, "breakpoint" },
+    };
+
+    std::vector< Result > results{};
+    for ( auto const & s : scenarios ) {
+        results.push_back( measure( debugger, s, repeat ) );
+        auto const & r{ results.back() };
+        auto const units{ static_cast< double >( s.count * s.per ) };
+        std::fprintf( stderr, "%-20s %10llu %-10s %10.0f/s %12.0f ns/%s %8.1f syscalls/%s\n", s.name.c_str(),
+                      static_cast< unsigned long long >( s.count * s.per ), s.unit.c_str(), r.seconds > 0 ? units / r.seconds : 0.0,
+                      r.seconds * 1e9 / units, s.unit.c_str(), r.syscalls, s.unit.c_str() );
+    }
+
+    if ( json.empty() ) {
+        write_json( std::cout, debugger, repeat, results );
+    } else {
+        std::ofstream out{ json };
+        write_json( out, debugger, repeat, results );
+        std::fprintf( stderr, "Wrote %s\n", json.c_str() );
+    }
+    return 0;
+}
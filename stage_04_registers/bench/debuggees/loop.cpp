@@ -0,0 +1,15 @@
+// A tight loop around the function the benchmark puts its breakpoint on; it never
+// ends by itself, the debugger kills it when the script is done.
+#include <cstdint>
+
+extern "C" __attribute__((noinline)) std::uint64_t bench_hit( std::uint64_t const i ) {
+    asm volatile( "" );
+    return i * 3 + 1;
+}
+
+int main() {
+    volatile std::uint64_t sum{};
+    for ( std::uint64_t i{}; ; ++i ) {
+        sum = sum + bench_hit( i );
+    }
+}
@@ -0,0 +1,23 @@
+// Many threads in tight loops around the function with the breakpoint, so that every
+// stop has to stop and restart all of them.
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+extern "C" __attribute__((noinline)) std::uint64_t bench_hit( std::uint64_t const i ) {
+    asm volatile( "" );
+    return i * 3 + 1;
+}
+
+static void work() {
+    volatile std::uint64_t sum{};
+    for ( std::uint64_t i{}; ; ++i ) {
+        sum = sum + bench_hit( i );
+    }
+}
+
+int main() {
+    std::vector< std::thread > threads{};
+    for ( auto i{ 0 }; i < 7; ++i ) threads.emplace_back( work );
+    work();
+}
@@ -1,36 +1,246 @@
-#include <sys/ptrace.h>
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
 #include <sys/types.h>
 
+#include "condition.hpp"
+#include "memory.hpp"
+
+inline constexpr std::byte int3{ 0xcc };
+
 struct Breakpoint {
     Breakpoint() = default;
 
-    Breakpoint( pid_t const pid, std::intptr_t const addr )
-        : pid{ pid }, addr{ addr } {}
+    explicit Breakpoint( std::intptr_t const addr ) : addr{ addr } {}
+
+    void enable( Memory & memory ) {
+        if ( enabled ) return;
 
-    void enable() {
-        // save current instruction
-        saved_data = ptrace( PTRACE_PEEKDATA, pid, addr, nullptr );
+        // save current instruction byte
+        if ( !memory.read_value( addr, saved_data ) ) return;
 
         // overwrite with int3 (0xcc)
-        ptrace( PTRACE_POKEDATA, pid, addr, ( saved_data & ~0xff ) | 0xcc );
+        if ( !memory.write_value( addr, int3 ) ) return;
 
         enabled = true;
     }
 
-    void disable() {
+    void disable( Memory & memory ) {
+        if ( !enabled ) return;
+
         // restore instruction
-        ptrace( PTRACE_POKEDATA, pid, addr, saved_data );
+        memory.write_value( addr, saved_data );
 
-        saved_data = 0;
+        saved_data = {};
         enabled = false;
     }
 
     bool          is_enabled()  const { return enabled; }
     std::intptr_t get_address() const { return addr;    }
+    std::byte     get_saved()   const { return saved_data; }
+
+    // Counts a hit and says whether it stops the tracee. A false condition is not a hit,
+    // the first `ignore_count` hits after that are counted but ignored, and a condition
+    // that cannot be evaluated stops.
+    bool hit( user_regs_struct const & regs, Memory & memory ) {
+        if ( !condition.empty() ) {
+            auto const value{ condition.evaluate( regs, memory ) };
+            condition_failed = !value;
+            if ( value && *value == 0 ) return false;
+        }
+        ++hits;
+        if ( ignore_count > 0 ) {
+            --ignore_count;
+            return false;
+        }
+        return true;
+    }
+
+    Condition condition{};
+    std::uint64_t hits{};
+    std::uint64_t ignore_count{};
+    bool condition_failed{};   // at the last hit
 
 private:
-    pid_t pid;
-    std::intptr_t addr;
+    friend struct BreakpointSet;
+
+    std::intptr_t addr{};
     bool enabled{};
-    long saved_data{};
+    std::byte saved_data{};
+};
+
+// All breakpoints of a tracee.
+//
+// Enables and disables can be staged and applied together: the staged
+// patches are grouped by page, and every page is patched with a single
+// read-modify-write of the range it spans, instead of one read and one
+// write per breakpoint.
+struct BreakpointSet {
+    static constexpr std::intptr_t page_size{ 4096 };
+
+    Breakpoint * find( std::intptr_t const addr ) {
+        auto const it{ breakpoints.find( addr ) };
+        return it != std::end( breakpoints ) ? &it->second : nullptr;
+    }
+
+    bool contains( std::intptr_t const addr ) const { return breakpoints.contains( addr ); }
+    std::size_t size() const { return breakpoints.size(); }
+
+    auto begin() const { return std::begin( breakpoints ); }
+    auto end()   const { return std::end( breakpoints ); }
+
+    void stage_enable( std::intptr_t const addr ) {
+        auto const created{ breakpoints.try_emplace( addr, addr ).second };
+        pending.push_back( { addr, true, false, created } );
+    }
+
+    void stage_disable( std::intptr_t const addr ) {
+        if ( breakpoints.contains( addr ) ) {
+            pending.push_back( { addr, false } );
+        }
+    }
+
+    void stage_disable_all() {
+        for ( auto const & [ addr, bp ] : breakpoints ) {
+            pending.push_back( { addr, false } );
+        }
+    }
+
+    // forgets every breakpoint without touching memory, e.g. after an exec replaced it
+    void clear() {
+        breakpoints.clear();
+        pending.clear();
+    }
+
+    // stage a disable and forget the breakpoint once it has been applied
+    void stage_remove( std::intptr_t const addr ) {
+        if ( breakpoints.contains( addr ) ) {
+            pending.push_back( { addr, false, true } );
+        }
+    }
+
+    // takes the breakpoint out of memory and forgets it right away, a single write of the saved byte
+    void remove( std::intptr_t const addr, Memory & memory ) {
+        if ( auto const it{ breakpoints.find( addr ) }; it != std::end( breakpoints ) ) {
+            it->second.disable( memory );
+            breakpoints.erase( it );
+        }
+    }
+
+    // replaces the int3s of enabled breakpoints in `bytes`, read from `addr`, with the original code
+    void restore_original( std::intptr_t const addr, std::span< std::byte > const bytes ) const {
+        // whichever is smaller is walked: a few bytes are looked up, a large range is checked against every breakpoint
+        if ( breakpoints.size() < bytes.size() ) {
+            for ( auto const & [ at, bp ] : breakpoints ) {
+                auto const offset{ static_cast< std::size_t >( at - addr ) };
+                if ( at >= addr && offset < bytes.size() && bp.enabled ) bytes[ offset ] = bp.saved_data;
+            }
+            return;
+        }
+        for ( std::size_t i{}; i < bytes.size(); ++i ) {
+            auto const it{ breakpoints.find( addr + static_cast< std::intptr_t >( i ) ) };
+            if ( it != std::end( breakpoints ) && it->second.enabled ) {
+                bytes[ i ] = it->second.saved_data;
+            }
+        }
+    }
+
+    // writes the original code under every enabled breakpoint into `memory`, a copy of the
+    // address space they are set in (e.g. a fork), which ends up with none of them
+    void restore_all( Memory & memory ) const {
+        for ( auto const & [ addr, bp ] : breakpoints ) {
+            if ( bp.enabled ) memory.write_value( addr, bp.saved_data );
+        }
+    }
+
+    // sets every enabled breakpoint again in `memory`, a copy of the address space without them
+    std::size_t rearm( Memory & memory ) {
+        for ( auto & [ addr, bp ] : breakpoints ) {
+            if ( !bp.enabled ) continue;
+            bp.enabled = false;
+            pending.push_back( { addr, true } );
+        }
+        return apply( memory );
+    }
+
+    // Returns the number of breakpoints whose memory could not be patched. A page that cannot
+    // be patched keeps the breakpoints it had as they were, the ones its enables created are gone.
+    std::size_t apply( Memory & memory ) {
+        // stable, so that an enable followed by a disable of the same address keeps its order
+        std::stable_sort( std::begin( pending ), std::end( pending ), []( auto const & a, auto const & b ) { return a.addr < b.addr; } );
+
+        std::size_t failed{};
+        std::vector< std::byte > buffer{};
+        std::vector< std::pair< std::intptr_t, Breakpoint > > before{};
+
+        for ( auto first{ std::begin( pending ) }; first != std::end( pending ); ) {
+            auto const page{ first->addr / page_size };
+            auto const last{ std::find_if( first, std::end( pending ), [page]( auto const & p ) { return p.addr / page_size != page; } ) };
+
+            auto const lo{ first->addr };
+            auto const hi{ std::prev( last )->addr + 1 };
+            buffer.resize( static_cast< std::size_t >( hi - lo ) );
+
+            if ( memory.read_memory( lo, buffer ) != buffer.size() ) {
+                for ( auto it{ first }; it != last; ++it ) {
+                    failed += it->enable;
+                    if ( it->remove || it->created ) breakpoints.erase( it->addr );
+                }
+                first = last;
+                continue;
+            }
+
+            before.clear();
+            for ( auto it{ first }; it != last; ++it ) {
+                auto & bp{ breakpoints[ it->addr ] };
+                if ( it == first || std::prev( it )->addr != it->addr ) before.emplace_back( it->addr, bp );
+                auto & byte{ buffer[ static_cast< std::size_t >( it->addr - lo ) ] };
+
+                if ( it->enable && !bp.enabled ) {
+                    bp.saved_data = byte;
+                    byte = int3;
+                    bp.enabled = true;
+                } else if ( !it->enable && bp.enabled ) {
+                    byte = bp.saved_data;
+                    bp.saved_data = {};
+                    bp.enabled = false;
+                }
+            }
+
+            if ( memory.write_memory( lo, buffer ) != buffer.size() ) {
+                for ( auto const & [ addr, bp ] : before ) breakpoints[ addr ] = bp;
+                for ( auto it{ first }; it != last; ++it ) {
+                    failed += it->enable;
+                    if ( it->created ) breakpoints.erase( it->addr );
+                }
+                first = last;
+                continue;
+            }
+
+            for ( auto it{ first }; it != last; ++it ) {
+                if ( it->remove ) breakpoints.erase( it->addr );
+            }
+            first = last;
+        }
+
+        pending.clear();
+        return failed;
+    }
+
+private:
+    struct Patch {
+        std::intptr_t addr;
+        bool enable;
+        bool remove{};
+        bool created{};   // by its enable, it goes again if that fails
+    };
+
+    std::unordered_map< std::intptr_t, Breakpoint > breakpoints{};
+    std::vector< Patch > pending{};
 };
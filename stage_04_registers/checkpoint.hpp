@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <sys/types.h>
+#include <sys/user.h>
+
+#include "displaced.hpp"
+
+// A copy-on-write fork of the tracee, kept stopped as a snapshot of the moment it was taken.
+//
+// Its code has no breakpoints or tracepoints in it. What it inherited and the debugger
+// keeps track of, the scratch pages and what was written to them and the seccomp
+// filters, is remembered with it, for when a restart makes a fork of it the tracee.
+struct Checkpoint {
+    std::uint32_t id{};
+    pid_t pid{};
+    std::string program{};
+    user_regs_struct regs{};
+    ScratchSpace scratch{};
+    std::unordered_map< std::intptr_t, DisplacedInstruction > displaced{};
+    std::unordered_set< long > filtered_syscalls{};
+};
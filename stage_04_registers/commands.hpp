@@ -0,0 +1,203 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "perfect_hash.hpp"
+
+enum class Command : std::uint8_t {
+    continue_,
+    interrupt,
+    thread,
+    threads,
+    backtrace,
+    profile,
+    stats,
+    non_stop,
+    step,
+    next,
+    stepi,
+    break_,
+    break_file,
+    hbreak,
+    watch,
+    delete_,
+    breakpoints,
+    condition,
+    ignore,
+    trace,
+    untrace,
+    tracepoints,
+    coverage,
+    catch_,
+    uncatch,
+    record,
+    replay,
+    checkpoint,
+    checkpoints,
+    restart,
+    register_,
+    examine,
+    find,
+    dump,
+    gcore,
+};
+
+struct CommandName {
+    std::string_view name;
+    Command command;
+    bool alias{};   // short for the command, its prefixes do not count
+};
+
+inline constexpr std::array command_names{
+    CommandName{ "continue",    Command::continue_   },
+    CommandName{ "c",           Command::continue_,  true },
+    CommandName{ "interrupt",   Command::interrupt   },
+    CommandName{ "thread",      Command::thread      },
+    CommandName{ "threads",     Command::threads     },
+    CommandName{ "backtrace",   Command::backtrace   },
+    CommandName{ "bt",          Command::backtrace,  true },
+    CommandName{ "profile",     Command::profile     },
+    CommandName{ "stats",       Command::stats       },
+    CommandName{ "non-stop",    Command::non_stop    },
+    CommandName{ "step",        Command::step        },
+    CommandName{ "s",           Command::step,       true },
+    CommandName{ "next",        Command::next        },
+    CommandName{ "n",           Command::next,       true },
+    CommandName{ "stepi",       Command::stepi       },
+    CommandName{ "si",          Command::stepi,      true },
+    CommandName{ "break",       Command::break_      },
+    CommandName{ "b",           Command::break_,     true },
+    CommandName{ "break-file",  Command::break_file  },
+    CommandName{ "hbreak",      Command::hbreak      },
+    CommandName{ "watch",       Command::watch       },
+    CommandName{ "delete",      Command::delete_     },
+    CommandName{ "breakpoints", Command::breakpoints },
+    CommandName{ "condition",   Command::condition   },
+    CommandName{ "ignore",      Command::ignore      },
+    CommandName{ "trace",       Command::trace       },
+    CommandName{ "untrace",     Command::untrace     },
+    CommandName{ "tracepoints", Command::tracepoints },
+    CommandName{ "coverage",    Command::coverage    },
+    CommandName{ "catch",       Command::catch_      },
+    CommandName{ "uncatch",     Command::uncatch     },
+    CommandName{ "record",      Command::record      },
+    CommandName{ "replay",      Command::replay      },
+    CommandName{ "checkpoint",  Command::checkpoint  },
+    CommandName{ "checkpoints", Command::checkpoints },
+    CommandName{ "restart",     Command::restart     },
+    CommandName{ "register",    Command::register_   },
+    CommandName{ "x",           Command::examine     },
+    CommandName{ "find",        Command::find        },
+    CommandName{ "dump",        Command::dump        },
+    CommandName{ "gcore",       Command::gcore       },
+};
+
+namespace command_detail {
+    // not a name of its own and the start of exactly one command's name, "cont" but not "con"
+    consteval bool is_unique_prefix( std::string_view const prefix ) {
+        std::size_t matches{};
+        for ( auto const & c : command_names ) {
+            if ( c.name == prefix ) return false;
+            if ( !c.alias && c.name.starts_with( prefix ) ) ++matches;
+        }
+        return matches == 1;
+    }
+
+    consteval std::size_t key_count() {
+        auto count{ command_names.size() };
+        for ( auto const & c : command_names ) {
+            for ( std::size_t n{ 1 }; !c.alias && n < c.name.size(); ++n ) {
+                if ( is_unique_prefix( c.name.substr( 0, n ) ) ) ++count;
+            }
+        }
+        return count;
+    }
+
+    using Table = PerfectHash< Command, key_count() >;
+
+    // the names, the aliases and every unambiguous prefix, so that a lookup never has to scan
+    consteval std::array< Table::Entry, key_count() > keys() {
+        std::array< Table::Entry, key_count() > out{};
+        std::size_t i{};
+        for ( auto const & c : command_names ) {
+            out[ i++ ] = { c.name, c.command };
+            for ( std::size_t n{ 1 }; !c.alias && n < c.name.size(); ++n ) {
+                if ( is_unique_prefix( c.name.substr( 0, n ) ) ) out[ i++ ] = { c.name.substr( 0, n ), c.command };
+            }
+        }
+        return out;
+    }
+}
+
+inline constexpr command_detail::Table command_table{ command_detail::keys() };
+
+inline std::optional< Command > find_command( std::string_view const word ) {
+    return command_table.find( word );
+}
+
+// the commands `word` could be short for, to say why it was not understood
+inline std::vector< std::string_view > commands_starting_with( std::string_view const word ) {
+    std::vector< std::string_view > out{};
+    for ( auto const & c : command_names ) {
+        if ( !c.alias && c.name.starts_with( word ) ) out.push_back( c.name );
+    }
+    return out;
+}
+
+// `word` is `name` or a shortened form of it, e.g. "r" for "read"
+inline bool is_prefix( std::string_view const word, std::string_view const name ) {
+    return !word.empty() && name.starts_with( word );
+}
+
+// The words of a command line, as views into the line: no copies and nothing allocated
+struct Tokens {
+    static constexpr std::size_t max_tokens{ 64 };
+
+    explicit Tokens( std::string_view const line ) : line{ line } {
+        std::size_t i{};
+        while ( i < line.size() ) {
+            while ( i < line.size() && ( line[ i ] == ' ' || line[ i ] == '\t' ) ) ++i;
+            auto const start{ i };
+            while ( i < line.size() && line[ i ] != ' ' && line[ i ] != '\t' ) ++i;
+            if ( i == start ) break;
+            if ( count == max_tokens ) {
+                overflow = true;
+                break;
+            }
+            tokens[ count++ ] = line.substr( start, i - start );
+        }
+    }
+
+    std::size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    bool too_many() const { return overflow; }
+
+    std::string_view operator[]( std::size_t const i ) const { return tokens[ i ]; }
+
+    std::string_view const * begin() const { return tokens.data(); }
+    std::string_view const * end() const { return tokens.data() + count; }
+
+    // the words from the i-th on
+    std::span< std::string_view const > from( std::size_t const i ) const {
+        return std::span{ tokens }.first( count ).subspan( std::min( i, count ) );
+    }
+
+    // the line from the i-th word on, as it was typed
+    std::string_view rest( std::size_t const i ) const {
+        if ( i >= count ) return {};
+        return line.substr( static_cast< std::size_t >( tokens[ i ].data() - line.data() ) );
+    }
+
+private:
+    std::string_view line{};
+    std::array< std::string_view, max_tokens > tokens{};
+    std::size_t count{};
+    bool overflow{};
+};
@@ -0,0 +1,376 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include <sys/user.h>
+
+#include "memory.hpp"
+#include "registers.hpp"
+
+enum class ConditionOp : std::uint8_t {
+    push,           // operand
+    reg,            // the register `operand` (a Register)
+    load,           // `size` bytes at the address on the stack, sign extended if `is_signed`
+    neg, logical_not, bit_not,
+    add, sub, mul, div, mod, shl, shr,
+    lt, le, gt, ge, eq, ne,
+    bit_and, bit_xor, bit_or,
+    and_jump,       // 0 on top: leave it and jump to `operand`, otherwise pop it
+    or_jump,        // non-zero on top: replace it with 1 and jump to `operand`, otherwise pop it
+    truth,          // top != 0
+};
+
+struct ConditionInstruction {
+    ConditionOp op{};
+    std::uint8_t size{};
+    bool is_signed{};
+    std::int64_t operand{};
+};
+
+// A breakpoint condition, compiled once into stack machine code.
+//
+// Evaluating it takes the registers of the stop that are already fetched
+// and one read of the tracee's memory per load, nothing is parsed or looked
+// up by name at hit time. Values are 64-bit, compared as signed.
+struct Condition {
+    static constexpr std::size_t max_stack{ 32 };
+
+    std::string text{};
+    std::vector< ConditionInstruction > code{};
+
+    bool empty() const { return code.empty(); }
+
+    // nothing if a load faults or a division by zero
+    std::optional< std::int64_t > evaluate( user_regs_struct const & regs, Memory & memory ) const {
+        std::array< std::int64_t, max_stack > stack{};
+        std::size_t depth{};
+
+        for ( std::size_t pc{}; pc < code.size(); ++pc ) {
+            auto const & insn{ code[ pc ] };
+            switch ( insn.op ) {
+                case ConditionOp::push:
+                    stack[ depth++ ] = insn.operand;
+                    continue;
+                case ConditionOp::reg:
+                    stack[ depth++ ] = static_cast< std::int64_t >( get_register_value( regs, static_cast< Register >( insn.operand ) ) );
+                    continue;
+                case ConditionOp::load: {
+                    std::uint64_t value{};
+                    auto const bytes{ std::as_writable_bytes( std::span{ &value, 1 } ).first( insn.size ) };
+                    if ( memory.read_memory( static_cast< std::intptr_t >( stack[ depth - 1 ] ), bytes ) != insn.size ) return std::nullopt;
+                    if ( insn.is_signed && insn.size < 8 ) {
+                        auto const shift{ 64 - insn.size * 8 };
+                        stack[ depth - 1 ] = static_cast< std::int64_t >( value << shift ) >> shift;
+                    } else {
+                        stack[ depth - 1 ] = static_cast< std::int64_t >( value );
+                    }
+                    continue;
+                }
+                case ConditionOp::neg:         stack[ depth - 1 ] = static_cast< std::int64_t >( -static_cast< std::uint64_t >( stack[ depth - 1 ] ) ); continue;
+                case ConditionOp::logical_not: stack[ depth - 1 ] = !stack[ depth - 1 ]; continue;
+                case ConditionOp::bit_not:     stack[ depth - 1 ] = ~stack[ depth - 1 ]; continue;
+                case ConditionOp::truth:       stack[ depth - 1 ] = stack[ depth - 1 ] != 0; continue;
+                case ConditionOp::and_jump:
+                    if ( stack[ depth - 1 ] == 0 ) pc = static_cast< std::size_t >( insn.operand ) - 1;
+                    else --depth;
+                    continue;
+                case ConditionOp::or_jump:
+                    if ( stack[ depth - 1 ] != 0 ) {
+                        stack[ depth - 1 ] = 1;
+                        pc = static_cast< std::size_t >( insn.operand ) - 1;
+                    } else {
+                        --depth;
+                    }
+                    continue;
+                default:
+                    break;
+            }
+
+            auto const b{ stack[ --depth ] };
+            auto & a{ stack[ depth - 1 ] };
+            auto const result{ apply( insn.op, a, b ) };
+            if ( !result ) return std::nullopt;
+            a = *result;
+        }
+        return depth == 1 ? std::optional{ stack[ 0 ] } : std::nullopt;
+    }
+
+    static std::optional< std::int64_t > apply( ConditionOp const op, std::int64_t const a, std::int64_t const b ) {
+        // wrapping arithmetic, like the registers it works on
+        auto const ua{ static_cast< std::uint64_t >( a ) };
+        auto const ub{ static_cast< std::uint64_t >( b ) };
+        switch ( op ) {
+            case ConditionOp::add:     return static_cast< std::int64_t >( ua + ub );
+            case ConditionOp::sub:     return static_cast< std::int64_t >( ua - ub );
+            case ConditionOp::mul:     return static_cast< std::int64_t >( ua * ub );
+            case ConditionOp::div:     if ( b == 0 || ( b == -1 && a == INT64_MIN ) ) return std::nullopt; return a / b;
+            case ConditionOp::mod:     if ( b == 0 || ( b == -1 && a == INT64_MIN ) ) return std::nullopt; return a % b;
+            case ConditionOp::shl:     return ub < 64 ? static_cast< std::int64_t >( ua << ub ) : 0;
+            case ConditionOp::shr:     return ub < 64 ? static_cast< std::int64_t >( ua >> ub ) : 0;
+            case ConditionOp::lt:      return a <  b;
+            case ConditionOp::le:      return a <= b;
+            case ConditionOp::gt:      return a >  b;
+            case ConditionOp::ge:      return a >= b;
+            case ConditionOp::eq:      return a == b;
+            case ConditionOp::ne:      return a != b;
+            case ConditionOp::bit_and: return a & b;
+            case ConditionOp::bit_xor: return a ^ b;
+            case ConditionOp::bit_or:  return a | b;
+            default:                   return std::nullopt;
+        }
+    }
+};
+
+// Compiles C-like expressions:
+//
+//     u32[$rbp - 0x14] == 3 && rdi != 0
+//
+// Operands are integers, registers (with or without a $), symbols (their
+// address) and memory reads: *addr reads 8 bytes, u8/u16/u32/u64[addr] read
+// that many bits and i8/i16/i32/i64[addr] sign extend them. The operators and
+// their precedence are C's, && and || short-circuit.
+template< typename Resolve >
+struct ConditionCompiler {
+    ConditionCompiler( std::string_view const text, Resolve & resolve ) : text{ text }, resolve{ resolve } {}
+
+    std::optional< Condition > compile( std::string & error ) {
+        Condition condition{ std::string{ text } };
+        out = &condition.code;
+        next();
+        if ( !binary( 0 ) || ( token.kind != Token::end && fail( "unexpected '" + std::string{ token.text } + "'" ) ) || !message.empty() ) {
+            error = message;
+            return std::nullopt;
+        }
+        return condition;
+    }
+
+private:
+    struct Token {
+        enum Kind : std::uint8_t { end, number, name, op } kind{ end };
+        std::string_view text{};
+        std::int64_t value{};
+    };
+
+    static int precedence( std::string_view const op ) {
+        if ( op == "||" ) return 1;
+        if ( op == "&&" ) return 2;
+        if ( op == "|" ) return 3;
+        if ( op == "^" ) return 4;
+        if ( op == "&" ) return 5;
+        if ( op == "==" || op == "!=" ) return 6;
+        if ( op == "<" || op == "<=" || op == ">" || op == ">=" ) return 7;
+        if ( op == "<<" || op == ">>" ) return 8;
+        if ( op == "+" || op == "-" ) return 9;
+        if ( op == "*" || op == "/" || op == "%" ) return 10;
+        return 0;
+    }
+
+    static ConditionOp binary_op( std::string_view const op ) {
+        if ( op == "|" ) return ConditionOp::bit_or;
+        if ( op == "^" ) return ConditionOp::bit_xor;
+        if ( op == "&" ) return ConditionOp::bit_and;
+        if ( op == "==" ) return ConditionOp::eq;
+        if ( op == "!=" ) return ConditionOp::ne;
+        if ( op == "<" ) return ConditionOp::lt;
+        if ( op == "<=" ) return ConditionOp::le;
+        if ( op == ">" ) return ConditionOp::gt;
+        if ( op == ">=" ) return ConditionOp::ge;
+        if ( op == "<<" ) return ConditionOp::shl;
+        if ( op == ">>" ) return ConditionOp::shr;
+        if ( op == "+" ) return ConditionOp::add;
+        if ( op == "-" ) return ConditionOp::sub;
+        if ( op == "*" ) return ConditionOp::mul;
+        if ( op == "/" ) return ConditionOp::div;
+        return ConditionOp::mod;
+    }
+
+    bool fail( std::string const & what ) {
+        if ( message.empty() ) message = what;
+        return false;
+    }
+
+    void next() {
+        while ( pos < text.size() && std::isspace( static_cast< unsigned char >( text[ pos ] ) ) ) ++pos;
+        token = {};
+        if ( pos >= text.size() ) return;
+
+        auto const start{ pos };
+        auto const c{ text[ pos ] };
+        if ( std::isdigit( static_cast< unsigned char >( c ) ) ) {
+            auto const hex{ text.substr( pos ).starts_with( "0x" ) || text.substr( pos ).starts_with( "0X" ) };
+            auto const * const first{ text.data() + pos + ( hex ? 2 : 0 ) };
+            std::uint64_t value{};
+            auto const [ ptr, ec ]{ std::from_chars( first, text.data() + text.size(), value, hex ? 16 : 10 ) };
+            pos = static_cast< std::size_t >( ptr - text.data() );
+            token = { Token::number, text.substr( start, pos - start ), static_cast< std::int64_t >( value ) };
+            if ( ec != std::errc{} || ( pos < text.size() && std::isalnum( static_cast< unsigned char >( text[ pos ] ) ) ) ) {
+                fail( "bad number '" + std::string{ token.text } + "'" );
+                token.kind = Token::end;
+            }
+        } else if ( std::isalpha( static_cast< unsigned char >( c ) ) || c == '_' || c == '$' ) {
+            ++pos;
+            while ( pos < text.size() && ( std::isalnum( static_cast< unsigned char >( text[ pos ] ) ) || text[ pos ] == '_' || text[ pos ] == '.' ) ) ++pos;
+            token = { Token::name, text.substr( start, pos - start ) };
+        } else {
+            static constexpr std::array< std::string_view, 8 > pairs{ "<<", ">>", "<=", ">=", "==", "!=", "&&", "||" };
+            auto const two{ text.substr( pos, 2 ) };
+            auto const length{ std::find( std::begin( pairs ), std::end( pairs ), two ) != std::end( pairs ) ? 2U : 1U };
+            pos += length;
+            token = { Token::op, text.substr( start, length ) };
+        }
+    }
+
+    bool accept( std::string_view const op ) {
+        if ( token.kind != Token::op || token.text != op ) return false;
+        next();
+        return true;
+    }
+
+    bool expect( std::string_view const op ) {
+        return accept( op ) || fail( "expected '" + std::string{ op } + "'" );
+    }
+
+    bool emit( ConditionOp const op, std::int64_t const operand = 0, std::uint8_t const size = 0, bool const is_signed = false ) {
+        out->push_back( { op, size, is_signed, operand } );
+        switch ( op ) {
+            case ConditionOp::push:
+            case ConditionOp::reg:
+                if ( ++depth > Condition::max_stack ) return fail( "expression too deep" );
+                break;
+            case ConditionOp::load: case ConditionOp::neg: case ConditionOp::logical_not:
+            case ConditionOp::bit_not: case ConditionOp::truth:
+            case ConditionOp::and_jump: case ConditionOp::or_jump:
+                break;
+            default:
+                --depth;
+                break;
+        }
+        return true;
+    }
+
+    // constants are folded, `1 << 4` costs nothing at hit time
+    bool emit_binary( ConditionOp const op ) {
+        auto & code{ *out };
+        if ( code.size() >= 2 && code[ code.size() - 1 ].op == ConditionOp::push && code[ code.size() - 2 ].op == ConditionOp::push ) {
+            if ( auto const folded{ Condition::apply( op, code[ code.size() - 2 ].operand, code.back().operand ) }; folded ) {
+                code.pop_back();
+                code.back().operand = *folded;
+                --depth;
+                return true;
+            }
+        }
+        return emit( op );
+    }
+
+    bool emit_unary( ConditionOp const op ) {
+        if ( !out->empty() && out->back().op == ConditionOp::push ) {
+            auto & value{ out->back().operand };
+            switch ( op ) {
+                case ConditionOp::neg:         value = static_cast< std::int64_t >( -static_cast< std::uint64_t >( value ) ); return true;
+                case ConditionOp::logical_not: value = !value; return true;
+                case ConditionOp::bit_not:     value = ~value; return true;
+                default: break;
+            }
+        }
+        return emit( op );
+    }
+
+    bool binary( int const min_precedence ) {
+        if ( !unary() ) return false;
+
+        while ( token.kind == Token::op ) {
+            auto const op{ token.text };
+            auto const prec{ precedence( op ) };
+            if ( prec == 0 || prec < min_precedence ) break;
+            next();
+
+            if ( op == "&&" || op == "||" ) {
+                auto const jump{ out->size() };
+                emit( op == "&&" ? ConditionOp::and_jump : ConditionOp::or_jump );
+                --depth;
+                if ( !binary( prec + 1 ) || !emit( ConditionOp::truth ) ) return false;
+                ( *out )[ jump ].operand = static_cast< std::int64_t >( out->size() );
+            } else {
+                if ( !binary( prec + 1 ) || !emit_binary( binary_op( op ) ) ) return false;
+            }
+        }
+        return true;
+    }
+
+    bool unary() {
+        if ( accept( "-" ) ) return unary() && emit_unary( ConditionOp::neg );
+        if ( accept( "!" ) ) return unary() && emit_unary( ConditionOp::logical_not );
+        if ( accept( "~" ) ) return unary() && emit_unary( ConditionOp::bit_not );
+        if ( accept( "+" ) ) return unary();
+        if ( accept( "*" ) ) return unary() && emit( ConditionOp::load, 0, 8 );
+        return primary();
+    }
+
+    bool primary() {
+        if ( token.kind == Token::number ) {
+            auto const value{ token.value };
+            next();
+            return emit( ConditionOp::push, value );
+        }
+        if ( accept( "(" ) ) {
+            return binary( 0 ) && expect( ")" );
+        }
+        if ( token.kind != Token::name ) {
+            return fail( token.kind == Token::end ? "unexpected end of the expression" : "unexpected '" + std::string{ token.text } + "'" );
+        }
+
+        auto name{ token.text };
+        next();
+
+        // sized memory reads, u32[addr]
+        if ( token.kind == Token::op && token.text == "[" ) {
+            auto const is_signed{ name.starts_with( 'i' ) };
+            std::uint8_t size{};
+            if ( name.size() > 1 && ( name[ 0 ] == 'u' || name[ 0 ] == 'i' ) ) {
+                auto const bits{ name.substr( 1 ) };
+                size = bits == "8" ? 1 : bits == "16" ? 2 : bits == "32" ? 4 : bits == "64" ? 8 : 0;
+            }
+            if ( size == 0 ) return fail( "unknown memory read '" + std::string{ name } + "', expected u8..u64 or i8..i64" );
+            next();
+            return binary( 0 ) && expect( "]" ) && emit( ConditionOp::load, 0, size, is_signed );
+        }
+
+        auto const is_register{ name.starts_with( '$' ) };
+        if ( is_register ) name.remove_prefix( 1 );
+        if ( auto const r{ get_register_from_name( name ) }; r ) {
+            return emit( ConditionOp::reg, static_cast< std::int64_t >( *r ) );
+        }
+        if ( is_register ) return fail( "unknown register '" + std::string{ name } + "'" );
+
+        if ( auto const addr{ resolve( name ) }; addr ) {
+            return emit( ConditionOp::push, static_cast< std::int64_t >( *addr ) );
+        }
+        return fail( "cannot resolve '" + std::string{ name } + "'" );
+    }
+
+    std::string_view text{};
+    Resolve & resolve;
+    std::size_t pos{};
+    Token token{};
+    std::vector< ConditionInstruction > * out{};
+    std::size_t depth{};
+    std::string message{};
+};
+
+// `resolve` gives the runtime address of a symbol name, or nothing
+template< typename Resolve >
+std::optional< Condition > compile_condition( std::string_view const text, Resolve && resolve, std::string & error ) {
+    return ConditionCompiler< std::remove_reference_t< Resolve > >{ text, resolve }.compile( error );
+}
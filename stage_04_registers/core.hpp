@@ -0,0 +1,501 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <span>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/procfs.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/user.h>
+
+#include "maps.hpp"
+#include "stats.hpp"
+
+struct CoreThread {
+    pid_t tid{};
+    int signal{};   // what it stopped with
+    user_regs_struct regs{};
+    std::optional< user_fpregs_struct > fpregs{};
+};
+
+// What a core file says about the process besides its memory, all of it taken while the
+// tracee is stopped; the memory itself may be read later, from a fork of that moment.
+struct CoreProcess {
+    pid_t pid{};
+    pid_t ppid{};
+    pid_t pgrp{};
+    pid_t sid{};
+    uid_t uid{};
+    gid_t gid{};
+    char state{ 't' };
+    std::string name{};   // the comm, 15 characters at most
+    std::string args{};   // the command line, with spaces between the arguments
+    std::vector< std::byte > auxv{};
+    std::vector< CoreThread > threads{};   // the first is the one the core is said to be stopped in
+    std::vector< MemoryRegion > regions{};
+};
+
+// everything but the threads, which only the debugger has the registers of
+inline CoreProcess read_process_info( pid_t const pid ) {
+    auto const proc{ "/proc/" + std::to_string( pid ) };
+    CoreProcess process{};
+    process.pid = pid;
+
+    // pid (comm) state ppid pgrp session ..., the comm may have spaces and parentheses in it
+    std::ifstream stat_file{ proc + "/stat" };
+    std::string line{};
+    std::getline( stat_file, line );
+    auto const first{ line.find( '(' ) };
+    auto const last{ line.rfind( ')' ) };
+    if ( first != std::string::npos && last != std::string::npos && last > first ) {
+        process.name = line.substr( first + 1, last - first - 1 );
+        std::istringstream rest{ line.substr( last + 1 ) };
+        rest >> process.state >> process.ppid >> process.pgrp >> process.sid;
+    }
+
+    std::ifstream cmdline{ proc + "/cmdline", std::ios::binary };
+    process.args.assign( std::istreambuf_iterator< char >{ cmdline }, {} );
+    while ( !process.args.empty() && process.args.back() == '\0' ) process.args.pop_back();
+    std::replace( std::begin( process.args ), std::end( process.args ), '\0', ' ' );
+
+    std::ifstream auxv{ proc + "/auxv", std::ios::binary };
+    for ( std::istreambuf_iterator< char > it{ auxv }, end{}; it != end; ++it ) {
+        process.auxv.push_back( static_cast< std::byte >( *it ) );
+    }
+
+    struct stat owner{};
+    if ( stat( proc.c_str(), &owner ) == 0 ) {
+        process.uid = owner.st_uid;
+        process.gid = owner.st_gid;
+    }
+    process.regions = read_memory_maps( pid );
+    return process;
+}
+
+struct CoreSummary {
+    std::string error{};           // why there is no core file, empty if there is one
+    std::size_t segments{};
+    std::uint64_t mapped{};        // bytes of the address space described
+    std::uint64_t written{};       // of those, in the file
+    std::uint64_t zero{};          // left as holes, all zero or never touched
+    std::uint64_t file_backed{};   // left out, the same as in the mapped files
+    std::uint64_t unreadable{};
+    std::uint64_t ns{};
+};
+
+namespace core_detail {
+    inline constexpr std::uint64_t page_size{ 4096 };
+    inline constexpr std::size_t copy_pages{ 256 };   // read with a single process_vm_readv
+    inline constexpr std::size_t pagemap_window{ 16384 };
+
+    // /proc/pid/pagemap, 8 bytes per page
+    inline constexpr std::uint64_t page_present{ std::uint64_t{ 1 } << 63 };
+    inline constexpr std::uint64_t page_swapped{ std::uint64_t{ 1 } << 62 };
+    inline constexpr std::uint64_t page_file{ std::uint64_t{ 1 } << 61 };   // or shared anonymous memory
+
+    // a page in the core file: its contents, a hole that reads as zeros, or nothing at all
+    enum class Fate : std::uint8_t {
+        copy,
+        hole,
+        omit,
+    };
+
+    struct Segment {
+        Elf64_Phdr header{};
+        bool omitted{};
+    };
+
+    struct Run {
+        std::uint64_t addr{};
+        std::uint64_t offset{};   // in the file, from the start of the data
+        std::uint64_t size{};
+    };
+
+    // Mapped files the debugger of the core reads itself: whatever of a private mapping
+    // is still the file's, and a shared mapping, which is the file. The rest, anonymous
+    // memory and what was written to a private mapping, has to be in the core.
+    inline bool is_file_backed( MemoryRegion const & region ) {
+        return region.inode != 0 && region.path.starts_with( '/' ) && !region.path.ends_with( " (deleted)" );
+    }
+
+    inline std::uint32_t flags_of( MemoryRegion const & region ) {
+        return ( region.readable ? PF_R : 0 ) | ( region.writable ? PF_W : 0 ) | ( region.executable ? PF_X : 0 );
+    }
+
+    inline bool is_zero( std::span< std::byte const > const page ) {
+        std::uint64_t any{};
+        for ( std::size_t i{}; i + sizeof( any ) <= page.size(); i += sizeof( any ) ) {
+            std::uint64_t word{};
+            std::memcpy( &word, page.data() + i, sizeof( word ) );
+            any |= word;
+        }
+        return any == 0;
+    }
+
+    template< typename T >
+    std::span< std::byte const > bytes_of( T const & value ) {
+        return std::as_bytes( std::span{ &value, 1 } );
+    }
+
+    inline void add_note( std::vector< std::byte > & notes, std::uint32_t const type, std::span< std::byte const > const desc ) {
+        static constexpr char name[]{ "CORE" };
+        Elf64_Nhdr const header{ sizeof( name ), static_cast< Elf64_Word >( desc.size() ), type };
+        auto const pad{ [&notes] { notes.resize( ( notes.size() + 3 ) & ~std::size_t{ 3 } ); } };
+
+        auto const h{ bytes_of( header ) };
+        notes.insert( std::end( notes ), std::begin( h ), std::end( h ) );
+        auto const n{ std::as_bytes( std::span{ name } ) };
+        notes.insert( std::end( notes ), std::begin( n ), std::end( n ) );
+        pad();
+        notes.insert( std::end( notes ), std::begin( desc ), std::end( desc ) );
+        pad();
+    }
+
+    // NT_PRSTATUS and NT_PRFPREG for every thread, the first one first, then NT_PRPSINFO,
+    // NT_AUXV and NT_FILE with the mapped files
+    inline std::vector< std::byte > build_notes( CoreProcess const & process ) {
+        std::vector< std::byte > notes{};
+
+        for ( auto const & thread : process.threads ) {
+            elf_prstatus status{};
+            status.pr_info.si_signo = thread.signal;
+            status.pr_cursig = static_cast< short >( thread.signal );
+            status.pr_pid = thread.tid;
+            status.pr_ppid = process.ppid;
+            status.pr_pgrp = process.pgrp;
+            status.pr_sid = process.sid;
+            static_assert( sizeof( status.pr_reg ) == sizeof( thread.regs ) );
+            std::memcpy( &status.pr_reg, &thread.regs, sizeof( thread.regs ) );
+            status.pr_fpvalid = thread.fpregs.has_value();
+            add_note( notes, NT_PRSTATUS, bytes_of( status ) );
+            if ( thread.fpregs ) add_note( notes, NT_PRFPREG, bytes_of( *thread.fpregs ) );
+        }
+
+        elf_prpsinfo info{};
+        info.pr_state = 0;
+        info.pr_sname = process.state;
+        info.pr_uid = process.uid;
+        info.pr_gid = process.gid;
+        info.pr_pid = process.pid;
+        info.pr_ppid = process.ppid;
+        info.pr_pgrp = process.pgrp;
+        info.pr_sid = process.sid;
+        std::strncpy( info.pr_fname, process.name.c_str(), sizeof( info.pr_fname ) - 1 );
+        std::strncpy( info.pr_psargs, process.args.c_str(), sizeof( info.pr_psargs ) - 1 );
+        add_note( notes, NT_PRPSINFO, bytes_of( info ) );
+
+        if ( !process.auxv.empty() ) add_note( notes, NT_AUXV, process.auxv );
+
+        // count, page size, then start, end and offset in pages of each file, then their names
+        std::vector< std::uint64_t > ranges{};
+        std::string names{};
+        for ( auto const & region : process.regions ) {
+            if ( !is_file_backed( region ) ) continue;
+            ranges.insert( std::end( ranges ), { region.start, region.end, region.offset / page_size } );
+            names += region.path;
+            names += '\0';
+        }
+        if ( !ranges.empty() ) {
+            std::array< std::uint64_t, 2 > const counts{ ranges.size() / 3, page_size };
+            auto const c{ std::as_bytes( std::span{ counts } ) };
+            std::vector< std::byte > files( std::begin( c ), std::end( c ) );
+            auto const r{ std::as_bytes( std::span{ ranges } ) };
+            files.insert( std::end( files ), std::begin( r ), std::end( r ) );
+            auto const n{ std::as_bytes( std::span{ names } ) };
+            files.insert( std::end( files ), std::begin( n ), std::end( n ) );
+            add_note( notes, NT_FILE, files );
+        }
+        return notes;
+    }
+
+    // Decides the fate of every page of the regions, from what /proc/pid/pagemap says about
+    // it: a PT_LOAD per run of pages that are or are not omitted, and the runs of pages to copy.
+    // Without the pagemap, everything but a clean looking file mapping is copied.
+    struct Layout {
+        std::vector< Segment > segments{};
+        std::vector< Run > runs{};
+        std::uint64_t data_size{};
+        std::uint64_t holes{};
+        std::uint64_t omitted{};
+
+        void plan( pid_t const pid, std::vector< MemoryRegion > const & regions ) {
+            auto const pagemap{ open( ( "/proc/" + std::to_string( pid ) + "/pagemap" ).c_str(), O_RDONLY | O_CLOEXEC ) };
+            std::vector< std::uint64_t > entries( pagemap_window );
+
+            for ( auto const & region : regions ) {
+                if ( region.path == "[vsyscall]" ) continue;
+
+                // the kernel's pages of clock data cannot be read, and stay the kernel's
+                if ( !region.readable || region.path.starts_with( "[vvar" ) ) {
+                    add( region, region.start, region.size(), Fate::omit );
+                    continue;
+                }
+                auto const file_backed{ is_file_backed( region ) };
+                // only private anonymous memory that was never touched is known to be zero
+                auto const untouched_is_zero{ !file_backed && !region.shared && region.inode == 0 };
+                if ( file_backed && region.shared ) {
+                    add( region, region.start, region.size(), Fate::omit );
+                    continue;
+                }
+
+                for ( auto addr{ region.start }; addr < region.end; ) {
+                    auto const count{ std::min< std::uint64_t >( ( region.end - addr ) / page_size, pagemap_window ) };
+                    auto const bytes{ count * sizeof( std::uint64_t ) };
+                    auto const known{ pagemap >= 0 && pread( pagemap, entries.data(), bytes, static_cast< off_t >( addr / page_size * sizeof( std::uint64_t ) ) ) == static_cast< ssize_t >( bytes ) };
+
+                    for ( std::uint64_t i{}; i < count; ++i, addr += page_size ) {
+                        auto fate{ Fate::copy };
+                        if ( known ) {
+                            auto const in_memory{ ( entries[ i ] & ( page_present | page_swapped ) ) != 0 };
+                            if ( file_backed ) {
+                                // a copy of its own once written, until then the file's page
+                                fate = in_memory && !( entries[ i ] & page_file ) ? Fate::copy : Fate::omit;
+                            } else if ( untouched_is_zero && !in_memory ) {
+                                fate = Fate::hole;
+                            }
+                        } else if ( file_backed && !region.writable ) {
+                            fate = Fate::omit;
+                        }
+                        add( region, addr, page_size, fate );
+                    }
+                }
+            }
+            if ( pagemap >= 0 ) close( pagemap );
+        }
+
+    private:
+        void add( MemoryRegion const & region, std::uint64_t const addr, std::uint64_t const size, Fate const fate ) {
+            auto const omit{ fate == Fate::omit };
+            auto * last{ segments.empty() ? nullptr : &segments.back() };
+            auto const extends{ last && last->omitted == omit && last->header.p_vaddr + last->header.p_memsz == addr && last->header.p_flags == flags_of( region ) };
+
+            if ( !extends ) {
+                Segment segment{};
+                segment.omitted = omit;
+                segment.header.p_type = PT_LOAD;
+                segment.header.p_flags = flags_of( region );
+                segment.header.p_vaddr = addr;
+                segment.header.p_offset = data_size;
+                segment.header.p_align = page_size;
+                segments.push_back( segment );
+                last = &segments.back();
+            }
+            last->header.p_memsz += size;
+
+            if ( omit ) {
+                omitted += size;
+                return;
+            }
+            last->header.p_filesz += size;
+            if ( fate == Fate::copy ) {
+                if ( !runs.empty() && runs.back().addr + runs.back().size == addr && runs.back().offset + runs.back().size == data_size ) {
+                    runs.back().size += size;
+                } else {
+                    runs.push_back( { addr, data_size, size } );
+                }
+            } else {
+                holes += size;
+            }
+            data_size += size;
+        }
+    };
+}
+
+// Writes an ELF core file of `pid` to `path`: the threads and the process as `process` has
+// them, the memory as it is in `pid` now, the tracee itself or a fork of it. `fix( addr, bytes )`
+// gets to change what was read before it is written, e.g. to take out breakpoints.
+//
+// The file is sparse: pages that were never touched or read as all zeros are holes, never
+// written, and cost neither the write nor the disk space. Clean pages of mapped files are
+// not in it at all, NT_FILE says where a debugger finds them. The rest is read with a
+// process_vm_readv of up to a megabyte of pages at a time, whatever runs they are in.
+template< typename F >
+CoreSummary write_core( std::string const & path, pid_t const pid, CoreProcess const & process, F && fix ) {
+    using namespace core_detail;
+
+    auto const started{ stats_detail::now() };
+    CoreSummary summary{};
+
+    Layout layout{};
+    layout.plan( pid, process.regions );
+    auto const notes{ build_notes( process ) };
+
+    Elf64_Ehdr header{};
+    std::memcpy( header.e_ident, ELFMAG, SELFMAG );
+    header.e_ident[ EI_CLASS ] = ELFCLASS64;
+    header.e_ident[ EI_DATA ] = ELFDATA2LSB;
+    header.e_ident[ EI_VERSION ] = EV_CURRENT;
+    header.e_ident[ EI_OSABI ] = ELFOSABI_NONE;
+    header.e_type = ET_CORE;
+    header.e_machine = EM_X86_64;
+    header.e_version = EV_CURRENT;
+    header.e_phoff = sizeof( Elf64_Ehdr );
+    header.e_ehsize = sizeof( Elf64_Ehdr );
+    header.e_phentsize = sizeof( Elf64_Phdr );
+    if ( layout.segments.size() + 1 >= PN_XNUM ) {
+        summary.error = "too many segments for a core file";
+        return summary;
+    }
+    header.e_phnum = static_cast< Elf64_Half >( layout.segments.size() + 1 );
+
+    std::vector< Elf64_Phdr > program_headers{};
+    Elf64_Phdr note{};
+    note.p_type = PT_NOTE;
+    note.p_offset = sizeof( Elf64_Ehdr ) + ( layout.segments.size() + 1 ) * sizeof( Elf64_Phdr );
+    note.p_filesz = notes.size();
+    note.p_align = 4;
+    program_headers.push_back( note );
+
+    auto const data_start{ ( note.p_offset + notes.size() + page_size - 1 ) & ~( page_size - 1 ) };
+    for ( auto segment : layout.segments ) {
+        segment.header.p_offset += data_start;
+        program_headers.push_back( segment.header );
+    }
+
+    auto const fd{ open( path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600 ) };
+    if ( fd < 0 ) {
+        summary.error = std::strerror( errno );
+        return summary;
+    }
+    auto const write_at{ [fd]( void const * const data, std::size_t const size, std::uint64_t const offset ) {
+        return pwrite( fd, data, size, static_cast< off_t >( offset ) ) == static_cast< ssize_t >( size );
+    } };
+    auto ok{ write_at( &header, sizeof( header ), 0 )
+          && write_at( program_headers.data(), program_headers.size() * sizeof( Elf64_Phdr ), sizeof( header ) )
+          && write_at( notes.data(), notes.size(), note.p_offset ) };
+
+    // the runs are taken a megabyte of pages at a time, with an iovec for each piece of a run in it
+    std::vector< std::byte > buffer( copy_pages * page_size );
+    std::vector< iovec > remote{};
+    std::vector< Run > pieces{};
+    auto run{ std::begin( layout.runs ) };
+    std::uint64_t done{};   // of `*run`
+
+    while ( ok && run != std::end( layout.runs ) ) {
+        remote.clear();
+        pieces.clear();
+        std::uint64_t size{};
+        for ( ; run != std::end( layout.runs ) && size < buffer.size() && remote.size() < IOV_MAX; ) {
+            auto const take{ std::min( run->size - done, buffer.size() - size ) };
+            remote.push_back( { reinterpret_cast< void * >( run->addr + done ), take } );
+            pieces.push_back( { run->addr + done, run->offset + done, take } );
+            size += take;
+            done += take;
+            if ( done == run->size ) {
+                ++run;
+                done = 0;
+            }
+        }
+
+        iovec local{ buffer.data(), size };
+        auto const got{ instrumented::process_vm_readv( pid, &local, 1, remote.data(), remote.size(), 0 ) };
+        auto const readable{ static_cast< std::uint64_t >( std::max< ssize_t >( got, 0 ) ) & ~( page_size - 1 ) };
+
+        // a failed read ends at the first page that could not be read, the pages from there on
+        // are read one by one and left as holes if they cannot be
+        for ( auto at{ readable }; at < size; at += page_size ) {
+            std::uint64_t piece_start{};
+            auto piece{ std::begin( pieces ) };
+            for ( ; piece_start + piece->size <= at; ++piece ) piece_start += piece->size;
+            iovec one_local{ buffer.data() + at, page_size };
+            iovec one_remote{ reinterpret_cast< void * >( piece->addr + ( at - piece_start ) ), page_size };
+            if ( instrumented::process_vm_readv( pid, &one_local, 1, &one_remote, 1, 0 ) != static_cast< ssize_t >( page_size ) ) {
+                std::fill_n( buffer.data() + at, page_size, std::byte{} );
+                summary.unreadable += page_size;
+            }
+        }
+
+        std::uint64_t piece_start{};
+        for ( auto const & piece : pieces ) {
+            std::span const bytes{ buffer.data() + piece_start, piece.size };
+            fix( piece.addr, bytes );
+
+            // consecutive pages that are not all zeros go out in one write, from `first` on
+            auto first{ piece.size };
+            for ( std::uint64_t at{}; at <= piece.size && ok; at += page_size ) {
+                auto const zero{ at == piece.size || is_zero( bytes.subspan( at, page_size ) ) };
+                if ( !zero && first == piece.size ) first = at;
+                if ( zero && first < at ) {
+                    ok = write_at( bytes.data() + first, at - first, data_start + piece.offset + first );
+                    summary.written += at - first;
+                    first = piece.size;
+                }
+                if ( zero && at < piece.size ) summary.zero += page_size;
+            }
+            piece_start += piece.size;
+        }
+    }
+
+    // the file ends where the last segment does, even if that is in a hole
+    if ( ok ) ok = ftruncate( fd, static_cast< off_t >( data_start + layout.data_size ) ) == 0;
+    if ( !ok ) summary.error = std::strerror( errno );
+    close( fd );
+
+    summary.segments = layout.segments.size();
+    summary.zero += layout.holes;
+    summary.zero -= std::min( summary.zero, summary.unreadable );
+    summary.file_backed = layout.omitted;
+    for ( auto const & segment : layout.segments ) summary.mapped += segment.header.p_memsz;
+    summary.ns = stats_detail::now() - started;
+    return summary;
+}
+
+// A core file written on a thread of its own from `copy`, a fork of the tracee that nothing
+// else touches, so that the tracee can go on meanwhile. `notify` is written to once it is done,
+// and the fork is the debugger's to kill then.
+struct BackgroundCore {
+    BackgroundCore( std::string path, pid_t const copy, CoreProcess process, int const notify )
+        : path{ std::move( path ) }, copy{ copy }, process{ std::move( process ) }
+    {
+        worker = std::thread{ [this, notify] {
+            summary = write_core( this->path, this->copy, this->process, []( std::uint64_t, std::span< std::byte > ) {} );
+            finished.store( true, std::memory_order_release );
+            std::uint64_t const one{ 1 };
+            [[maybe_unused]] auto const n{ notify >= 0 ? write( notify, &one, sizeof( one ) ) : 0 };
+        } };
+    }
+
+    BackgroundCore( BackgroundCore const & ) = delete;
+    BackgroundCore & operator=( BackgroundCore const & ) = delete;
+
+    ~BackgroundCore() { if ( worker.joinable() ) worker.join(); }
+
+    bool is_done() const { return finished.load( std::memory_order_acquire ); }
+
+    // waits for it if it is not done yet
+    CoreSummary const & result() {
+        if ( worker.joinable() ) worker.join();
+        return summary;
+    }
+
+    std::string const & get_path() const { return path; }
+    pid_t get_copy() const { return copy; }
+
+private:
+    std::string path{};
+    pid_t copy{};
+    CoreProcess process{};
+    CoreSummary summary{};
+    std::atomic< bool > finished{};
+    std::thread worker{};
+};
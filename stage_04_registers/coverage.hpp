@@ -0,0 +1,122 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+enum class CoverageKind : std::uint8_t {
+    functions,
+    lines,
+};
+
+inline std::string_view describe( CoverageKind const kind ) {
+    return kind == CoverageKind::functions ? "functions" : "lines";
+}
+
+// Which of a fixed set of code locations have run, one bit per location. The locations
+// are addresses in the program's ELF file, sorted and without repeats, so the bitmap alone
+// says what ran: whoever reads it can list the same locations from the same file.
+//
+// A location is only ever marked once, its breakpoint is gone after its first hit.
+struct Coverage {
+    Coverage() = default;
+
+    Coverage( CoverageKind const kind, std::vector< std::uint64_t > locations, std::uint64_t const base, std::string path )
+        : kind{ kind }, locations{ std::move( locations ) }, base{ base }, path{ std::move( path ) }
+    {
+        std::sort( std::begin( this->locations ), std::end( this->locations ) );
+        this->locations.erase( std::unique( std::begin( this->locations ), std::end( this->locations ) ), std::end( this->locations ) );
+        covered_bits.assign( ( this->locations.size() + 63 ) / 64, 0 );
+        armed_bits.assign( covered_bits.size(), 0 );
+    }
+
+    bool is_active() const { return !locations.empty(); }
+    CoverageKind get_kind() const { return kind; }
+    std::string const & get_path() const { return path; }
+    std::size_t size() const { return locations.size(); }
+    std::size_t covered() const { return covered_count; }
+
+    // where location `i` is in the tracee
+    std::intptr_t address( std::size_t const i ) const { return static_cast< std::intptr_t >( locations[ i ] + base ); }
+
+    // its breakpoint was set for the coverage, not by the user, and goes once it is hit
+    void set_armed( std::size_t const i, bool const armed ) {
+        auto & word{ armed_bits[ i / 64 ] };
+        word = armed ? word | bit( i ) : word & ~bit( i );
+    }
+
+    bool is_armed( std::intptr_t const addr ) const {
+        auto const i{ index_of( addr ) };
+        return i && ( armed_bits[ *i / 64 ] & bit( *i ) );
+    }
+
+    // the user took over the breakpoint at `addr`, it stays when the location is hit
+    void disown( std::intptr_t const addr ) {
+        if ( auto const i{ index_of( addr ) }; i ) set_armed( *i, false );
+    }
+
+    // the locations whose breakpoint is still only there for the coverage
+    template< typename F >
+    void for_each_armed( F && f ) const {
+        for ( std::size_t i{}; i < locations.size(); ++i ) {
+            if ( armed_bits[ i / 64 ] & bit( i ) ) f( address( i ) );
+        }
+    }
+
+    // notes a hit of `addr`, returns whether it is a location run for the first time
+    bool mark( std::intptr_t const addr ) {
+        auto const i{ index_of( addr ) };
+        if ( !i || ( covered_bits[ *i / 64 ] & bit( *i ) ) ) return false;
+        covered_bits[ *i / 64 ] |= bit( *i );
+        ++covered_count;
+        return true;
+    }
+
+    // A short text header, then the bitmap in hex, 64 digits to a line; location i is
+    // bit i % 8 of byte i / 8, lowest bit first. The locations themselves are not written.
+    bool write( std::string const & program ) const {
+        std::ofstream out{ path };
+        if ( !out ) return false;
+
+        out << "dbgg coverage 1\n"
+            << "program " << program << '\n'
+            << "kind " << describe( kind ) << '\n'
+            << "locations " << std::dec << locations.size() << '\n'
+            << "covered " << covered_count << '\n'
+            << "first " << std::hex << ( locations.empty() ? 0 : locations.front() ) << '\n'
+            << "last " << ( locations.empty() ? 0 : locations.back() ) << '\n';
+
+        auto const bytes{ ( locations.size() + 7 ) / 8 };
+        out << std::setfill('0');
+        for ( std::size_t i{}; i < bytes; ++i ) {
+            auto const byte{ ( covered_bits[ i / 8 ] >> ( i % 8 * 8 ) ) & 0xff };
+            out << std::setw(2) << byte << ( i % 32 == 31 || i + 1 == bytes ? "\n" : "" );
+        }
+        return static_cast< bool >( out.flush() );
+    }
+
+private:
+    static std::uint64_t bit( std::size_t const i ) { return std::uint64_t{ 1 } << ( i % 64 ); }
+
+    std::optional< std::size_t > index_of( std::intptr_t const addr ) const {
+        auto const elf_addr{ static_cast< std::uint64_t >( addr ) - base };
+        auto const it{ std::lower_bound( std::begin( locations ), std::end( locations ), elf_addr ) };
+        if ( it == std::end( locations ) || *it != elf_addr ) return std::nullopt;
+        return static_cast< std::size_t >( it - std::begin( locations ) );
+    }
+
+    CoverageKind kind{};
+    std::vector< std::uint64_t > locations{};
+    std::uint64_t base{};
+    std::string path{};
+    std::vector< std::uint64_t > covered_bits{};
+    std::vector< std::uint64_t > armed_bits{};
+    std::size_t covered_count{};
+};
@@ -1,156 +1,3172 @@
 #include <algorithm>
 #include <array>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <span>
 #include <sstream>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
+#include <csignal>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
 #include <sys/ptrace.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 
 #include "breakpoint.hpp"
+#include "checkpoint.hpp"
+#include "commands.hpp"
+#include "condition.hpp"
+#include "core.hpp"
+#include "coverage.hpp"
+#include "displaced.hpp"
+#include "dwarf.hpp"
+#include "elf.hpp"
+#include "event_loop.hpp"
+#include "hw_breakpoint.hpp"
+#include "inject.hpp"
+#include "json_lines.hpp"
+#include "maps.hpp"
+#include "memory.hpp"
+#include "profiler.hpp"
 #include "registers.hpp"
+#include "search.hpp"
+#include "stats.hpp"
+#include "stop_event.hpp"
+#include "record.hpp"
+#include "syscalls.hpp"
+#include "threads.hpp"
+#include "tracepoint.hpp"
+#include "unwind.hpp"
 
 namespace
 {
-    inline std::vector< std::string > split( std::string const & s, char const delimiter ) {
-        std::vector< std::string > out{};
-        std::stringstream ss{ s };
-        std::string item;
+    inline void append_hex( std::string & out, std::uint64_t const value ) {
+        char digits[ 16 ];
+        auto const [ end, ec ]{ std::to_chars( std::begin( digits ), std::end( digits ), value, 16 ) };
+        out += "0x";
+        out.append( static_cast< std::size_t >( std::end( digits ) - end ), '0' );
+        out.append( std::begin( digits ), end );
+    }
 
-        while( std::getline(ss, item, delimiter ) ) {
-            out.emplace_back(item);
-        }
+    // hex, with or without the 0x prefix
+    inline std::optional< std::intptr_t > parse_address( std::string_view const s ) {
+        auto const * first{ s.data() };
+        auto const * const last{ s.data() + s.size() };
+        if ( s.starts_with( "0x" ) || s.starts_with( "0X" ) ) first += 2;
 
-        return out;
+        std::uintptr_t value{};
+        auto const [ ptr, ec ]{ std::from_chars( first, last, value, 16 ) };
+        if ( ec != std::errc{} || ptr != last || first == last ) return std::nullopt;
+        return static_cast< std::intptr_t >( value );
     }
 
-    inline bool is_prefix( std::string const & haystack, std::string const & needle ) {
-        if ( needle.size() > haystack.size() ) return false;
-        return std::equal( std::begin( haystack ), std::end( haystack ), std::begin( needle ) );
+    // the whole word as a number; base 0 is decimal, or hex after 0x
+    template< typename T >
+    inline std::optional< T > parse_number( std::string_view s, int base = 0 ) {
+        T value{};
+        std::from_chars_result result{};
+        if constexpr ( std::is_floating_point_v< T > ) {
+            result = std::from_chars( s.data(), s.data() + s.size(), value );
+        } else {
+            if ( base == 0 ) {
+                base = s.starts_with( "0x" ) || s.starts_with( "0X" ) ? 16 : 10;
+                if ( base == 16 ) s.remove_prefix( 2 );
+            }
+            result = std::from_chars( s.data(), s.data() + s.size(), value, base );
+        }
+        if ( result.ec != std::errc{} || result.ptr != s.data() + s.size() || s.empty() ) return std::nullopt;
+        return value;
     }
 }
 
 struct Debugger {
+    static constexpr long tracer_options{ PTRACE_O_TRACECLONE | PTRACE_O_TRACEEXEC | PTRACE_O_TRACESECCOMP | PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL };
 
-    Debugger( std::string const & prog, pid_t const pid ) : prog_name{ prog }, pid{ pid } {}
+    Debugger( std::string const & prog, pid_t const pid ) : prog_name{ prog }, pid{ pid }, current_tid{ pid }, threads{ pid }, memory{ pid }, debug_registers{ pid }, elf{ prog }, symbols{ elf }, lines{ elf } {}
 
+    // waits for the selected thread, the others are stopped or left alone
     void wait_for_program()
     {
-        int wait_status{};
-        auto options{ 0 };
-        waitpid( pid, &wait_status, options);
+        auto const tid{ current_tid };
+        while ( true ) {
+            auto * const waited{ wait_any() };
+            if ( !waited ) return;
+
+            // a thread group leader is only reaped after every other thread, so nothing can wait for
+            // just the selected thread; whatever the others report is dealt with as the event loop would
+            if ( waited->tid != tid ) {
+                on_thread_event( *waited );
+                continue;
+            }
+            auto & thread{ *waited };
+
+            // threads created on the way are noted, and a SIGSTOP left over from stopping all threads
+            // (delivered before the thread did anything) is dropped; the step or continue carries on
+            auto const reason{ thread.last_event.reason };
+            if ( reason == StopReason::breakpoint && ( is_stale( thread ) || !should_stop( thread ) ) ) {
+                // a hit that does not count, carried past like any other breakpoint; one that is gone
+                // (deleted, or a coverage breakpoint after its hit) leaves a step still to be taken
+                auto const stepping{ thread.stepping };
+                auto const stepped{ step_over_breakpoint( stepping ) };
+                auto * const still{ threads.find( tid ) };
+                if ( !still || !still->is_stopped() ) return;
+                if ( stepping && stepped ) {
+                    still->last_event.reason = StopReason::single_step;
+                    return;
+                }
+                still->resume( stepping ? PTRACE_SINGLESTEP : PTRACE_CONT );
+                continue;
+            }
+            if ( reason == StopReason::clone ) {
+                std::cout << "New thread " << std::dec << thread.last_event.message << '\n';
+            } else if ( ( reason == StopReason::syscall && !is_caught( thread ) ) || reason == StopReason::syscall_exit ) {
+                // still trapped by a filter, but no longer caught, or only trapped to be recorded
+            } else if ( reason != StopReason::interrupted || interrupt_requested ) {
+                return;
+            }
+            thread.resume( thread.stepping ? PTRACE_SINGLESTEP : PTRACE_CONT );
+        }
     }
 
-    std::uint64_t get_pc()                          { return get_register_value( pid, Register::rip      ); }
-    void          set_pc( std::uint64_t const val ) {        set_register_value( pid, Register::rip, val ); }
+    // the next state change of any thread, nullptr if there is none (yet, with WNOHANG)
+    Thread * wait_any( int const options = 0 )
+    {
+        int status{};
+        auto const tid{ instrumented::waitpid( -1, &status, options | __WALL ) };
+        if ( tid <= 0 ) return nullptr;
+
+        // a new thread can report its first stop before the clone event of its parent
+        auto * thread{ threads.find( tid ) };
+        if ( !thread ) thread = &threads.add( tid );
+
+        handle_wait_status( *thread, status );
+        return thread;
+    }
 
-    void step_over_breakpoint()
+    // turns the raw wait status of a thread into its `last_event`
+    void handle_wait_status( Thread & thread, int const status )
     {
-        auto possible_breakpoint_location{ get_pc() - 1 };
+        thread.last_event = decode_wait_status( thread.tid, status );
+        thread.pending_signal = 0;
+        thread.debug_status = 0;
+        if ( thread.last_event.has_ended() ) {
+            thread.state = ThreadState::exited;
+            return;
+        }
+        thread.state = ThreadState::stopped;
+
+        if ( thread.is_new ) {
+            thread.is_new = false;
+            debug_registers.add_thread( thread.tid );
+        }
+
+        auto & event{ thread.last_event };
+        switch ( event.reason ) {
+            case StopReason::exec:
+                reset_address_space();
+                break;
+            case StopReason::clone:
+                instrumented::ptrace( PTRACE_GETEVENTMSG, thread.tid, nullptr, &event.message );
+                threads.add( static_cast< pid_t >( event.message ) );
+                break;
+            case StopReason::interrupted:
+                thread.expect_stop = false;
+                break;
+            case StopReason::syscall:
+                if ( replaying.is_open() ) {
+                    replay_syscall( thread );
+                } else if ( recording.is_open() ) {
+                    thread.await_exit = find_recorded_syscall( static_cast< long >( registers_of( thread ).get( Register::orig_rax ) ) ) != nullptr;
+                }
+                break;
+            case StopReason::syscall_exit:
+                record_syscall( thread );
+                break;
+            case StopReason::signal:
+                if ( event.signal == SIGTRAP ) {
+                    classify_trap( thread );
+                    // stepped over the system call, there was no syscall-exit-stop
+                    if ( thread.await_exit && event.reason == StopReason::single_step ) record_syscall( thread );
+                } else if ( event.signal == SIGSTOP && thread.expect_stop ) {
+                    // sent by us or by the kernel to a new thread, the tracee must not see it
+                    event.reason = StopReason::interrupted;
+                    thread.expect_stop = false;
+                } else if ( event.signal != SIGINT ) {
+                    // delivered when the thread resumes, like it would have been without a debugger
+                    thread.pending_signal = event.signal;
+                }
+                break;
+            default:
+                break;
+        }
+    }
 
-        if ( breakpoints.count( possible_breakpoint_location ) ) {
-            auto & bp{ breakpoints [ possible_breakpoint_location ] };
-            if ( bp.is_enabled() ) {
-                set_pc( possible_breakpoint_location );
+    // a SIGTRAP is ours: a debug register, an int3 or a single step; anything else stays a signal
+    void classify_trap( Thread & thread )
+    {
+        // which debug register, if any, caused this stop
+        if ( !debug_registers.empty() ) {
+            thread.debug_status = debug_registers.take_status( thread.tid );
+        }
+        if ( thread.debug_status & 0xf ) {
+            thread.last_event.reason = StopReason::hardware;
+            return;
+        }
 
-                bp.disable();
-                // from the manpage: [Details of these kinds of stops are yet to be documented.]
-                ptrace( PTRACE_SINGLESTEP, pid, nullptr, nullptr );
-                wait_for_program();
-                bp.enable();
+        // an int3 leaves rip one past the breakpoint, rewind it so the thread is stopped *at* the breakpoint
+        auto & regs{ registers_of( thread ) };
+        auto const pc{ regs.get( Register::rip ) };
+        auto const addr{ static_cast< std::intptr_t >( pc - 1 ) };
+        auto const * const bp{ breakpoints.find( addr ) };
+        if ( ( bp && bp->is_enabled() ) || retired.contains( addr ) ) {
+            siginfo_t info{};
+            instrumented::ptrace( PTRACE_GETSIGINFO, thread.tid, nullptr, &info );
+            if ( info.si_code == SI_KERNEL || info.si_code == TRAP_BRKPT ) {
+                regs.set( Register::rip, pc - 1 );
+                thread.last_event.reason = StopReason::breakpoint;
+                return;
             }
         }
+
+        if ( thread.stepping ) {
+            thread.last_event.reason = StopReason::single_step;
+        }
     }
 
-    void continue_execution()
+    // exec replaced the address space, everything patched into or learned from the old one is gone
+    void reset_address_space()
+    {
+        // the other threads are gone too, and the one that called exec took over the leader's tid
+        threads.retain_leader();
+        current_tid = pid;
+
+        // what the old image traced is still in our mapping of the ring
+        drain_traces();
+        tracepoints.clear();
+        trace_ring = {};
+        reported_drops = 0;
+        arm_trace_timer( false );
+        // its locations were in the old image
+        finish_coverage( false );
+        breakpoints.clear();
+        retired.clear();
+        debug_registers.reset( pid );
+        displaced.clear();
+        scratch.clear();
+        load_base.reset();
+        memory.reset( pid );
+        unwinder.reset();
+
+        std::error_code ec{};
+        auto const exe{ std::filesystem::read_symlink( "/proc/" + std::to_string( pid ) + "/exe", ec ) };
+        if ( ec ) return;
+
+        prog_name = exe.string();
+        elf = ElfFile{ prog_name };
+        symbols = SymbolIndex{ elf };
+        lines = LineIndex{ elf };
+    }
+
+    Thread & current_thread() { return *threads.find( current_tid ); }
+
+    bool is_stopped() { return current_thread().is_stopped(); }
+
+    void resume( __ptrace_request const request ) { current_thread().resume( request ); }
+
+    // one PTRACE_GETREGS per stop of a thread, and only once its registers are asked for
+    RegisterFile & registers_of( Thread & thread )
+    {
+        if ( !thread.registers.is_valid() ) {
+            thread.registers.fetch( thread.tid );
+        }
+        return thread.registers;
+    }
+
+    RegisterFile & current_registers() { return registers_of( current_thread() ); }
+
+    std::uint64_t get_register( Register const r )                          { return current_registers().get( r );      }
+    void          set_register( Register const r, std::uint64_t const val ) {        current_registers().set( r, val ); }
+
+    std::uint64_t get_pc()                          { return get_register( Register::rip      ); }
+    void          set_pc( std::uint64_t const val ) {        set_register( Register::rip, val ); }
+
+    // gets past any breakpoint at the current pc, returns false if there was none;
+    // with `single_step` the instruction under it has been executed, otherwise the
+    // tracee may only have been made ready to continue past it
+    bool step_over_breakpoint( bool const single_step = true )
+    {
+        auto const pc{ get_pc() };
+
+        auto * bp{ breakpoints.find( pc ) };
+        if ( bp && !bp->is_enabled() ) bp = nullptr;
+
+        // the kernel sets the resume flag after a hardware breakpoint hit, which already skips it once
+        auto hw_slot{ debug_registers.find_execute( pc ) };
+        if ( hw_slot && ( get_register( Register::eflags ) & resume_flag ) ) hw_slot.reset();
+
+        if ( !bp && !hw_slot ) return false;
+
+        // software breakpoints stay in place, the instruction under them is executed elsewhere
+        if ( bp && !hw_slot && displaced_step_over( single_step ) ) return true;
+
+        auto const step_in_place{ [&]{
+            if ( bp ) bp->disable( memory );
+            if ( hw_slot ) debug_registers.set_enabled( current_tid, *hw_slot, false );
+            // from the manpage: [Details of these kinds of stops are yet to be documented.]
+            resume( PTRACE_SINGLESTEP );
+            wait_for_program();
+            if ( bp ) bp->enable( memory );
+            if ( hw_slot ) debug_registers.set_enabled( current_tid, *hw_slot, true );
+        } };
+
+        // with the int3 lifted, other running threads would go straight past the breakpoint
+        if ( bp ) {
+            with_others_stopped( step_in_place );
+        } else {
+            step_in_place();
+        }
+        return true;
+    }
+
+    // running threads are paused around `f`, for what is unsafe while they run
+    template< typename F >
+    void with_others_stopped( F && f )
+    {
+        if ( !non_stop && !running ) {
+            f();
+            return;
+        }
+
+        auto const paused{ stop_all() };
+        f();
+        for ( auto const tid : paused ) {
+            resume_quietly( tid );
+        }
+    }
+
+    // resumes a thread whose stop the user is not told about, past the breakpoint it may be on
+    void resume_quietly( pid_t const tid )
+    {
+        auto * thread{ threads.find( tid ) };
+        if ( !thread || !thread->is_stopped() || thread->unreported ) return;
+
+        if ( thread->last_event.reason == StopReason::breakpoint ) {
+            auto const selected{ std::exchange( current_tid, tid ) };
+            step_over_breakpoint( false );
+            if ( threads.find( selected ) ) current_tid = selected;
+            thread = threads.find( tid );
+        }
+        if ( thread && thread->is_stopped() ) thread->resume( PTRACE_CONT );
+    }
+
+    // executes the instruction under the breakpoint at pc from a scratch slot, or emulates it,
+    // returns false if it has to be stepped in place
+    bool displaced_step_over( bool const single_step )
     {
-        step_over_breakpoint();
-        ptrace( PTRACE_CONT, pid, nullptr, nullptr );
+        auto const pc{ static_cast< std::intptr_t >( get_pc() ) };
 
+        auto it{ displaced.find( pc ) };
+        if ( it == std::end( displaced ) ) {
+            it = displaced.emplace( pc, prepare_displaced( pc ) ).first;
+        }
+        auto const & d{ it->second };
+
+        switch ( d.action ) {
+            case DisplacedAction::in_place:
+                return false;
+            case DisplacedAction::emulate:
+                emulate_branch( pc, d );
+                return true;
+            case DisplacedAction::run_in_slot:
+                set_pc( static_cast< std::uint64_t >( d.slot ) );
+                if ( !single_step ) return true;
+                break;
+            case DisplacedAction::step_in_slot:
+                set_pc( static_cast< std::uint64_t >( d.slot ) );
+                break;
+        }
+
+        resume( PTRACE_SINGLESTEP );
         wait_for_program();
+        if ( !is_stopped() ) return true;
+
+        auto const fallthrough{ static_cast< std::uint64_t >( d.slot + d.fallthrough ) };
+        auto const next{ static_cast< std::uint64_t >( pc + d.insn.length ) };
+        if ( d.insn.kind == InstructionKind::call_indirect ) {
+            // the call pushed the slot as the return address
+            memory.write_value( static_cast< std::intptr_t >( get_register( Register::rsp ) ), next );
+        }
+        if ( get_pc() == fallthrough ) {
+            set_pc( next );
+        }
+        return true;
     }
 
-    void handle_command( std::string const & line )
+    DisplacedInstruction prepare_displaced( std::intptr_t const pc )
     {
-        auto args{ split( line, ' ' ) };
-        auto command{ args[ 0 ] };
+        std::array< std::byte, 16 > bytes{};
+        auto const n{ read_memory( pc, bytes ) };
+        breakpoints.restore_original( pc, bytes );
 
-        if ( command == "continue" || command == "c" || is_prefix( command, "cont" ) ) {
-            continue_execution();
-        } else if ( is_prefix( command, "break" ) ) {
-            std::string const addr{ args[ 1 ] };
-            set_breakpoint_at_address( std::stol( addr, 0, 16 ) );
-        } else if ( command == "register" || is_prefix( command, "reg" ) ) {
-            if ( args.size() == 1 ) {
-                std::cerr << "Invalid number of args. Usage: register <print/read/write> [reg name]\n";
-                return;
+        auto const insn{ decode_instruction( std::span{ bytes }.first( n ) ) };
+        if ( !insn ) return {};
+        if ( !needs_slot( *insn ) ) {
+            std::vector< std::byte > unused{};
+            return relocate_instruction( *insn, bytes, pc, 0, unused );
+        }
+
+        auto const slot{ scratch_slot( pc ) };
+        if ( !slot ) return { *insn };
+
+        std::vector< std::byte > code{};
+        auto const displaced{ relocate_instruction( *insn, bytes, pc, *slot, code ) };
+        if ( !code.empty() && write_memory( *slot, code ) != code.size() ) return { *insn };
+        return displaced;
+    }
+
+    void emulate_branch( std::intptr_t const pc, DisplacedInstruction const & d )
+    {
+        auto const next{ static_cast< std::uint64_t >( pc + d.insn.length ) };
+        auto const sp{ get_register( Register::rsp ) };
+
+        switch ( d.insn.kind ) {
+            case InstructionKind::jump_relative:
+                set_pc( static_cast< std::uint64_t >( d.target( pc ) ) );
+                break;
+            case InstructionKind::call_relative:
+                memory.write_value( static_cast< std::intptr_t >( sp - 8 ), next );
+                set_register( Register::rsp, sp - 8 );
+                set_pc( static_cast< std::uint64_t >( d.target( pc ) ) );
+                break;
+            case InstructionKind::ret: {
+                std::uint64_t return_addr{};
+                memory.read_value( static_cast< std::intptr_t >( sp ), return_addr );
+                set_register( Register::rsp, sp + 8 + d.insn.pop_bytes );
+                set_pc( return_addr );
+                break;
             }
-            if ( args[ 1 ] == "print" ) {
-                reload_registers();
-                print_registers();
-            } else if ( args[ 1 ] == "read" || is_prefix( args[ 1 ], "r" ) ) {
-                reload_registers();
-                if ( auto const it  = std::find_if( std::begin( registers ), std::end( registers ), [args]( auto const & rd ) { return rd.name == args[ 2 ]; } );
-                                it != std::end( registers ) )
-                {
-                    std::cout << std::setw(16) << std::hex << it->value << '\n';
-                } else {
-                    std::cerr << "Cannot find register '" << args[ 2 ] << "'\n";
+            default:
+                break;
+        }
+    }
+
+    // runs a system call inside the tracee, see inject_syscall()
+    std::int64_t run_syscall( std::uint64_t const nr, std::array< std::uint64_t, 6 > const & args )
+    {
+        auto const inject{ [&]{
+            auto & regs{ current_registers() };
+            regs.write_back( current_tid );
+            auto const & saved{ regs.raw() };
+            // once there is a scratch page its first bytes are a syscall instruction, no code has to be patched
+            auto const site{ scratch.empty() ? static_cast< std::intptr_t >( saved.rip ) : scratch.first_page() };
+            return inject_syscall( current_tid, memory, saved, site, nr, args );
+        } };
+        if ( !scratch.empty() ) return inject();
+
+        // the syscall is patched over the code at rip, no other thread may run into it
+        std::int64_t result{};
+        with_others_stopped( [&]{ result = inject(); } );
+        return result;
+    }
+
+    // `count` scratch slots within rel32 reach of `near`, mapping a new page next to it if needed
+    std::optional< std::intptr_t > scratch_slot( std::intptr_t const near, std::intptr_t const count = 1 )
+    {
+        if ( auto const slot{ scratch.take_slot( near, count ) }; slot ) return slot;
+
+        constexpr std::intptr_t distance{ 16 << 20 };
+        constexpr std::intptr_t lowest{ 1 << 16 };
+        auto const base{ near & ~( ScratchSpace::page_size - 1 ) };
+
+        for ( std::intptr_t step{ 1 }; step <= 64; ++step ) {
+            for ( auto const candidate : { base - step * distance, base + step * distance } ) {
+                if ( candidate < lowest ) continue;
+
+                auto const result{ run_syscall( SYS_mmap, {
+                    static_cast< std::uint64_t >( candidate ), ScratchSpace::page_size, PROT_READ | PROT_EXEC,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, ~std::uint64_t{}, 0 } ) };
+                if ( result == candidate ) {
+                    // the first page starts with a syscall instruction for later injected calls
+                    auto const first{ scratch.empty() };
+                    if ( first ) write_memory( candidate, syscall_instruction );
+                    scratch.add_page( candidate, first ? 1 : 0 );
+                    return scratch.take_slot( near, count );
                 }
-            } else if ( args[ 1 ] == "write" || is_prefix( args[ 1 ], "w" ) ) {
-                std::cout << "Setting register " << args[ 2 ] << " to value " << std::hex << std::stol( args[ 3 ], 0, 16 ) << '\n';
-                set_register_value( pid, get_register_from_name( args[ 2 ] ), std::stol( args[ 3 ], 0, 16 ) );
-                reload_registers();
+                // kernels before 4.17 take MAP_FIXED_NOREPLACE as a hint only
+                if ( result > 0 ) run_syscall( SYS_munmap, { static_cast< std::uint64_t >( result ), ScratchSpace::page_size, 0, 0, 0, 0 } );
             }
-        } else {
-            std::cerr << "Unknown command\n";
         }
+        return std::nullopt;
     }
 
-    void run()
+    void run_until_stop()
     {
+        step_over_breakpoint( false );
+        resume( PTRACE_CONT );
+
         wait_for_program();
+    }
 
-        do {
-            std::printf( "dbgg> " );
-            if ( std::string line; std::getline( std::cin, line ) ) {
-                handle_command( line );
+    bool require_process()
+    {
+        if ( is_stopped() ) return true;
+        std::cerr << "The process is not running\n";
+        return false;
+    }
+
+    // resumes every thread, or only the selected one in non-stop mode, and returns;
+    // the next stop is reported by the event loop
+    void continue_execution()
+    {
+        if ( !require_process() ) return;
+
+        if ( non_stop ) {
+            continue_thread();
+            return;
+        }
+
+        // a stop collected while stopping the other threads is reported before anything runs again
+        if ( serve_next() ) return;
+
+        if ( !resume_all_threads() ) {
+            report_stop();
+            return;
+        }
+        running = true;
+    }
+
+    // returns false if the selected thread ended while being moved past its breakpoint
+    bool resume_all_threads()
+    {
+        // threads sitting on a breakpoint they have reported are moved past it, the selected one always
+        auto const selected{ current_tid };
+        for ( auto & [ tid, thread ] : threads ) {
+            auto const reason{ thread.last_event.reason };
+            if ( !thread.is_stopped() ) continue;
+            if ( tid != selected && reason != StopReason::breakpoint && reason != StopReason::hardware ) continue;
+            current_tid = tid;
+            step_over_breakpoint( false );
+        }
+        current_tid = selected;
+
+        if ( !is_stopped() ) return false;
+        threads.resume_all( PTRACE_CONT );
+        return true;
+    }
+
+    // non-stop: only the selected thread is resumed, along with the ones held since switching modes,
+    // and the next queued breakpoint hit is served right away
+    void continue_thread()
+    {
+        step_over_breakpoint( false );
+        if ( !is_stopped() ) {
+            report_stop();
+            return;
+        }
+        resume( PTRACE_CONT );
+        for ( auto const tid : std::exchange( held, {} ) ) {
+            resume_quietly( tid );
+        }
+
+        running = true;
+        serve_next();
+    }
+
+    // a parked thread waits with its stop until the user gets to it
+    void park( Thread & thread )
+    {
+        thread.unreported = true;
+        parked.push_back( thread.tid );
+    }
+
+    // selects and reports the oldest parked thread, returns false if there is none
+    bool serve_next()
+    {
+        while ( !parked.empty() ) {
+            auto * const thread{ threads.find( parked.front() ) };
+            parked.pop_front();
+            if ( !thread || !thread->is_stopped() || !thread->unreported ) continue;
+
+            thread->unreported = false;
+            if ( is_stale( *thread ) ) {
+                if ( non_stop ) thread->resume( PTRACE_CONT );
+                continue;
+            }
+            running = false;
+            current_tid = thread->tid;
+            report_stop();
+            return true;
+        }
+        return false;
+    }
+
+    void set_non_stop( bool const on )
+    {
+        if ( on != non_stop ) {
+            non_stop = on;
+            if ( on ) {
+                // everything stopped but the selected thread runs again with the next continue
+                for ( auto & [ tid, thread ] : threads ) {
+                    if ( tid != current_tid && thread.is_stopped() && !thread.unreported ) held.push_back( tid );
+                }
             } else {
+                held.clear();
+                stop_all();
+            }
+        }
+        std::cout << "Non-stop mode is " << ( non_stop ? "on" : "off" ) << '\n';
+    }
+
+    void interrupt_program()
+    {
+        auto * const thread{ threads.first_running() };
+        if ( !running || !thread ) {
+            std::cerr << "The process is not running\n";
+            return;
+        }
+        interrupt_requested = true;
+        thread->interrupt( pid );
+    }
+
+    // batched: every running thread is sent its stop first, then they are collected one by one;
+    // a thread that stopped for another reason on the way is parked, the others are returned
+    std::vector< pid_t > stop_all()
+    {
+        std::vector< pid_t > stopped{};
+        threads.interrupt_all();
+
+        // new threads can show up while waiting, look again until nothing is left running
+        while ( threads.first_running() ) {
+            auto * const thread{ wait_any() };
+            if ( !thread ) {
+                // no child left to wait for, whatever is still marked running is gone
+                for ( auto * gone{ threads.first_running() }; gone; gone = threads.first_running() ) {
+                    gone->state = ThreadState::exited;
+                }
                 break;
             }
-        } while ( true );
+
+            if ( thread->state == ThreadState::exited && thread->tid != pid ) {
+                forget_thread( *thread );
+            } else if ( is_reportable( *thread ) ) {
+                park( *thread );
+            } else {
+                stopped.push_back( thread->tid );
+            }
+        }
+        return stopped;
     }
 
-    void set_breakpoint_at_address( std::intptr_t const addr )
+    void forget_thread( Thread const & thread )
     {
-        std::cout << "Setting breakpoint on: " << std::setfill('0') << std::setw(16) << std::hex << addr << '\n';
-        Breakpoint bp{ pid, addr };
-        bp.enable();
-        breakpoints [ addr ] = bp;
+        auto const tid{ thread.tid };
+        std::cout << "Thread " << std::dec << tid << " exited\n";
+        debug_registers.remove_thread( tid );
+        if ( current_tid == tid ) current_tid = pid;
+        threads.remove( tid );
     }
 
-    void reload_registers()
+    // stops the user is told about, as opposed to the ones the debugger causes for itself
+    bool is_reportable( Thread & thread )
     {
-        for ( auto & r : registers ) {
-            r.value = get_register_value( pid, r.r ) ;
+        switch ( thread.last_event.reason ) {
+            case StopReason::clone:
+                return false;
+            case StopReason::breakpoint:
+                return !is_stale( thread ) && should_stop( thread );
+            case StopReason::hardware:
+                return !is_stale( thread );
+            case StopReason::syscall:
+                return is_caught( thread );
+            case StopReason::syscall_exit:
+                return false;
+            case StopReason::interrupted:
+                return std::exchange( interrupt_requested, false );
+            case StopReason::exited:
+            case StopReason::killed:
+                return thread.tid == pid;
+            default:
+                return true;
+        }
+    }
+
+    // a breakpoint hit whose breakpoint has been deleted since, by a command run while the thread was
+    // already on its way into it or while its stop was waiting to be served
+    bool is_stale( Thread & thread )
+    {
+        if ( thread.last_event.reason == StopReason::breakpoint ) {
+            return !breakpoints.contains( static_cast< std::intptr_t >( registers_of( thread ).get( Register::rip ) ) );
+        }
+        if ( thread.last_event.reason == StopReason::hardware ) {
+            for ( std::size_t slot{}; slot < DebugRegisters::slot_count; ++slot ) {
+                if ( ( thread.debug_status & ( 1U << slot ) ) && debug_registers[ slot ] ) return false;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    // the filters cannot be taken out again, so a system call can trap without being caught any more
+    bool is_caught( Thread & thread )
+    {
+        return caught_syscalls.contains( static_cast< long >( registers_of( thread ).get( Register::orig_rax ) ) );
+    }
+
+    // evaluated once per hit, against the registers fetched when the hit was classified
+    bool should_stop( Thread & thread )
+    {
+        auto & regs{ registers_of( thread ) };
+        auto const addr{ static_cast< std::intptr_t >( regs.get( Register::rip ) ) };
+        if ( coverage.is_active() && take_coverage_hit( addr ) ) return false;
+        auto * const bp{ breakpoints.find( addr ) };
+        return !bp || bp->hit( regs.raw(), memory );
+    }
+
+    // notes that `addr` ran; a breakpoint only there for the coverage has done its job and goes,
+    // instead of being stepped over and put back, returns whether it did
+    bool take_coverage_hit( std::intptr_t const addr )
+    {
+        coverage.mark( addr );
+        if ( !coverage.is_armed( addr ) ) return false;
+        coverage.disown( addr );
+        breakpoints.remove( addr, memory );
+        // other threads can already be on their way into the int3, their trap is still ours
+        retired.insert( addr );
+        return true;
+    }
+
+    // a state change of any thread, seen by the event loop
+    void on_thread_event( Thread & thread )
+    {
+        auto const & event{ thread.last_event };
+
+        if ( event.reason == StopReason::clone ) {
+            std::cout << "New thread " << std::dec << event.message << '\n';
+        } else if ( event.has_ended() && thread.tid != pid ) {
+            forget_thread( thread );
+            return;
+        }
+
+        if ( !is_reportable( thread ) ) {
+            // in non-stop mode only threads with something to report stay stopped
+            if ( running || non_stop ) resume_quietly( thread.tid );
+            // stopping the others to step past a breakpoint can turn up a stop to report
+            if ( running && !non_stop && !parked.empty() ) {
+                running = false;
+                stop_all();
+                serve_next();
+                prompt();
+                run_commands();
+            }
+            return;
+        }
+        if ( non_stop && thread.is_stopped() ) {
+            park( thread );
+            if ( running && serve_next() ) {
+                prompt();
+                run_commands();
+            }
+            return;
+        }
+        if ( !running ) {
+            if ( thread.is_stopped() ) park( thread );
+            return;
+        }
+
+        running = false;
+        current_tid = thread.tid;
+        if ( event.has_ended() ) {
+            threads.retain_leader();
+        } else {
+            stop_all();
+        }
+        report_stop();
+        prompt();
+        run_commands();
+    }
+
+    // stops every thread `hz` times a second for `seconds` and records its stack, unwound through
+    // the CFI; the result is written as folded stacks, one "outer;...;leaf count" per line
+    void profile( unsigned const hz, double const seconds, std::string const & output )
+    {
+        if ( !require_process() ) return;
+        if ( serve_next() ) return;
+
+        auto const timer{ timerfd_create( CLOCK_MONOTONIC, TFD_CLOEXEC ) };
+        if ( timer < 0 ) {
+            std::cerr << "Cannot create a timer\n";
+            return;
+        }
+        auto const period_ns{ 1'000'000'000LL / hz };
+        itimerspec spec{};
+        spec.it_interval.tv_sec = period_ns / 1'000'000'000LL;
+        spec.it_interval.tv_nsec = period_ns % 1'000'000'000LL;
+        spec.it_value = spec.it_interval;
+
+        // read up front too, in case the process is gone by the end
+        auto regions{ read_memory_maps( pid ) };
+        unwinder.refresh( regions );
+        load_address();
+        auto const is_mapped{ [&regions]( std::uint64_t const addr ) {
+            return std::any_of( std::begin( regions ), std::end( regions ), [addr]( auto const & r ) { return addr >= r.start && addr < r.end; } );
+        } };
+        StackHistogram histogram{};
+        std::array< std::uint64_t, StackHistogram::max_depth > stack{};
+        std::uint64_t samples{};
+        auto const ticks{ static_cast< std::uint64_t >( hz * seconds ) };
+
+        if ( resume_all_threads() ) {
+            timerfd_settime( timer, 0, &spec, nullptr );
+            for ( std::uint64_t tick{}; tick < ticks; ) {
+                // missed expirations are not made up for, the profile just gets fewer samples
+                std::uint64_t expirations{};
+                if ( read( timer, &expirations, sizeof( expirations ) ) != sizeof( expirations ) ) break;
+                tick += expirations;
+
+                stop_all();
+                for ( auto & [ tid, thread ] : threads ) {
+                    if ( !thread.is_stopped() ) continue;
+                    auto const & regs{ registers_of( thread ).raw() };
+                    // the libraries are mapped after the profile started (or one got loaded since)
+                    if ( !is_mapped( regs.rip ) ) {
+                        regions = read_memory_maps( pid );
+                        unwinder.refresh( regions );
+                    }
+                    auto const depth{ unwinder.unwind( memory, regs, stack ) };
+                    histogram.add( std::span{ stack }.first( depth ) );
+                    ++samples;
+                }
+
+                // a breakpoint, a signal or the end of the process cuts the profile short
+                if ( !parked.empty() || !is_stopped() || tick >= ticks ) break;
+                if ( !resume_all_threads() ) break;
+            }
+        }
+        close( timer );
+
+        if ( is_stopped() ) regions = read_memory_maps( pid );
+        write_profile( histogram, samples, regions, output );
+
+        if ( non_stop ) {
+            for ( auto & [ tid, thread ] : threads ) {
+                if ( tid != current_tid && thread.is_stopped() && !thread.unreported ) held.push_back( tid );
+            }
+        }
+        if ( !serve_next() ) report_stop();
+    }
+
+    void write_profile( StackHistogram const & histogram, std::uint64_t const samples, std::span< MemoryRegion const > const regions, std::string const & output )
+    {
+        // stacks that only differ inside a function are the same stack once symbolized
+        std::map< std::string, std::uint64_t > folded{};
+        histogram.for_each( [&]( std::span< std::uint64_t const > stack, std::uint64_t const count ) {
+            // code without CFI is unwound through rbp, and code built without frame pointers leaves
+            // it holding anything; the walk went astray at the first return address that is not
+            // in executable memory
+            for ( std::size_t i{ 1 }; i < stack.size(); ++i ) {
+                auto const region{ std::find_if( std::begin( regions ), std::end( regions ), [addr = stack[ i ]]( auto const & r ) { return addr >= r.start && addr < r.end; } ) };
+                if ( region == std::end( regions ) || !region->executable ) {
+                    stack = stack.first( i );
+                    break;
+                }
+            }
+
+            std::string line{};
+            // return addresses point past the call, the call itself is what belongs to the caller
+            for ( auto i{ stack.size() }; i-- > 0; ) {
+                if ( !line.empty() ) line += ';';
+                line += frame_name( i == 0 ? stack[ i ] : stack[ i ] - 1, regions );
+            }
+            folded[ line ] += count;
+        } );
+
+        std::ofstream file{};
+        if ( !output.empty() ) {
+            file.open( output );
+            if ( !file ) {
+                std::cerr << "Cannot open '" << output << "'\n";
+                return;
+            }
+        }
+        auto & out{ output.empty() ? std::cout : file };
+        for ( auto const & [ line, count ] : folded ) {
+            out << line << ' ' << std::dec << count << '\n';
+        }
+
+        std::cout << "Collected " << std::dec << samples << " samples, " << folded.size() << " distinct stacks";
+        if ( auto const dropped{ histogram.dropped_samples() }; dropped ) {
+            std::cout << " (" << dropped << " dropped)";
+        }
+        if ( !output.empty() ) {
+            std::cout << ", written to " << output;
+        }
+        std::cout << '\n';
+    }
+
+    // the executable's symbol covering `addr`, otherwise the file it is mapped from
+    std::string frame_name( std::uint64_t const addr, std::span< MemoryRegion const > const regions )
+    {
+        auto const base{ load_address() };
+        if ( addr >= base ) {
+            if ( auto const symbol{ symbols.find_symbol( addr - base ) }; symbol ) return std::string{ symbol->name };
+        }
+        for ( auto const & region : regions ) {
+            if ( addr >= region.start && addr < region.end && !region.path.empty() ) {
+                return '[' + std::filesystem::path{ region.path }.filename().string() + ']';
+            }
+        }
+
+        std::ostringstream ss{};
+        ss << "0x" << std::hex << addr;
+        return ss.str();
+    }
+
+    // the call stack of the selected thread, innermost frame first
+    void backtrace( std::size_t const max_frames )
+    {
+        if ( !require_process() ) return;
+
+        auto const regions{ read_memory_maps( pid ) };
+        unwinder.refresh( regions );
+        std::vector< std::uint64_t > frames( max_frames );
+        frames.resize( unwinder.unwind( memory, current_registers().raw(), frames ) );
+
+        for ( std::size_t i{}; i < frames.size(); ++i ) {
+            auto const pc{ frames[ i ] };
+            std::cout << '#' << std::dec << i << "  0x" << std::setfill('0') << std::setw(16) << std::hex << pc;
+
+            if ( auto const symbol{ describe_address( pc ) }; !symbol.empty() ) {
+                std::cout << symbol;
+            } else {
+                std::cout << " in " << frame_name( pc, regions );
+            }
+            // return addresses point past the call, the line of the call is the one before
+            if ( auto const source{ source_location( i == 0 ? pc : pc - 1 ) }; source ) {
+                std::cout << " at " << std::filesystem::path{ source->file }.lexically_normal().string() << ':' << std::dec << source->line;
+            }
+            std::cout << '\n';
+        }
+    }
+
+    void select_thread( pid_t const tid )
+    {
+        auto const * const thread{ threads.find( tid ) };
+        if ( !thread || !thread->is_stopped() ) {
+            std::cerr << "No stopped thread " << std::dec << tid << '\n';
+            return;
         }
+        current_tid = tid;
+        std::cout << "Switched to thread " << std::dec << tid << '\n';
+        report_location();
+    }
+
+    void list_threads()
+    {
+        for ( auto & [ tid, thread ] : threads ) {
+            std::cout << ( tid == current_tid ? "* " : "  " ) << std::dec << tid;
+            if ( thread.is_stopped() ) {
+                auto const pc{ registers_of( thread ).get( Register::rip ) };
+                std::cout << " stopped at 0x" << std::setfill('0') << std::setw(16) << std::hex << pc << describe_address( pc );
+            } else {
+                std::cout << ( thread.state == ThreadState::running ? " running" : " exited" );
+            }
+            std::cout << '\n';
+        }
+    }
+
+    void single_step_instruction()
+    {
+        if ( !step_over_breakpoint() ) {
+            resume( PTRACE_SINGLESTEP );
+            wait_for_program();
+        }
+        // a tracepoint's trampoline is stepped through as if it were the instructions it replaced
+        if ( !is_stopped() || !in_trampoline( get_pc() ) ) return;
+        while ( is_stopped() && current_thread().last_event.reason == StopReason::single_step && in_trampoline( get_pc() ) ) {
+            resume( PTRACE_SINGLESTEP );
+            wait_for_program();
+        }
+        // its pushfq saved the trap flag of the step, and popfq put it back for good
+        if ( is_stopped() ) set_register( Register::eflags, get_register( Register::eflags ) & ~trap_flag );
+    }
+
+    // runs until `addr` is reached in a frame above `sp`, or anything else stops the tracee
+    void run_to_return( std::uint64_t const addr, std::uint64_t const sp )
+    {
+        auto const temporary{ !breakpoints.contains( static_cast< std::intptr_t >( addr ) ) };
+        if ( temporary ) {
+            breakpoints.stage_enable( static_cast< std::intptr_t >( addr ) );
+            breakpoints.apply( memory );
+        }
+
+        do {
+            run_until_stop();
+        } while ( is_stopped() && get_pc() == addr && get_register( Register::rsp ) <= sp );
+
+        if ( temporary && is_stopped() ) {
+            breakpoints.stage_remove( static_cast< std::intptr_t >( addr ) );
+            breakpoints.apply( memory );
+        }
+    }
+
+    std::optional< SourceLocation > source_location( std::uint64_t const addr )
+    {
+        auto const base{ load_address() };
+        if ( addr < base ) return std::nullopt;
+
+        auto location{ lines.find_location( addr - base ) };
+        if ( location ) location->addr += base;
+        return location;
+    }
+
+    // single-steps until the start of another source line, stepping over calls if `over_calls`
+    void step_line( bool const over_calls )
+    {
+        if ( !require_process() ) return;
+
+        auto const start{ source_location( get_pc() ) };
+        if ( !start ) {
+            std::cerr << "No line information here, stepping a single instruction\n";
+            single_step_instruction();
+            report_stop();
+            return;
+        }
+
+        while ( true ) {
+            auto const pc{ get_pc() };
+            auto const sp{ get_register( Register::rsp ) };
+
+            single_step_instruction();
+            if ( !is_stopped() ) break;
+
+            // a call just pushed a return address pointing right past itself
+            auto const new_sp{ get_register( Register::rsp ) };
+            std::uint64_t return_addr{};
+            auto const entered_call{ new_sp == sp - 8 && memory.read_value( static_cast< std::intptr_t >( new_sp ), return_addr ) && return_addr > pc && return_addr <= pc + 16 };
+
+            auto location{ source_location( get_pc() ) };
+            if ( entered_call && ( over_calls || !location ) ) {
+                run_to_return( return_addr, new_sp );
+                if ( !is_stopped() || get_pc() != return_addr ) break;
+                location = source_location( get_pc() );
+            }
+            if ( !location ) {
+                // returned into code without line information, nothing left to step through
+                run_until_stop();
+                break;
+            }
+            if ( location->is_stmt && location->addr == get_pc() && ( location->line != start->line || location->file != start->file ) ) break;
+        }
+        report_stop();
+    }
+
+    void report_stop()
+    {
+        drain_traces();
+        recording.flush();
+        if ( current_thread().tid == pid && current_thread().last_event.has_ended() ) finish_coverage( false );
+        if ( batch ) {
+            emit_stop();
+            return;
+        }
+
+        auto const & thread{ current_thread() };
+        auto const & event{ thread.last_event };
+
+        switch ( event.reason ) {
+            case StopReason::exited:
+                std::cout << ( thread.tid == pid ? "Process" : "Thread" ) << " exited with status " << std::dec << event.exit_code << '\n';
+                return;
+            case StopReason::killed:
+                std::cout << ( thread.tid == pid ? "Process" : "Thread" ) << " terminated by signal " << std::dec << event.signal << " (" << strsignal( event.signal ) << ")\n";
+                return;
+            case StopReason::signal:
+                std::cout << "Received signal " << std::dec << event.signal << " (" << strsignal( event.signal ) << ")\n";
+                break;
+            case StopReason::interrupted:
+                std::cout << "Interrupted\n";
+                break;
+            case StopReason::exec:
+                std::cout << "Process " << std::dec << pid << " is executing " << prog_name << '\n';
+                break;
+            case StopReason::clone:
+                std::cout << "New thread " << std::dec << event.message << '\n';
+                break;
+            case StopReason::syscall:
+                std::cout << "Caught syscall " << describe_syscall( current_registers().raw() ) << '\n';
+                break;
+            case StopReason::breakpoint:
+                if ( auto const * const bp{ breakpoints.find( static_cast< std::intptr_t >( get_pc() ) ) }; bp && bp->condition_failed ) {
+                    std::cout << "Cannot evaluate '" << bp->condition.text << "', stopping\n";
+                }
+                break;
+            default:
+                break;
+        }
+
+        for ( std::size_t slot{}; slot < DebugRegisters::slot_count; ++slot ) {
+            if ( ( thread.debug_status & ( 1U << slot ) ) && debug_registers[ slot ] ) {
+                report_hardware_breakpoint( slot, *debug_registers[ slot ] );
+            }
+        }
+        report_location();
+    }
+
+    // {"event":"stop",...}, the batch mode counterpart of report_stop()
+    void emit_stop()
+    {
+        auto & thread{ current_thread() };
+        auto const & event{ thread.last_event };
+
+        json.begin( "stop" ).field( "reason", describe( event.reason ) ).field( "tid", thread.tid );
+        switch ( event.reason ) {
+            case StopReason::exited:
+                json.field( "exit_code", event.exit_code ).end();
+                return;
+            case StopReason::killed:
+                json.field( "signal", event.signal ).end();
+                return;
+            case StopReason::signal:
+                json.field( "signal", event.signal );
+                break;
+            case StopReason::clone:
+                json.field( "thread", static_cast< std::int64_t >( event.message ) );
+                break;
+            case StopReason::syscall:
+                json.field( "syscall", describe_syscall( registers_of( thread ).raw() ) );
+                break;
+            default:
+                break;
+        }
+        for ( std::size_t slot{}; slot < DebugRegisters::slot_count; ++slot ) {
+            if ( ( thread.debug_status & ( 1U << slot ) ) && debug_registers[ slot ] ) json.field( "slot", static_cast< std::int64_t >( slot ) );
+        }
+
+        auto const pc{ get_pc() };
+        json.hex( "pc", pc );
+        if ( auto const name{ symbol_name( pc ) }; !name.empty() ) json.field( "symbol", name );
+        if ( auto const source{ source_location( pc ) }; source ) {
+            json.field( "file", std::filesystem::path{ source->file }.lexically_normal().string() ).field( "line", static_cast< std::int64_t >( source->line ) );
+        }
+        json.end();
+    }
+
+    void report_location()
+    {
+        if ( threads.size() > 1 ) {
+            std::cout << "Thread " << std::dec << current_tid << ' ';
+        }
+        auto const location{ get_pc() };
+        std::cout << "Stopped at 0x" << std::setfill('0') << std::setw(16) << std::hex << location << describe_address( location ) << '\n';
+
+        if ( auto const source{ source_location( location ) }; source ) {
+            print_source_line( *source );
+        }
+    }
+
+    void report_hardware_breakpoint( std::size_t const slot, HardwareBreakpoint const & bp )
+    {
+        if ( !bp.is_watchpoint() ) {
+            std::cout << "Hardware breakpoint " << std::dec << slot << " hit\n";
+            return;
+        }
+
+        std::uint64_t value{};
+        memory.read_memory( bp.addr, std::as_writable_bytes( std::span{ &value, 1 } ).first( bp.len ) );
+        std::cout << "Watchpoint " << std::dec << slot << " triggered, 0x" << std::hex << bp.addr
+                  << " = 0x" << std::setfill('0') << std::setw( bp.len * 2 ) << value << '\n';
+    }
+
+    void print_source_line( SourceLocation const & location )
+    {
+        auto const path{ std::filesystem::path{ location.file }.lexically_normal().string() };
+
+        auto it{ sources.find( path ) };
+        if ( it == std::end( sources ) ) {
+            std::vector< std::string > text{};
+            std::ifstream in{ path };
+            for ( std::string line; std::getline( in, line ); ) {
+                text.push_back( std::move( line ) );
+            }
+            it = sources.emplace( path, std::move( text ) ).first;
+        }
+
+        std::cout << path << ':' << std::dec << location.line;
+        if ( location.line >= 1 && location.line <= it->second.size() ) {
+            std::cout << '\t' << it->second[ location.line - 1 ];
+        }
+        std::cout << '\n';
+    }
+
+    // runtime address the executable is mapped at, 0 unless it is position independent
+    std::uint64_t load_address()
+    {
+        if ( load_base ) return *load_base;
+        if ( !elf.is_valid() || !elf.is_position_independent() ) return *( load_base = 0 );
+
+        std::error_code ec{};
+        auto const path{ std::filesystem::canonical( prog_name, ec ) };
+        for ( auto const & region : read_memory_maps( pid ) ) {
+            if ( region.offset == 0 && region.path == path.string() ) {
+                return *( load_base = region.start );
+            }
+        }
+        return 0;
+    }
+
+    // symbol name, file:line or hex address
+    std::optional< std::intptr_t > resolve_location( std::string_view const location )
+    {
+        if ( auto const addr{ symbols.find_address( location ) }; addr ) {
+            return static_cast< std::intptr_t >( *addr + load_address() );
+        }
+
+        if ( auto const colon{ location.rfind( ':' ) }; colon != std::string::npos ) {
+            std::uint32_t line{};
+            auto const * const last{ location.data() + location.size() };
+            auto const [ ptr, ec ]{ std::from_chars( location.data() + colon + 1, last, line ) };
+            if ( ec == std::errc{} && ptr == last ) {
+                auto const addr{ lines.find_address( location.substr( 0, colon ), line ) };
+                if ( !addr ) return std::nullopt;
+                return static_cast< std::intptr_t >( *addr + load_address() );
+            }
+        }
+
+        return parse_address( location );
+    }
+
+    // " <symbol+offset>", or nothing if the address is not covered by a symbol
+    std::string describe_address( std::uint64_t const addr )
+    {
+        auto const name{ symbol_name( addr ) };
+        return name.empty() ? name : " <" + name + '>';
+    }
+
+    // "symbol" or "symbol+offset", empty outside of the executable's symbols
+    std::string symbol_name( std::uint64_t const addr )
+    {
+        auto const base{ load_address() };
+        if ( addr < base ) return {};
+
+        auto const symbol{ symbols.find_symbol( addr - base ) };
+        if ( !symbol ) return {};
+
+        auto name{ std::string{ symbol->name } };
+        if ( auto const offset{ addr - base - symbol->addr }; offset ) {
+            name += '+' + std::to_string( offset );
+        }
+        return name;
+    }
+
+    // resolves every location, reporting the ones that are neither a symbol nor an address
+    std::vector< std::intptr_t > resolve_locations( std::span< std::string_view const > const locations )
+    {
+        std::vector< std::intptr_t > addrs{};
+        addrs.reserve( locations.size() );
+        for ( auto const & location : locations ) {
+            if ( auto const addr{ resolve_location( location ) }; addr ) {
+                addrs.push_back( *addr );
+            } else {
+                std::cerr << "Cannot resolve '" << location << "'\n";
+            }
+        }
+        return addrs;
+    }
+
+    void handle_command( std::string_view const line )
+    {
+        Tokens const args{ line };
+        if ( args.empty() ) return;
+        if ( args.too_many() ) {
+            std::cerr << "Too many words, at most " << std::dec << Tokens::max_tokens << '\n';
+            return;
+        }
+
+        auto const command{ find_command( args[ 0 ] ) };
+        if ( !command ) {
+            if ( auto const candidates{ commands_starting_with( args[ 0 ] ) }; candidates.size() > 1 ) {
+                std::cerr << "Ambiguous command '" << args[ 0 ] << "':";
+                for ( auto const name : candidates ) std::cerr << ' ' << name;
+                std::cerr << '\n';
+            } else {
+                std::cerr << "Unknown command\n";
+            }
+            return;
+        }
+
+        switch ( *command ) {
+            case Command::continue_:
+                continue_execution();
+                break;
+            case Command::interrupt:
+                interrupt_program();
+                break;
+            case Command::thread: {
+                auto const tid{ args.size() == 2 ? parse_number< pid_t >( args[ 1 ], 10 ) : std::nullopt };
+                if ( !tid ) {
+                    std::cerr << "Invalid number of args. Usage: thread <tid>\n";
+                    return;
+                }
+                select_thread( *tid );
+                break;
+            }
+            case Command::threads:
+                list_threads();
+                break;
+            case Command::backtrace: {
+                auto const frames{ args.size() == 2 ? parse_number< std::size_t >( args[ 1 ], 10 ) : std::optional< std::size_t >{ 64 } };
+                if ( args.size() > 2 || !frames ) {
+                    std::cerr << "Invalid number of args. Usage: backtrace [max frames]\n";
+                    return;
+                }
+                backtrace( *frames );
+                break;
+            }
+            case Command::profile: {
+                std::optional< unsigned > hz{ 99 };
+                std::optional< double > seconds{ 5 };
+                std::string_view output{};
+                for ( std::size_t i{ 1 }; i < args.size(); i += 2 ) {
+                    if ( i + 1 >= args.size() || ( args[ i ] != "--hz" && args[ i ] != "--duration" && args[ i ] != "--output" ) ) {
+                        std::cerr << "Invalid args. Usage: profile [--hz N] [--duration S] [--output file]\n";
+                        return;
+                    }
+                    if ( args[ i ] == "--hz" ) hz = parse_number< unsigned >( args[ i + 1 ], 10 );
+                    else if ( args[ i ] == "--duration" ) seconds = parse_number< double >( args[ i + 1 ] );
+                    else output = args[ i + 1 ];
+                }
+                if ( !hz || !seconds || *hz == 0 || *hz > 10000 || *seconds <= 0 ) {
+                    std::cerr << "The rate has to be between 1 and 10000 Hz, and the duration positive\n";
+                    return;
+                }
+                profile( *hz, *seconds, std::string{ output } );
+                break;
+            }
+            case Command::stats:
+                if ( args.size() > 2 || ( args.size() == 2 && !is_prefix( args[ 1 ], "reset" ) ) ) {
+                    std::cerr << "Invalid args. Usage: stats [reset]\n";
+                    return;
+                }
+                if constexpr ( !stats_enabled ) {
+                    std::cerr << "Built without statistics, rebuild with -DDEBUGGER_STATS (the CMake option STAGE_FOUR_STATS)\n";
+                    return;
+                }
+                if ( args.size() == 2 ) {
+                    reset_stats();
+                } else if ( batch ) {
+                    emit_stats();
+                } else {
+                    print_stats();
+                }
+                break;
+            case Command::non_stop:
+                if ( args.size() != 2 || ( args[ 1 ] != "on" && args[ 1 ] != "off" ) ) {
+                    std::cerr << "Invalid number of args. Usage: non-stop <on|off>\n";
+                    return;
+                }
+                set_non_stop( args[ 1 ] == "on" );
+                break;
+            case Command::step:
+                step_line( false );
+                break;
+            case Command::next:
+                step_line( true );
+                break;
+            case Command::stepi:
+                if ( !require_process() ) return;
+                single_step_instruction();
+                report_stop();
+                break;
+            case Command::break_: {
+                auto const condition{ std::find( std::begin( args ), std::end( args ), "if" ) };
+                if ( args.size() < 2 || ( condition != std::end( args ) && ( condition != std::begin( args ) + 2 || condition + 1 == std::end( args ) ) ) ) {
+                    std::cerr << "Invalid number of args. Usage: break <function|file:line|addr> [...] or break <location> if <expr>\n";
+                    return;
+                }
+                if ( condition != std::end( args ) ) {
+                    set_conditional_breakpoint( args[ 1 ], args.rest( 3 ) );
+                    return;
+                }
+                set_breakpoints_at_addresses( resolve_locations( args.from( 1 ) ) );
+                break;
+            }
+            case Command::break_file:
+                if ( args.size() != 2 ) {
+                    std::cerr << "Invalid number of args. Usage: break-file <file with hex addresses>\n";
+                    return;
+                }
+                set_breakpoints_from_file( std::string{ args[ 1 ] } );
+                break;
+            case Command::hbreak: {
+                if ( args.size() != 2 ) {
+                    std::cerr << "Invalid number of args. Usage: hbreak <function|file:line|addr>\n";
+                    return;
+                }
+                auto const addr{ resolve_location( args[ 1 ] ) };
+                if ( !addr ) {
+                    std::cerr << "Cannot resolve '" << args[ 1 ] << "'\n";
+                    return;
+                }
+                set_hardware_breakpoint( { *addr, 1, HardwareCondition::execute } );
+                break;
+            }
+            case Command::watch: {
+                if ( args.size() != 4 ) {
+                    std::cerr << "Invalid number of args. Usage: watch <addr> <len> <r|w|rw>\n";
+                    return;
+                }
+                auto const addr{ resolve_location( args[ 1 ] ) };
+                if ( !addr ) {
+                    std::cerr << "Cannot resolve '" << args[ 1 ] << "'\n";
+                    return;
+                }
+                auto const len{ parse_number< std::uint8_t >( args[ 2 ] ) };
+                if ( !len ) {
+                    std::cerr << "Invalid length '" << args[ 2 ] << "'\n";
+                    return;
+                }
+                if ( args[ 3 ] != "r" && args[ 3 ] != "w" && args[ 3 ] != "rw" ) {
+                    std::cerr << "Unknown watch kind '" << args[ 3 ] << "', expected r, w or rw\n";
+                    return;
+                }
+                // x86 cannot trap on reads only, r and rw are the same
+                auto const condition{ args[ 3 ] == "w" ? HardwareCondition::write : HardwareCondition::read_write };
+                set_hardware_breakpoint( { *addr, *len, condition } );
+                break;
+            }
+            case Command::delete_:
+                remove_breakpoints( resolve_locations( args.from( 1 ) ) );
+                break;
+            case Command::breakpoints:
+                list_breakpoints();
+                break;
+            case Command::condition:
+                if ( args.size() < 2 ) {
+                    std::cerr << "Invalid number of args. Usage: condition <function|file:line|addr> [expr]\n";
+                    return;
+                }
+                set_condition( args[ 1 ], args.rest( 2 ) );
+                break;
+            case Command::ignore: {
+                auto const count{ args.size() == 3 ? parse_number< std::uint64_t >( args[ 2 ] ) : std::nullopt };
+                if ( !count ) {
+                    std::cerr << "Invalid number of args. Usage: ignore <function|file:line|addr> <count>\n";
+                    return;
+                }
+                set_ignore_count( args[ 1 ], *count );
+                break;
+            }
+            case Command::trace:
+                if ( args.size() < 3 ) {
+                    std::cerr << "Invalid number of args. Usage: trace <function|file:line|addr> <reg> [...]\n";
+                    return;
+                }
+                set_tracepoint( args[ 1 ], args.from( 2 ) );
+                break;
+            case Command::untrace:
+                if ( args.size() != 2 ) {
+                    std::cerr << "Invalid number of args. Usage: untrace <function|file:line|addr>\n";
+                    return;
+                }
+                remove_tracepoint( args[ 1 ] );
+                break;
+            case Command::tracepoints:
+                list_tracepoints();
+                break;
+            case Command::coverage:
+                if ( args.size() == 1 ) {
+                    show_coverage();
+                } else if ( args.size() == 2 && is_prefix( args[ 1 ], "stop" ) ) {
+                    finish_coverage( true );
+                } else if ( args.size() == 3 && ( is_prefix( args[ 1 ], "functions" ) || is_prefix( args[ 1 ], "lines" ) ) ) {
+                    start_coverage( is_prefix( args[ 1 ], "functions" ) ? CoverageKind::functions : CoverageKind::lines, std::string{ args[ 2 ] } );
+                } else {
+                    std::cerr << "Invalid args. Usage: coverage [<functions|lines> <report file>|stop]\n";
+                }
+                break;
+            case Command::catch_:
+            case Command::uncatch:
+                if ( args.size() < 2 || args[ 1 ] != "syscall" ) {
+                    std::cerr << "Invalid args. Usage: " << args[ 0 ] << " syscall [name|number] [...]\n";
+                    return;
+                }
+                if ( *command == Command::catch_ ) {
+                    catch_syscalls( args.from( 2 ) );
+                } else {
+                    uncatch_syscalls( args.from( 2 ) );
+                }
+                break;
+            case Command::record:
+            case Command::replay:
+                if ( args.size() != 2 ) {
+                    std::cerr << "Invalid number of args. Usage: " << args[ 0 ] << " <file>|stop\n";
+                    return;
+                }
+                if ( args[ 1 ] == "stop" ) {
+                    stop_recording();
+                } else if ( *command == Command::record ) {
+                    start_recording( std::string{ args[ 1 ] } );
+                } else {
+                    start_replay( std::string{ args[ 1 ] } );
+                }
+                break;
+            case Command::checkpoint:
+                take_checkpoint();
+                break;
+            case Command::checkpoints:
+                list_checkpoints();
+                break;
+            case Command::restart: {
+                auto const id{ args.size() == 2 ? parse_number< std::uint32_t >( args[ 1 ], 10 ) : std::nullopt };
+                if ( !id ) {
+                    std::cerr << "Invalid number of args. Usage: restart <checkpoint>\n";
+                    return;
+                }
+                restart_from_checkpoint( *id );
+                break;
+            }
+            case Command::register_:
+                if ( args.size() == 1 ) {
+                    std::cerr << "Invalid number of args. Usage: register <print/read/write> [reg name]\n";
+                    return;
+                }
+                if ( !require_process() ) return;
+                if ( is_prefix( args[ 1 ], "print" ) ) {
+                    if ( batch ) {
+                        emit_registers();
+                    } else {
+                        print_registers();
+                    }
+                } else if ( is_prefix( args[ 1 ], "read" ) ) {
+                    auto const r{ args.size() == 3 ? get_register_from_name( args[ 2 ] ) : std::nullopt };
+                    if ( !r ) {
+                        std::cerr << "Cannot find register '" << ( args.size() > 2 ? args[ 2 ] : "" ) << "'\n";
+                        return;
+                    }
+                    auto const value{ get_register( *r ) };
+                    if ( batch ) {
+                        json.begin( "register" ).field( "tid", current_tid ).field( "name", args[ 2 ] ).hex( "value", value ).end();
+                        return;
+                    }
+                    std::cout << std::setw(16) << std::hex << value;
+                    if ( *r == Register::rip ) std::cout << describe_address( value );
+                    std::cout << '\n';
+                } else if ( is_prefix( args[ 1 ], "write" ) ) {
+                    auto const r{ args.size() == 4 ? get_register_from_name( args[ 2 ] ) : std::nullopt };
+                    auto const value{ args.size() == 4 ? parse_address( args[ 3 ] ) : std::nullopt };
+                    if ( !r || !value ) {
+                        std::cerr << "Invalid args. Usage: register write <reg name> <hex value>\n";
+                        return;
+                    }
+                    std::cout << "Setting register " << args[ 2 ] << " to value " << std::hex << *value << '\n';
+                    set_register( *r, static_cast< std::uint64_t >( *value ) );
+                } else {
+                    std::cerr << "Invalid args. Usage: register <print/read/write> [reg name]\n";
+                }
+                break;
+            case Command::find: {
+                std::string error{};
+                std::string_view rest{};
+                auto const pattern{ args.size() > 1 ? parse_pattern( args.rest( 1 ), rest, error ) : std::nullopt };
+                Tokens const range{ rest };
+                if ( !pattern || range.size() > 2 ) {
+                    if ( !error.empty() ) std::cerr << "Invalid pattern: " << error << '\n';
+                    std::cerr << "Usage: find <\"text\"|[u8:|u16:|u32:|u64:]number[/mask]|bytes:hex with ?> [<region>|<start> <end|+length>]\n";
+                    return;
+                }
+                find_in_memory( *pattern, range.from( 0 ) );
+                break;
+            }
+            case Command::examine: {
+                if ( args.size() < 2 ) {
+                    std::cerr << "Invalid number of args. Usage: x <addr> [len]\n";
+                    return;
+                }
+                auto const addr{ resolve_location( args[ 1 ] ) };
+                if ( !addr ) {
+                    std::cerr << "Cannot resolve '" << args[ 1 ] << "'\n";
+                    return;
+                }
+                auto const len{ args.size() > 2 ? parse_number< std::size_t >( args[ 2 ] ) : std::optional< std::size_t >{ 64 } };
+                if ( !len ) {
+                    std::cerr << "Invalid length '" << args[ 2 ] << "'\n";
+                    return;
+                }
+                examine_memory( *addr, *len );
+                break;
+            }
+            case Command::dump: {
+                if ( args.size() < 4 ) {
+                    std::cerr << "Invalid number of args. Usage: dump <addr> <len> <file>\n";
+                    return;
+                }
+                auto const addr{ resolve_location( args[ 1 ] ) };
+                if ( !addr ) {
+                    std::cerr << "Cannot resolve '" << args[ 1 ] << "'\n";
+                    return;
+                }
+                auto const len{ parse_number< std::size_t >( args[ 2 ] ) };
+                if ( !len ) {
+                    std::cerr << "Invalid length '" << args[ 2 ] << "'\n";
+                    return;
+                }
+                dump_memory( *addr, *len, std::string{ args[ 3 ] } );
+                break;
+            }
+            case Command::gcore:
+                if ( args.size() != 2 ) {
+                    std::cerr << "Invalid number of args. Usage: gcore <file>\n";
+                    return;
+                }
+                write_core_file( std::string{ args[ 1 ] } );
+                break;
+        }
+    }
+
+    // Serves the terminal (or a script) and the tracee from one epoll loop: stdin
+    // lines are queued while the tracee runs, SIGCHLD and the pidfd report its
+    // stops and its exit, and SIGINT interrupts it instead of killing us.
+    void run()
+    {
+        // a launched tracee is in sync with us from its exec stop on, an attached one is stopped already
+        if ( !attached ) {
+            wait_for_program();
+            if ( is_stopped() ) {
+                instrumented::ptrace( PTRACE_SETOPTIONS, pid, nullptr, tracer_options );
+            }
+        }
+
+        EventLoop loop{};
+        SignalFd signals{ SIGCHLD, SIGINT };
+        auto const tracee_fd{ open_pidfd( pid ) };
+        trace_timer = timerfd_create( CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK );
+        core_event = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+
+        if ( !batch ) loop.add( STDIN_FILENO, [&]{ read_commands( loop ); } );
+        loop.add( signals.get(), [&]{
+            for ( auto sig{ signals.take() }; sig != 0; sig = signals.take() ) {
+                handle_signal( sig );
+            }
+        } );
+        // the trace ring is emptied while the tracee runs, it never stops for a tracepoint
+        if ( trace_timer >= 0 ) {
+            loop.add( trace_timer, [&]{
+                std::uint64_t expirations{};
+                if ( read( trace_timer, &expirations, sizeof( expirations ) ) == sizeof( expirations ) ) drain_traces();
+            } );
+        }
+        // a core file written in the background is done
+        if ( core_event >= 0 ) {
+            loop.add( core_event, [&]{
+                std::uint64_t finished{};
+                if ( read( core_event, &finished, sizeof( finished ) ) == sizeof( finished ) ) finish_core_files( false );
+            } );
+        }
+        // only ever becomes readable once, when the tracee is gone
+        if ( tracee_fd >= 0 ) {
+            loop.add( tracee_fd, [&]{
+                loop.remove( tracee_fd );
+                reap_stops();
+            } );
+        }
+
+        prompt();
+        run_commands();
+        while ( !( input_closed && commands.empty() && !running ) && loop.run_once() ) {}
+        finish_coverage( false );
+        finish_core_files( true );
+        json.flush();
+
+        if ( tracee_fd >= 0 ) close( tracee_fd );
+        if ( trace_timer >= 0 ) close( trace_timer );
+        trace_timer = -1;
+        if ( core_event >= 0 ) close( core_event );
+        core_event = -1;
+    }
+
+    // Seizes every thread of a running process, with the options set right away, and stops them
+    // all. Threads the seized ones start meanwhile are traced through their clone events, the
+    // ones the others start are found by looking again until nothing new turns up.
+    bool attach()
+    {
+        auto const task{ "/proc/" + std::to_string( pid ) + "/task" };
+        for ( auto found{ true }; found; ) {
+            found = false;
+            std::error_code ec{};
+            for ( auto const & entry : std::filesystem::directory_iterator{ task, ec } ) {
+                auto const tid{ static_cast< pid_t >( std::stol( entry.path().filename().string() ) ) };
+                if ( tid == pid ? attached : threads.find( tid ) != nullptr ) continue;
+
+                if ( instrumented::ptrace( PTRACE_SEIZE, tid, nullptr, tracer_options ) != 0 ) {
+                    if ( tid != pid ) continue;   // exited in the meantime
+                    std::cerr << "Cannot attach to " << std::dec << pid << ": " << strerror( errno ) << '\n';
+                    return false;
+                }
+                auto & thread{ tid == pid ? threads.leader() : threads.add( tid ) };
+                thread.interrupt( pid );
+                attached |= tid == pid;
+                found = true;
+            }
+            if ( ec && !attached ) {
+                std::cerr << "Cannot attach to " << std::dec << pid << ": " << ec.message() << '\n';
+                return false;
+            }
+        }
+        stop_all();
+        current_tid = pid;
+
+        std::cout << "Attached to process " << std::dec << pid << " (" << prog_name << ")\n";
+        report_location();
+        return true;
+    }
+
+    // commands come from the script instead of stdin, results go out as JSON lines
+    bool load_script( std::string const & path )
+    {
+        std::ifstream in{ path };
+        if ( !in ) {
+            std::cerr << "Cannot open '" << path << "'\n";
+            return false;
+        }
+        for ( std::string line; std::getline( in, line ); ) {
+            commands.push_back( std::move( line ) );
+        }
+        batch = true;
+        input_closed = true;
+        return true;
+    }
+
+    void prompt()
+    {
+        if ( batch ) return;
+        std::printf( "dbgg> " );
+        std::fflush( stdout );
+    }
+
+    void read_commands( EventLoop & loop )
+    {
+        char buffer[ 4096 ];
+        auto const n{ read( STDIN_FILENO, buffer, sizeof( buffer ) ) };
+        if ( n < 0 && ( errno == EINTR || errno == EAGAIN ) ) return;
+
+        if ( n <= 0 ) {
+            input_closed = true;
+            loop.remove( STDIN_FILENO );
+            if ( !input.empty() ) commands.push_back( std::exchange( input, {} ) );
+        } else {
+            input.append( buffer, static_cast< std::size_t >( n ) );
+        }
+
+        for ( auto newline{ input.find( '\n' ) }; newline != std::string::npos; newline = input.find( '\n' ) ) {
+            auto line{ input.substr( 0, newline ) };
+            input.erase( 0, newline + 1 );
+
+            // the only command that does not wait for the tracee to stop
+            if ( running && line == "interrupt" ) {
+                interrupt_program();
+            } else {
+                commands.push_back( std::move( line ) );
+            }
+        }
+        run_commands();
+    }
+
+    // queued commands run in order, but only while the tracee is stopped
+    void run_commands()
+    {
+        while ( !running && !commands.empty() ) {
+            auto const line{ std::move( commands.front() ) };
+            commands.pop_front();
+
+            handle_command( line );
+            if ( !running ) prompt();
+        }
+        // one write() for everything the commands produced, before waiting on the tracee again
+        json.flush();
+    }
+
+    void handle_signal( int const sig )
+    {
+        if ( sig == SIGCHLD ) {
+            reap_stops();
+        } else if ( sig == SIGINT ) {
+            if ( running ) {
+                interrupt_program();
+            } else {
+                std::cout << '\n';
+                prompt();
+            }
+        }
+    }
+
+    // stops already reaped by a blocking wait still raise SIGCHLD, there is nothing left for those
+    void reap_stops()
+    {
+        for ( auto * thread{ wait_any( WNOHANG ) }; thread; thread = wait_any( WNOHANG ) ) {
+            on_thread_event( *thread );
+        }
+    }
+
+    void set_breakpoint_at_address( std::intptr_t const addr )
+    {
+        set_breakpoints_at_addresses( std::span{ &addr, 1 } );
+    }
+
+    void set_breakpoints_at_addresses( std::span< std::intptr_t const > const addrs, bool const verbose = true )
+    {
+        for ( auto const addr : addrs ) {
+            // an int3 in the middle of a tracepoint's jmp would break it
+            if ( auto const * const tp{ tracepoint_covering( addr ) }; tp ) {
+                std::cerr << "Tracepoint " << std::dec << tp->id << " is in the way of a breakpoint at " << std::setfill('0') << std::setw(16) << std::hex << addr << '\n';
+                continue;
+            }
+            coverage.disown( addr );
+            if ( verbose ) {
+                std::cout << "Setting breakpoint on: " << std::setfill('0') << std::setw(16) << std::hex << addr << '\n';
+            }
+            breakpoints.stage_enable( addr );
+        }
+
+        if ( auto const failed{ breakpoints.apply( memory ) }; failed ) {
+            std::cerr << "Could not set " << std::dec << failed << " breakpoint(s)\n";
+        }
+    }
+
+    void set_conditional_breakpoint( std::string_view const location, std::string_view const text )
+    {
+        auto const addr{ resolve_location( location ) };
+        if ( !addr ) {
+            std::cerr << "Cannot resolve '" << location << "'\n";
+            return;
+        }
+        auto condition{ compile( text ) };
+        if ( !condition ) return;
+
+        set_breakpoint_at_address( *addr );
+        if ( auto * const bp{ breakpoints.find( *addr ) }; bp ) {
+            bp->condition = std::move( *condition );
+        }
+    }
+
+    // an empty `text` makes the breakpoint unconditional again
+    void set_condition( std::string_view const location, std::string_view const text )
+    {
+        auto * const bp{ find_breakpoint( location ) };
+        if ( !bp ) return;
+
+        if ( text.empty() ) {
+            bp->condition = {};
+            std::cout << "Breakpoint at " << std::setfill('0') << std::setw(16) << std::hex << bp->get_address() << " is now unconditional\n";
+            return;
+        }
+        if ( auto condition{ compile( text ) }; condition ) {
+            bp->condition = std::move( *condition );
+        }
+    }
+
+    void set_ignore_count( std::string_view const location, std::uint64_t const count )
+    {
+        if ( auto * const bp{ find_breakpoint( location ) }; bp ) {
+            bp->ignore_count = count;
+            std::cout << "Will ignore the next " << std::dec << count << " hits of the breakpoint at "
+                      << std::setfill('0') << std::setw(16) << std::hex << bp->get_address() << '\n';
+        }
+    }
+
+    Breakpoint * find_breakpoint( std::string_view const location )
+    {
+        auto const addr{ resolve_location( location ) };
+        if ( !addr ) {
+            std::cerr << "Cannot resolve '" << location << "'\n";
+            return nullptr;
+        }
+        auto * const bp{ breakpoints.find( *addr ) };
+        if ( !bp ) {
+            std::cerr << "No breakpoint at '" << location << "'\n";
+        }
+        return bp;
+    }
+
+    // symbols in the condition are resolved now, to where they are loaded in this run
+    std::optional< Condition > compile( std::string_view const text )
+    {
+        auto const resolve{ [this]( std::string_view const name ) -> std::optional< std::uint64_t > {
+            if ( auto const addr{ symbols.find_address( name ) }; addr ) return *addr + load_address();
+            return std::nullopt;
+        } };
+
+        std::string error{};
+        auto condition{ compile_condition( text, resolve, error ) };
+        if ( !condition ) {
+            std::cerr << "Invalid condition '" << text << "': " << error << '\n';
+        }
+        return condition;
+    }
+
+    void list_breakpoints()
+    {
+        std::vector< Breakpoint const * > sorted{};
+        for ( auto const & [ addr, bp ] : breakpoints ) {
+            if ( !coverage.is_armed( addr ) ) sorted.push_back( &bp );
+        }
+        std::sort( std::begin( sorted ), std::end( sorted ), []( auto const * a, auto const * b ) { return a->get_address() < b->get_address(); } );
+
+        for ( auto const * const bp : sorted ) {
+            auto const addr{ static_cast< std::uint64_t >( bp->get_address() ) };
+            std::cout << std::setfill('0') << std::setw(16) << std::hex << addr << describe_address( addr )
+                      << ", hit " << std::dec << bp->hits << " time(s)";
+            if ( bp->ignore_count ) std::cout << ", ignoring the next " << bp->ignore_count;
+            if ( !bp->condition.empty() ) std::cout << ", if " << bp->condition.text;
+            std::cout << '\n';
+        }
+    }
+
+    void set_breakpoints_from_file( std::string const & path )
+    {
+        std::ifstream in{ path };
+        if ( !in ) {
+            std::cerr << "Cannot open '" << path << "'\n";
+            return;
+        }
+
+        std::vector< std::string > locations{};
+        for ( std::string location; in >> location; ) {
+            locations.push_back( std::move( location ) );
+        }
+        std::vector< std::string_view > const views( std::begin( locations ), std::end( locations ) );
+        auto const addrs{ resolve_locations( views ) };
+
+        set_breakpoints_at_addresses( addrs, false );
+        std::cout << "Set " << std::dec << addrs.size() << " breakpoints from " << path << '\n';
+    }
+
+    void set_hardware_breakpoint( HardwareBreakpoint const & bp )
+    {
+        if ( !DebugRegisters::is_valid_length( bp.len ) || bp.addr % bp.len != 0 ) {
+            std::cerr << "Length must be 1, 2, 4 or 8 and the address aligned to it\n";
+            return;
+        }
+        if ( !require_process() ) return;
+
+        std::optional< std::size_t > slot{};
+        std::string error{};
+        with_others_stopped( [&]{ slot = debug_registers.add( bp, error ); } );
+        if ( slot ) {
+            std::cout << ( bp.is_watchpoint() ? "Watchpoint " : "Hardware breakpoint " ) << std::dec << *slot
+                      << " on: " << std::setfill('0') << std::setw(16) << std::hex << bp.addr << '\n';
+        } else {
+            std::cerr << error << '\n';
+        }
+    }
+
+    // no addresses removes every breakpoint, hardware ones included
+    void remove_breakpoints( std::span< std::intptr_t const > const addrs )
+    {
+        std::vector< std::size_t > slots{};
+        for ( std::size_t slot{}; slot < DebugRegisters::slot_count; ++slot ) {
+            if ( !debug_registers[ slot ] ) continue;
+            if ( addrs.empty() || std::find( std::begin( addrs ), std::end( addrs ), debug_registers[ slot ]->addr ) != std::end( addrs ) ) {
+                slots.push_back( slot );
+            }
+        }
+        if ( !slots.empty() ) {
+            with_others_stopped( [&]{
+                for ( auto const slot : slots ) debug_registers.remove( slot );
+            } );
+        }
+
+        std::vector< std::intptr_t > removed{};
+        if ( addrs.empty() ) {
+            for ( auto const & [ addr, bp ] : breakpoints ) {
+                if ( !coverage.is_armed( addr ) ) removed.push_back( addr );
+            }
+        } else {
+            removed.assign( std::begin( addrs ), std::end( addrs ) );
+        }
+        for ( auto const addr : removed ) {
+            breakpoints.stage_remove( addr );
+            // a running thread may already be on its way into the int3, its trap must still be recognised
+            if ( non_stop ) retired.insert( addr );
+        }
+        breakpoints.apply( memory );
+    }
+
+    // forks the tracee where the selected thread is, the fork is kept stopped as a checkpoint
+    void take_checkpoint()
+    {
+        if ( !require_process() ) return;
+
+        // the fork must not be made through a syscall instruction patched over the code
+        if ( scratch.empty() && !scratch_slot( static_cast< std::intptr_t >( get_pc() ) ) ) {
+            std::cerr << "Cannot take a checkpoint, no scratch page in the tracee\n";
+            return;
+        }
+        auto & regs{ current_registers() };
+        regs.write_back( current_tid );
+        auto const saved{ regs.raw() };
+
+        auto const child{ inject_fork( current_tid, memory, saved, scratch.first_page(), tracer_options ) };
+        if ( child < 0 ) {
+            std::cerr << "Cannot fork the tracee\n";
+            return;
+        }
+
+        // the snapshot keeps the original code, whatever is set when it is restarted goes in then
+        Memory copy{ child };
+        breakpoints.restore_all( copy );
+        for ( auto const & [ id, tp ] : tracepoints ) {
+            copy.write_memory( tp.addr, tp.original );
+        }
+
+        Checkpoint checkpoint{ next_checkpoint_id++, child, prog_name, saved, scratch, displaced, filtered_syscalls };
+        std::cout << "Checkpoint " << std::dec << checkpoint.id << ": process " << child << " at 0x"
+                  << std::setfill('0') << std::setw(16) << std::hex << saved.rip << describe_address( saved.rip ) << '\n';
+        if ( threads.size() > 1 ) {
+            std::cout << "Only thread " << std::dec << current_tid << " is in the checkpoint, a fork has no other threads\n";
+        }
+        checkpoints.emplace( checkpoint.id, std::move( checkpoint ) );
+    }
+
+    // Writes a core file of the tracee to `path`. The registers of every thread are taken while
+    // it is stopped, the memory from a fork of it, on a thread of its own: the tracee can go on
+    // as soon as the fork is made. Without a scratch page for the fork the tracee itself is read,
+    // and the command only returns once the file is written.
+    void write_core_file( std::string const & path )
+    {
+        if ( !require_process() ) return;
+
+        CoreProcess process{};
+        pid_t copy{ -1 };
+        with_others_stopped( [&]{
+            auto const add_thread{ [&]( Thread & thread ) {
+                if ( !thread.is_stopped() ) return;
+                CoreThread core{ thread.tid, thread.last_event.signal, registers_of( thread ).raw(), std::nullopt };
+                user_fpregs_struct fpregs{};
+                if ( instrumented::ptrace( PTRACE_GETFPREGS, thread.tid, nullptr, &fpregs ) == 0 ) core.fpregs = fpregs;
+                process.threads.push_back( core );
+            } };
+            add_thread( current_thread() );
+            for ( auto & [ tid, thread ] : threads ) {
+                if ( tid != current_tid ) add_thread( thread );
+            }
+
+            if ( !scratch.empty() || scratch_slot( static_cast< std::intptr_t >( get_pc() ) ) ) {
+                auto & regs{ current_registers() };
+                regs.write_back( current_tid );
+                copy = inject_fork( current_tid, memory, regs.raw(), scratch.first_page(), tracer_options );
+            }
+            // after the fork, which may have mapped the scratch page, the fork has the same maps
+            auto threads_taken{ std::move( process.threads ) };
+            process = read_process_info( pid );
+            process.threads = std::move( threads_taken );
+        } );
+
+        if ( copy > 0 ) {
+            Memory fork_memory{ copy };
+            breakpoints.restore_all( fork_memory );
+            for ( auto const & [ id, tp ] : tracepoints ) {
+                fork_memory.write_memory( tp.addr, tp.original );
+            }
+            core_files.push_back( std::make_unique< BackgroundCore >( path, copy, std::move( process ), core_event ) );
+            if ( !batch ) std::cout << "Writing " << path << " from process " << std::dec << copy << ", a fork of the tracee\n";
+            return;
+        }
+
+        std::cerr << "Cannot fork the tracee, it is read as it is\n";
+        auto const summary{ write_core( path, pid, process, [this]( std::uint64_t const addr, std::span< std::byte > const bytes ) {
+            auto const start{ static_cast< std::intptr_t >( addr ) };
+            breakpoints.restore_original( start, bytes );
+            for ( auto const & [ id, tp ] : tracepoints ) {
+                for ( std::size_t i{}; i < tp.original.size(); ++i ) {
+                    auto const at{ tp.addr + static_cast< std::intptr_t >( i ) };
+                    if ( at >= start && at - start < static_cast< std::intptr_t >( bytes.size() ) ) bytes[ static_cast< std::size_t >( at - start ) ] = tp.original[ i ];
+                }
+            }
+        } ) };
+        report_core_file( path, summary );
+    }
+
+    // reports the core files written in the background, those that are done or with `wait` all
+    // of them, and kills the forks they were written from
+    void finish_core_files( bool const wait )
+    {
+        std::erase_if( core_files, [&]( auto & core ) {
+            if ( !wait && !core->is_done() ) return false;
+            auto const & summary{ core->result() };
+            auto const copy{ core->get_copy() };
+            kill( copy, SIGKILL );
+            for ( int status{}; instrumented::waitpid( copy, &status, __WALL ) == copy && !WIFEXITED( status ) && !WIFSIGNALED( status ); ) {}
+            report_core_file( core->get_path(), summary );
+            return true;
+        } );
+    }
+
+    void report_core_file( std::string const & path, CoreSummary const & summary )
+    {
+        if ( batch ) {
+            json.begin( "gcore" ).field( "file", path );
+            if ( !summary.error.empty() ) {
+                json.field( "error", summary.error ).end();
+                return;
+            }
+            json.field( "segments", static_cast< std::int64_t >( summary.segments ) ).field( "mapped", static_cast< std::int64_t >( summary.mapped ) )
+                .field( "written", static_cast< std::int64_t >( summary.written ) ).field( "zero", static_cast< std::int64_t >( summary.zero ) )
+                .field( "file_backed", static_cast< std::int64_t >( summary.file_backed ) ).field( "unreadable", static_cast< std::int64_t >( summary.unreadable ) )
+                .field( "ns", static_cast< std::int64_t >( summary.ns ) ).end();
+            return;
+        }
+        if ( !summary.error.empty() ) {
+            std::cerr << "Cannot write core file '" << path << "': " << summary.error << '\n';
+            return;
+        }
+        std::cout << "Wrote " << path << " in " << format_duration( summary.ns ) << ": " << std::dec << summary.segments << " segments, "
+                  << format_size( summary.written ) << " of " << format_size( summary.mapped ) << " written, "
+                  << format_size( summary.zero ) << " zero, " << format_size( summary.file_backed ) << " left to the mapped files";
+        if ( summary.unreadable ) std::cout << ", " << format_size( summary.unreadable ) << " unreadable";
+        std::cout << '\n';
+    }
+
+    // What every kind of call to the kernel cost since the start or the last `stats reset`,
+    // and where the time went: into those calls, blocked waiting for the tracee (or for a
+    // command), or into the debugger itself
+    void print_stats()
+    {
+        auto const snapshot{ collect_stats() };
+        std::uint64_t calls_ns{};
+        std::uint64_t blocked_ns{};
+
+        std::cout << std::left << std::setfill(' ') << std::setw(20) << "call" << std::right
+                  << std::setw(10) << "count" << std::setw(8) << "errors" << std::setw(11) << "total"
+                  << std::setw(10) << "mean" << std::setw(10) << "p50" << std::setw(10) << "p90"
+                  << std::setw(10) << "p99" << std::setw(10) << "max" << '\n';
+        for ( std::size_t i{}; i < operation_count; ++i ) {
+            auto const & op{ snapshot.operations[ i ] };
+            if ( op.calls == 0 ) continue;
+            ( is_blocking( static_cast< Operation >( i ) ) ? blocked_ns : calls_ns ) += op.total_ns;
+
+            std::cout << std::left << std::setw(20) << operation_names[ i ] << std::right << std::dec
+                      << std::setw(10) << op.calls << std::setw(8) << op.errors << std::setw(11) << format_duration( op.total_ns )
+                      << std::setw(10) << format_duration( op.total_ns / op.calls ) << std::setw(10) << format_duration( op.percentile( 0.5 ) )
+                      << std::setw(10) << format_duration( op.percentile( 0.9 ) ) << std::setw(10) << format_duration( op.percentile( 0.99 ) )
+                      << std::setw(10) << format_duration( op.max() );
+            if ( op.last_error ) std::cout << "  last: " << std::strerror( op.last_error );
+            std::cout << '\n';
+        }
+
+        auto const elapsed{ snapshot.elapsed_ns };
+        auto const own{ elapsed > calls_ns + blocked_ns ? elapsed - calls_ns - blocked_ns : 0 };
+        std::cout << format_duration( elapsed ) << " in all: " << format_duration( calls_ns ) << " in these calls, "
+                  << format_duration( blocked_ns ) << " blocked on the tracee or the user, " << format_duration( own ) << " in the debugger\n";
+    }
+
+    // {"event":"stats",...} once per kind of call, then a summary
+    void emit_stats()
+    {
+        auto const snapshot{ collect_stats() };
+        for ( std::size_t i{}; i < operation_count; ++i ) {
+            auto const & op{ snapshot.operations[ i ] };
+            if ( op.calls == 0 ) continue;
+            json.begin( "stats" ).field( "call", operation_names[ i ] ).flag( "blocking", is_blocking( static_cast< Operation >( i ) ) )
+                .field( "count", static_cast< std::int64_t >( op.calls ) ).field( "errors", static_cast< std::int64_t >( op.errors ) )
+                .field( "total_ns", static_cast< std::int64_t >( op.total_ns ) ).field( "p50_ns", static_cast< std::int64_t >( op.percentile( 0.5 ) ) )
+                .field( "p90_ns", static_cast< std::int64_t >( op.percentile( 0.9 ) ) ).field( "p99_ns", static_cast< std::int64_t >( op.percentile( 0.99 ) ) )
+                .field( "max_ns", static_cast< std::int64_t >( op.max() ) );
+            if ( op.last_error ) json.field( "last_error", std::strerror( op.last_error ) );
+            json.end();
+        }
+        json.begin( "stats_total" ).field( "elapsed_ns", static_cast< std::int64_t >( snapshot.elapsed_ns ) ).end();
+    }
+
+    // 3 significant digits at most, in the largest unit that keeps the number at least 1
+    static std::string format_duration( std::uint64_t const ns )
+    {
+        static constexpr std::array< std::pair< double, char const * >, 3 > units{{ { 1e9, "s" }, { 1e6, "ms" }, { 1e3, "us" } }};
+        for ( auto const & [ scale, unit ] : units ) {
+            if ( static_cast< double >( ns ) >= scale ) {
+                auto const value{ static_cast< double >( ns ) / scale };
+                std::ostringstream out{};
+                out << std::fixed << std::setprecision( value >= 100 ? 0 : value >= 10 ? 1 : 2 ) << value << unit;
+                return out.str();
+            }
+        }
+        return std::to_string( ns ) + "ns";
+    }
+
+    // the same for sizes, in binary units
+    static std::string format_size( std::uint64_t const bytes )
+    {
+        static constexpr std::array< std::pair< double, char const * >, 3 > units{{ { 1 << 30, "GiB" }, { 1 << 20, "MiB" }, { 1 << 10, "KiB" } }};
+        for ( auto const & [ scale, unit ] : units ) {
+            if ( static_cast< double >( bytes ) >= scale ) {
+                auto const value{ static_cast< double >( bytes ) / scale };
+                std::ostringstream out{};
+                out << std::fixed << std::setprecision( value >= 100 ? 0 : value >= 10 ? 1 : 2 ) << value << unit;
+                return out.str();
+            }
+        }
+        return std::to_string( bytes ) + " bytes";
+    }
+
+    void list_checkpoints()
+    {
+        for ( auto const & [ id, checkpoint ] : checkpoints ) {
+            std::cout << "Checkpoint " << std::dec << id << ": process " << checkpoint.pid << " at 0x"
+                      << std::setfill('0') << std::setw(16) << std::hex << checkpoint.regs.rip << describe_address( checkpoint.regs.rip ) << '\n';
+        }
+    }
+
+    // The current process is killed and a fork of the checkpoint takes its place, so the
+    // checkpoint itself can be restarted again. Breakpoints, tracepoints and caught system
+    // calls are carried over: what is set now is set in the new process.
+    void restart_from_checkpoint( std::uint32_t const id )
+    {
+        auto const it{ checkpoints.find( id ) };
+        if ( it == std::end( checkpoints ) ) {
+            std::cerr << "No checkpoint " << std::dec << id << '\n';
+            return;
+        }
+        auto const & checkpoint{ it->second };
+
+        Memory snapshot{ checkpoint.pid };
+        auto const child{ inject_fork( checkpoint.pid, snapshot, checkpoint.regs, checkpoint.scratch.first_page(), tracer_options ) };
+        if ( child < 0 ) {
+            std::cerr << "Cannot fork checkpoint " << std::dec << id << '\n';
+            return;
+        }
+
+        drain_traces();
+        kill_tracee();
+
+        pid = child;
+        current_tid = child;
+        threads = ThreadTable{ child };
+        auto & leader{ threads.leader() };
+        leader.state = ThreadState::stopped;
+        leader.last_event = { StopReason::interrupted, child };
+        running = false;
+        interrupt_requested = false;
+        parked.clear();
+        held.clear();
+        retired.clear();
+        memory.reset( child );
+        debug_registers.rebind( child );
+
+        if ( checkpoint.program != prog_name ) {
+            // taken before an exec
+            prog_name = checkpoint.program;
+            elf = ElfFile{ prog_name };
+            symbols = SymbolIndex{ elf };
+            lines = LineIndex{ elf };
+            load_base.reset();
+            unwinder.reset();
+        }
+        scratch = checkpoint.scratch;
+        displaced = checkpoint.displaced;
+        filtered_syscalls = checkpoint.filtered_syscalls;
+
+        if ( auto const failed{ breakpoints.rearm( memory ) }; failed ) {
+            std::cerr << "Could not set " << std::dec << failed << " breakpoint(s)\n";
+        }
+        // the checkpoint may predate the ring, the new process gets one of its own
+        trace_ring = {};
+        reported_drops = 0;
+        auto const has_ring{ !tracepoints.empty() && map_trace_ring() };
+        for ( auto tp{ std::begin( tracepoints ) }; tp != std::end( tracepoints ); ) {
+            auto const instructions{ replaced_instructions( tp->second.original ) };
+            if ( has_ring && instructions && place_tracepoint( tp->second, *instructions ) ) {
+                ++tp;
+            } else {
+                std::cerr << "Tracepoint " << std::dec << tp->first << " is gone\n";
+                tp = tracepoints.erase( tp );
+            }
+        }
+        if ( tracepoints.empty() ) arm_trace_timer( false );
+        std::vector< long > unfiltered{};
+        for ( auto const nr : caught_syscalls ) {
+            if ( !filtered_syscalls.contains( nr ) ) unfiltered.push_back( nr );
+        }
+        if ( !unfiltered.empty() ) install_syscall_filter( unfiltered );
+
+        std::cout << "Restarted checkpoint " << std::dec << id << " as process " << child << '\n';
+        report_location();
+    }
+
+    // kills every thread of the tracee and waits until they are all gone
+    void kill_tracee()
+    {
+        if ( threads.leader().state == ThreadState::exited ) return;
+
+        kill( pid, SIGKILL );
+        // the leader is only reaped once the others are
+        for ( auto & [ tid, thread ] : threads ) {
+            if ( tid == pid || thread.state == ThreadState::exited ) continue;
+            for ( int status{}; instrumented::waitpid( tid, &status, __WALL ) == tid && !WIFEXITED( status ) && !WIFSIGNALED( status ); ) {}
+        }
+        for ( int status{}; instrumented::waitpid( pid, &status, __WALL ) == pid && !WIFEXITED( status ) && !WIFSIGNALED( status ); ) {}
+    }
+
+    std::optional< long > resolve_syscall( std::string_view const name )
+    {
+        if ( auto const * const info{ find_syscall( name ) }; info ) return info->nr;
+
+        long nr{};
+        auto const * const last{ name.data() + name.size() };
+        auto const [ ptr, ec ]{ std::from_chars( name.data(), last, nr ) };
+        if ( ec != std::errc{} || ptr != last || nr < 0 ) {
+            std::cerr << "Unknown syscall '" << name << "'\n";
+            return std::nullopt;
+        }
+        return nr;
+    }
+
+    // no names lists the caught system calls
+    void catch_syscalls( std::span< std::string_view const > const names )
+    {
+        if ( names.empty() ) {
+            std::vector< long > sorted( std::begin( caught_syscalls ), std::end( caught_syscalls ) );
+            std::sort( std::begin( sorted ), std::end( sorted ) );
+            for ( auto const nr : sorted ) {
+                auto const * const info{ find_syscall( nr ) };
+                std::cout << ( info ? info->name : "syscall" ) << " (" << std::dec << nr << ")\n";
+            }
+            return;
+        }
+        if ( !require_process() ) return;
+
+        std::vector< long > nrs{};
+        for ( auto const & name : names ) {
+            auto const nr{ resolve_syscall( name ) };
+            if ( !nr ) return;
+            nrs.push_back( *nr );
+        }
+
+        // only what no filter traps yet needs a new one
+        std::vector< long > unfiltered{};
+        for ( auto const nr : nrs ) {
+            if ( !filtered_syscalls.contains( nr ) && std::find( std::begin( unfiltered ), std::end( unfiltered ), nr ) == std::end( unfiltered ) ) {
+                unfiltered.push_back( nr );
+            }
+        }
+        if ( !unfiltered.empty() && !install_syscall_filter( unfiltered ) ) return;
+
+        for ( auto const nr : nrs ) {
+            caught_syscalls.insert( nr );
+            auto const * const info{ find_syscall( nr ) };
+            std::cout << "Catching syscall " << ( info ? info->name : "" ) << ( info ? " (" : "(" ) << std::dec << nr << ")\n";
+        }
+    }
+
+    // no names stops catching any
+    void uncatch_syscalls( std::span< std::string_view const > const names )
+    {
+        if ( names.empty() ) {
+            caught_syscalls.clear();
+            return;
+        }
+        for ( auto const & name : names ) {
+            if ( auto const nr{ resolve_syscall( name ) }; nr ) caught_syscalls.erase( *nr );
+        }
+    }
+
+    // The filter is copied into a scratch area and installed by the tracee itself, for all of its
+    // threads at once; the kernel only runs it for system calls, the rest of the tracee is not slowed down
+    bool install_syscall_filter( std::span< long const > const nrs )
+    {
+        if ( nrs.size() > 255 ) {
+            std::cerr << "Cannot catch more than 255 system calls at once\n";
+            return false;
+        }
+        auto const filter{ build_syscall_filter( nrs ) };
+        auto const code{ std::as_bytes( std::span{ filter } ) };
+        auto const size{ static_cast< std::intptr_t >( sizeof( sock_fprog ) + code.size() ) };
+
+        auto const at{ scratch_slot( static_cast< std::intptr_t >( get_pc() ), ( size + ScratchSpace::slot_size - 1 ) / ScratchSpace::slot_size ) };
+        if ( !at ) {
+            std::cerr << "Cannot set up a syscall filter in the tracee\n";
+            return false;
+        }
+        auto const filter_at{ *at + static_cast< std::intptr_t >( sizeof( sock_fprog ) ) };
+        sock_fprog const program{ static_cast< unsigned short >( filter.size() ), reinterpret_cast< sock_filter * >( filter_at ) };
+        if ( !memory.write_value( *at, program ) || write_memory( filter_at, code ) != code.size() ) {
+            std::cerr << "Cannot set up a syscall filter in the tracee\n";
+            return false;
+        }
+
+        auto const result{ run_syscall( SYS_seccomp, { SECCOMP_SET_MODE_FILTER, SECCOMP_FILTER_FLAG_TSYNC, static_cast< std::uint64_t >( *at ), 0, 0, 0 } ) };
+        if ( result != 0 ) {
+            if ( result > 0 ) {
+                std::cerr << "Cannot install the syscall filter, thread " << std::dec << result << " has filters of its own\n";
+            } else {
+                std::cerr << "Cannot install the syscall filter: " << strerror( static_cast< int >( -result ) ) << '\n';
+            }
+            return false;
+        }
+        filtered_syscalls.insert( std::begin( nrs ), std::end( nrs ) );
+        return true;
+    }
+
+    void start_recording( std::string const & path )
+    {
+        if ( recording.is_open() || replaying.is_open() ) {
+            std::cerr << "Already " << ( recording.is_open() ? "recording" : "replaying" ) << ", 'record stop' first\n";
+            return;
+        }
+        if ( !trap_recorded_syscalls() ) return;
+        recording = SyscallLogWriter{ path };
+        if ( !recording.is_open() ) {
+            std::cerr << "Cannot open '" << path << "': " << strerror( errno ) << '\n';
+            return;
+        }
+        std::cout << "Recording system call results to " << path << '\n';
+    }
+
+    void start_replay( std::string const & path )
+    {
+        if ( recording.is_open() || replaying.is_open() ) {
+            std::cerr << "Already " << ( recording.is_open() ? "recording" : "replaying" ) << ", 'replay stop' first\n";
+            return;
+        }
+        SyscallLogReader log{ path };
+        if ( !log.is_open() ) {
+            std::cerr << "Cannot read a system call log from '" << path << "'\n";
+            return;
+        }
+        if ( !trap_recorded_syscalls() ) return;
+        replaying = std::move( log );
+        std::cout << "Replaying system call results from " << path << '\n';
+    }
+
+    void stop_recording()
+    {
+        if ( recording.is_open() ) {
+            std::cout << "Recorded " << std::dec << recording.entries() << " system call(s)\n";
+            recording = {};
+        } else if ( replaying.is_open() ) {
+            std::cout << "Replayed " << std::dec << replaying.entries() << " system call(s)\n";
+            replaying = {};
+        } else {
+            std::cerr << "Not recording or replaying\n";
+        }
+        // a thread on its way to the exit of a recorded call stops there once more, which is let through
+        for ( auto & [ tid, thread ] : threads ) thread.await_exit = false;
+    }
+
+    // the filters stay once installed, a later recording or replay finds them there
+    bool trap_recorded_syscalls()
+    {
+        std::vector< long > unfiltered{};
+        for ( auto const & s : recorded_syscalls ) {
+            if ( !filtered_syscalls.contains( s.nr ) ) unfiltered.push_back( s.nr );
+        }
+        return unfiltered.empty() || install_syscall_filter( unfiltered );
+    }
+
+    // at the syscall-exit-stop of a call let through at its seccomp-stop, the registers still hold
+    // its arguments and now its result
+    void record_syscall( Thread & thread )
+    {
+        if ( !std::exchange( thread.await_exit, false ) || !recording.is_open() ) return;
+
+        auto const & regs{ registers_of( thread ).raw() };
+        auto const nr{ static_cast< long >( regs.orig_rax ) };
+        auto const result{ static_cast< std::int64_t >( regs.rax ) };
+        auto const * const recorded{ find_recorded_syscall( nr ) };
+        // interrupted by a signal, the call is made again, and trapped again, once it has been handled
+        if ( !recorded || is_restarted( result ) ) return;
+
+        auto const args{ syscall_arguments( regs ) };
+        auto const buffer{ static_cast< std::intptr_t >( args[ static_cast< std::size_t >( recorded->buffer ) ] ) };
+        recording.append( nr, result, recorded_length( *recorded, args, result ), [&]( std::span< std::byte > const out ) {
+            return read_memory( buffer, out );
+        } );
+    }
+
+    // the call is skipped, by making its number -1 at its seccomp-stop, and what the log says it
+    // returned and wrote is put in its place
+    void replay_syscall( Thread & thread )
+    {
+        auto & regs{ registers_of( thread ) };
+        auto const nr{ static_cast< long >( regs.get( Register::orig_rax ) ) };
+        auto const * const recorded{ find_recorded_syscall( nr ) };
+        if ( !recorded ) return;
+
+        auto const entry{ replaying.next() };
+        if ( !entry || entry->nr != nr ) {
+            auto const * const expected{ entry ? find_syscall( entry->nr ) : nullptr };
+            auto const * const made{ find_syscall( nr ) };
+            if ( entry ) {
+                std::cout << "Replay diverged after " << std::dec << replaying.entries() - 1 << " system call(s), the log has "
+                          << ( expected ? expected->name : "another call" ) << " where the process makes " << ( made ? made->name : "another" ) << '\n';
+            } else {
+                std::cout << "Replayed all " << std::dec << replaying.entries() << " system call(s) of the log\n";
+            }
+            std::cout << "System calls are made for real from here\n";
+            replaying = {};
+            return;
+        }
+
+        auto const args{ syscall_arguments( regs.raw() ) };
+        write_memory( static_cast< std::intptr_t >( args[ static_cast< std::size_t >( recorded->buffer ) ] ), entry->data );
+        regs.set( Register::orig_rax, static_cast< std::uint64_t >( -1 ) );
+        regs.set( Register::rax, static_cast< std::uint64_t >( entry->result ) );
+    }
+
+    // "name(arg, ...)" from the registers of a seccomp-stop, which is before the call is made
+    std::string describe_syscall( user_regs_struct const & regs )
+    {
+        auto const nr{ static_cast< long >( regs.orig_rax ) };
+        auto const * const info{ find_syscall( nr ) };
+        auto const args{ syscall_arguments( regs ) };
+
+        std::ostringstream ss{};
+        if ( info ) {
+            ss << info->name;
+        } else {
+            ss << "syscall_" << std::dec << nr;
+        }
+        ss << '(';
+        auto const kinds{ info ? info->args : std::string_view{ "xxxxxx" } };
+        for ( std::size_t i{}; i < kinds.size(); ++i ) {
+            if ( i ) ss << ", ";
+            switch ( kinds[ i ] ) {
+                case 'd': ss << std::dec << static_cast< std::int32_t >( args[ i ] ); break;
+                case 'l': ss << std::dec << static_cast< std::int64_t >( args[ i ] ); break;
+                case 's': ss << read_string( static_cast< std::intptr_t >( args[ i ] ) ); break;
+                default:  ss << "0x" << std::hex << args[ i ]; break;
+            }
+        }
+        ss << ')';
+        return ss.str();
+    }
+
+    // a quoted C string from the tracee, shortened past `max` characters
+    std::string read_string( std::intptr_t const addr, std::size_t const max = 64 )
+    {
+        if ( addr == 0 ) return "NULL";
+
+        std::array< char, 65 > buffer{};
+        auto const n{ read_memory( addr, std::as_writable_bytes( std::span{ buffer } ).first( std::min( max + 1, buffer.size() ) ) ) };
+        if ( n == 0 ) {
+            std::ostringstream ss{};
+            ss << "0x" << std::hex << addr;
+            return ss.str();
+        }
+
+        std::string out{ '"' };
+        std::size_t i{};
+        for ( ; i < n && i < max && buffer[ i ] != '\0'; ++i ) {
+            auto const c{ static_cast< unsigned char >( buffer[ i ] ) };
+            if ( c == '"' || c == '\\' ) {
+                out += '\\';
+                out += static_cast< char >( c );
+            } else if ( std::isprint( c ) ) {
+                out += static_cast< char >( c );
+            } else {
+                char escaped[ 5 ];
+                std::snprintf( escaped, sizeof( escaped ), "\\x%02x", c );
+                out += escaped;
+            }
+        }
+        out += '"';
+        if ( i < n && buffer[ i ] != '\0' ) out += "...";
+        return out;
+    }
+
+    // `trace <location> <registers...>`: records the registers at every hit without stopping
+    void set_tracepoint( std::string_view const location, std::span< std::string_view const > const names )
+    {
+        if ( !require_process() ) return;
+
+        auto const addr{ resolve_location( location ) };
+        if ( !addr ) {
+            std::cerr << "Cannot resolve '" << location << "'\n";
+            return;
+        }
+        if ( names.size() > Tracepoint::max_registers ) {
+            std::cerr << "A tracepoint records at most " << std::dec << Tracepoint::max_registers << " registers\n";
+            return;
+        }
+
+        Tracepoint tp{ next_tracepoint_id, *addr };
+        for ( auto const & name : names ) {
+            auto const r{ get_register_from_name( name ) };
+            if ( !r ) {
+                std::cerr << "Cannot find register '" << name << "'\n";
+                return;
+            }
+            if ( !is_traceable( *r ) ) {
+                std::cerr << "Cannot trace register '" << name << "'\n";
+                return;
+            }
+            tp.registers.push_back( *r );
+        }
+
+        std::array< std::byte, 32 > bytes{};
+        auto const n{ read_memory( *addr, bytes ) };
+        breakpoints.restore_original( *addr, bytes );
+        auto const instructions{ replaced_instructions( std::span{ bytes }.first( n ) ) };
+        if ( !instructions ) {
+            std::cerr << "The code at " << std::setfill('0') << std::setw(16) << std::hex << *addr
+                      << " cannot be moved into a trampoline, use a breakpoint there\n";
+            return;
+        }
+        std::size_t length{};
+        for ( auto const & insn : *instructions ) length += insn.length;
+        tp.original.assign( std::begin( bytes ), std::begin( bytes ) + static_cast< std::ptrdiff_t >( length ) );
+
+        for ( auto a{ *addr }; a < *addr + static_cast< std::intptr_t >( length ); ++a ) {
+            if ( breakpoints.contains( a ) || tracepoint_covering( a ) ) {
+                std::cerr << "A breakpoint or tracepoint is in the way at " << std::setfill('0') << std::setw(16) << std::hex << a << '\n';
+                return;
+            }
+        }
+
+        if ( !trace_ring.is_mapped() && !map_trace_ring() ) return;
+        if ( !place_tracepoint( tp, *instructions ) ) return;
+
+        std::cout << "Tracepoint " << std::dec << tp.id << " on: " << std::setfill('0') << std::setw(16) << std::hex << tp.addr << '\n';
+        ++next_tracepoint_id;
+        tracepoints.emplace( tp.id, std::move( tp ) );
+        arm_trace_timer( true );
+    }
+
+    // writes the trampoline of `tp` to a new scratch area and the jmp to it over the original code
+    bool place_tracepoint( Tracepoint & tp, std::span< Instruction const > const instructions )
+    {
+        auto const slot{ scratch_slot( tp.addr, Tracepoint::trampoline_size / ScratchSpace::slot_size ) };
+        if ( !slot ) {
+            std::cerr << "No room for a trampoline near " << std::setfill('0') << std::setw(16) << std::hex << tp.addr << '\n';
+            return false;
+        }
+        tp.trampoline = *slot;
+
+        std::vector< std::byte > code{};
+        if ( !assemble_trampoline( tp, trace_ring.remote_address(), instructions, code ) ) {
+            std::cerr << "The code at " << std::setfill('0') << std::setw(16) << std::hex << tp.addr << " is out of reach of the trampoline\n";
+            return false;
+        }
+
+        bool installed{};
+        with_others_stopped( [&]{ installed = install_tracepoint( tp, code ); } );
+        return installed;
+    }
+
+    // the jmp goes in last, once the trampoline it leads to is complete
+    bool install_tracepoint( Tracepoint const & tp, std::span< std::byte const > const code )
+    {
+        // a thread stopped between two of the replaced instructions would resume in the middle of the jmp
+        for ( auto & [ tid, thread ] : threads ) {
+            if ( !thread.is_stopped() ) continue;
+            auto const pc{ static_cast< std::intptr_t >( registers_of( thread ).get( Register::rip ) ) };
+            if ( pc > tp.addr && tp.covers( pc ) ) {
+                std::cerr << "Thread " << std::dec << tid << " is stopped inside the code a tracepoint would replace\n";
+                return false;
+            }
+        }
+
+        std::vector< std::byte > jump{ std::byte{ 0xe9 } };
+        displaced_detail::append_rel32( jump, tp.trampoline - ( tp.addr + static_cast< std::intptr_t >( Tracepoint::jump_size ) ) );
+        // whatever is left of the last replaced instruction traps if anything jumps into it
+        jump.resize( tp.original.size(), int3 );
+
+        if ( write_memory( tp.trampoline, code ) != code.size() || write_memory( tp.addr, jump ) != jump.size() ) {
+            write_memory( tp.addr, tp.original );
+            std::cerr << "Cannot patch the tracee at " << std::setfill('0') << std::setw(16) << std::hex << tp.addr << '\n';
+            return false;
+        }
+        return true;
+    }
+
+    // the original code goes back; the trampoline stays, a thread may still be running through it
+    void remove_tracepoint( std::string_view const location )
+    {
+        auto const addr{ resolve_location( location ) };
+        auto const it{ std::find_if( std::begin( tracepoints ), std::end( tracepoints ), [&addr]( auto const & entry ) { return addr && entry.second.addr == *addr; } ) };
+        if ( it == std::end( tracepoints ) ) {
+            std::cerr << "No tracepoint at '" << location << "'\n";
+            return;
+        }
+        if ( is_stopped() ) {
+            with_others_stopped( [&]{ write_memory( it->second.addr, it->second.original ); } );
+        }
+        drain_traces();
+        std::cout << "Removed tracepoint " << std::dec << it->first << " after " << it->second.hits << " hit(s)\n";
+        tracepoints.erase( it );
+        if ( tracepoints.empty() ) arm_trace_timer( false );
+    }
+
+    // A memfd the tracee creates and maps shared, and we map through /proc/<pid>/fd
+    bool map_trace_ring()
+    {
+        constexpr char name[]{ "dbgg-trace" };
+        auto const name_at{ scratch_slot( static_cast< std::intptr_t >( get_pc() ) ) };
+        if ( !name_at || write_memory( *name_at, std::as_bytes( std::span{ name } ) ) != sizeof( name ) ) {
+            std::cerr << "Cannot set up the trace ring in the tracee\n";
+            return false;
+        }
+
+        auto const is_error{ []( std::int64_t const result ) { return result < 0 && result > -4096; } };
+        auto const fd{ run_syscall( SYS_memfd_create, { static_cast< std::uint64_t >( *name_at ), MFD_CLOEXEC, 0, 0, 0, 0 } ) };
+        if ( is_error( fd ) ) {
+            std::cerr << "Cannot set up the trace ring in the tracee: " << strerror( static_cast< int >( -fd ) ) << '\n';
+            return false;
+        }
+        auto const remote_fd{ static_cast< std::uint64_t >( fd ) };
+
+        std::int64_t remote{ -1 };
+        auto local_fd{ -1 };
+        if ( run_syscall( SYS_ftruncate, { remote_fd, TraceRing::size, 0, 0, 0, 0 } ) == 0 ) {
+            remote = run_syscall( SYS_mmap, { 0, TraceRing::size, PROT_READ | PROT_WRITE, MAP_SHARED, remote_fd, 0 } );
+            auto const path{ "/proc/" + std::to_string( pid ) + "/fd/" + std::to_string( fd ) };
+            local_fd = open( path.c_str(), O_RDWR | O_CLOEXEC );
+        }
+        // the mappings keep the memfd alive on both sides
+        run_syscall( SYS_close, { remote_fd, 0, 0, 0, 0, 0 } );
+
+        if ( is_error( remote ) || local_fd < 0 ) {
+            if ( local_fd >= 0 ) close( local_fd );
+            std::cerr << "Cannot map the trace ring\n";
+            return false;
+        }
+        trace_ring = TraceRing{ local_fd, static_cast< std::intptr_t >( remote ) };
+        if ( !trace_ring.is_mapped() ) {
+            std::cerr << "Cannot map the trace ring\n";
+            return false;
+        }
+        return true;
+    }
+
+    // prints what the trampolines recorded since the last time, one line per hit
+    void drain_traces()
+    {
+        if ( !trace_ring.is_mapped() ) return;
+
+        std::string out{};
+        trace_ring.drain( [&]( TraceRing::Record const & record ) {
+            auto const it{ tracepoints.find( static_cast< std::uint32_t >( record.id ) ) };
+            // removed since, the jmp may have been taken right before
+            if ( it == std::end( tracepoints ) ) return;
+            auto & tp{ it->second };
+            ++tp.hits;
+
+            out += "Tracepoint ";
+            out += std::to_string( tp.id );
+            out += ':';
+            for ( std::size_t i{}; i < tp.registers.size(); ++i ) {
+                out += ' ';
+                out += register_name( tp.registers[ i ] );
+                out += '=';
+                append_hex( out, record.values[ i ] );
+            }
+            out += '\n';
+        } );
+
+        if ( auto const dropped{ trace_ring.dropped() }; dropped != reported_drops ) {
+            out += "(" + std::to_string( dropped - reported_drops ) + " trace records dropped, the ring was full)\n";
+            reported_drops = dropped;
+        }
+        if ( !out.empty() ) {
+            std::cout << out << std::flush;
+        }
+    }
+
+    // a one-shot breakpoint on every function, or every statement, of the program: each is
+    // taken out at its first hit, so a location costs one trap however often it runs
+    void start_coverage( CoverageKind const kind, std::string path )
+    {
+        if ( !require_process() ) return;
+        if ( coverage.is_active() ) {
+            std::cerr << "Already measuring coverage, `coverage stop` first\n";
+            return;
+        }
+
+        std::vector< std::uint64_t > locations{};
+        if ( kind == CoverageKind::functions ) {
+            symbols.for_each_function( [&]( Symbol const & s ) { locations.push_back( s.addr ); } );
+        } else {
+            lines.for_each_statement( [&]( std::uint64_t const addr ) { locations.push_back( addr ); } );
+        }
+        // line programs keep the rows of functions the linker dropped, at address 0 and the like
+        std::erase_if( locations, [this]( auto const addr ) { return !elf.is_code( addr ); } );
+        if ( locations.empty() ) {
+            std::cerr << "No " << describe( kind ) << " to cover in " << prog_name << '\n';
+            return;
+        }
+
+        coverage = Coverage{ kind, std::move( locations ), load_address(), std::move( path ) };
+        std::vector< std::size_t > armed{};
+        for ( std::size_t i{}; i < coverage.size(); ++i ) {
+            auto const addr{ coverage.address( i ) };
+            // a user's breakpoint stays theirs, it is only noted when it is hit
+            if ( breakpoints.contains( addr ) || tracepoint_covering( addr ) ) continue;
+            breakpoints.stage_enable( addr );
+            coverage.set_armed( i, true );
+            armed.push_back( i );
+        }
+        breakpoints.apply( memory );
+
+        // whatever could not be patched is not covered, but must not linger as a disabled breakpoint
+        std::size_t failed{};
+        for ( auto const i : armed ) {
+            auto const addr{ coverage.address( i ) };
+            if ( auto const * const bp{ breakpoints.find( addr ) }; bp && !bp->is_enabled() ) {
+                breakpoints.stage_remove( addr );
+                coverage.set_armed( i, false );
+                ++failed;
+            }
+        }
+        if ( failed ) {
+            breakpoints.apply( memory );
+            std::cerr << "Could not set " << std::dec << failed << " coverage breakpoint(s)\n";
+        }
+        std::cout << "Measuring coverage of " << std::dec << coverage.size() << ' ' << describe( kind ) << ", report to " << coverage.get_path() << '\n';
+    }
+
+    void show_coverage()
+    {
+        if ( !coverage.is_active() ) {
+            std::cout << "Not measuring coverage\n";
+            return;
+        }
+        std::cout << std::dec << coverage.covered() << " of " << coverage.size() << ' ' << describe( coverage.get_kind() )
+                  << " run so far, report to " << coverage.get_path() << '\n';
+    }
+
+    // writes the report; the breakpoints still left are taken out with `disarm`, otherwise the
+    // process or its address space is gone with them
+    void finish_coverage( bool const disarm )
+    {
+        if ( !coverage.is_active() ) return;
+        if ( disarm ) {
+            coverage.for_each_armed( [this]( std::intptr_t const addr ) {
+                breakpoints.stage_remove( addr );
+                retired.insert( addr );
+            } );
+            breakpoints.apply( memory );
+        }
+
+        auto const written{ coverage.write( prog_name ) };
+        if ( batch ) {
+            json.begin( "coverage" ).field( "kind", describe( coverage.get_kind() ) ).field( "locations", static_cast< std::int64_t >( coverage.size() ) )
+                .field( "covered", static_cast< std::int64_t >( coverage.covered() ) ).field( "report", coverage.get_path() ).flag( "written", written ).end();
+        } else if ( written ) {
+            std::cout << "Coverage: " << std::dec << coverage.covered() << " of " << coverage.size() << ' ' << describe( coverage.get_kind() )
+                      << " run, written to " << coverage.get_path() << '\n';
+        } else {
+            std::cerr << "Cannot write the coverage report to '" << coverage.get_path() << "'\n";
+        }
+        coverage = {};
+    }
+
+    void list_tracepoints()
+    {
+        for ( auto const & [ id, tp ] : tracepoints ) {
+            auto const addr{ static_cast< std::uint64_t >( tp.addr ) };
+            std::cout << "Tracepoint " << std::dec << id << " on: " << std::setfill('0') << std::setw(16) << std::hex << addr << describe_address( addr ) << ',';
+            for ( auto const r : tp.registers ) {
+                std::cout << ' ' << register_name( r );
+            }
+            std::cout << ", hit " << std::dec << tp.hits << " time(s)\n";
+        }
+        if ( reported_drops ) {
+            std::cout << std::dec << reported_drops << " trace records dropped\n";
+        }
+    }
+
+    std::string const & register_name( Register const r ) const
+    {
+        return std::find_if( std::begin( registers ), std::end( registers ), [r]( auto const & rd ) { return rd.r == r; } )->name;
+    }
+
+    Tracepoint const * tracepoint_covering( std::intptr_t const addr ) const
+    {
+        for ( auto const & [ id, tp ] : tracepoints ) {
+            if ( tp.covers( addr ) ) return &tp;
+        }
+        return nullptr;
+    }
+
+    bool in_trampoline( std::uint64_t const pc ) const
+    {
+        return std::any_of( std::begin( tracepoints ), std::end( tracepoints ), [pc]( auto const & entry ) { return entry.second.in_trampoline( static_cast< std::intptr_t >( pc ) ); } );
+    }
+
+    // drains the ring every 10ms while there are tracepoints
+    void arm_trace_timer( bool const on )
+    {
+        if ( trace_timer < 0 ) return;
+        itimerspec spec{};
+        if ( on ) {
+            spec.it_interval.tv_nsec = 10'000'000;
+            spec.it_value = spec.it_interval;
+        }
+        timerfd_settime( trace_timer, 0, &spec, nullptr );
+    }
+
+    std::size_t read_memory( std::intptr_t const addr, std::span< std::byte > const out )
+    {
+        return memory.read_memory( addr, out );
+    }
+
+    std::size_t write_memory( std::intptr_t const addr, std::span< std::byte const > const in )
+    {
+        return memory.write_memory( addr, in );
+    }
+
+    void examine_memory( std::intptr_t const addr, std::size_t len )
+    {
+        // more than fits on a screen, `dump` is for large ranges
+        static constexpr std::size_t max_length{ 64 << 10 };
+        if ( !require_process() ) return;
+        if ( len > max_length ) {
+            std::cerr << "Showing the first " << std::dec << max_length << " of " << len << " bytes, dump writes more to a file\n";
+            len = max_length;
+        }
+
+        std::vector< std::byte > buffer( len );
+        auto const n{ read_memory( addr, buffer ) };
+        if ( n < len ) {
+            std::cerr << "Could only read " << std::dec << n << " of " << len << " bytes\n";
+        }
+        if ( batch ) {
+            json.begin( "memory" ).hex( "addr", static_cast< std::uint64_t >( addr ) ).field( "length", static_cast< std::int64_t >( n ) )
+                .bytes( "bytes", std::span{ buffer }.first( n ) ).end();
+            return;
+        }
+
+        for ( std::size_t line{}; line < n; line += 16 ) {
+            std::cout << std::setfill('0') << std::setw(16) << std::hex << addr + line << ": ";
+            auto const end{ std::min( line + 16, n ) };
+            for ( auto i{ line }; i < line + 16; ++i ) {
+                if ( i < end ) {
+                    std::cout << std::setw(2) << std::to_integer< unsigned >( buffer[ i ] ) << ' ';
+                } else {
+                    std::cout << "   ";
+                }
+            }
+            for ( auto i{ line }; i < end; ++i ) {
+                auto const c{ std::to_integer< unsigned char >( buffer[ i ] ) };
+                std::cout << ( std::isprint( c ) ? static_cast< char >( c ) : '.' );
+            }
+            std::cout << '\n';
+        }
+    }
+
+    // Every match of `pattern` in the tracee's readable mappings, in those named `range[0]`
+    // ("heap", "stack" or the end of a file's path) or between two addresses. Regions are
+    // read a megabyte at a time, the end of a chunk is kept so that matches across chunks
+    // are found, and our breakpoints are taken out of what was read.
+    void find_in_memory( BytePattern const & pattern, std::span< std::string_view const > const range )
+    {
+        static constexpr std::size_t chunk_size{ 1 << 20 };
+        static constexpr std::size_t max_listed{ 256 };
+        static constexpr std::uintptr_t page_size{ 4096 };
+        if ( !require_process() ) return;
+
+        std::uintptr_t lo{};
+        std::uintptr_t hi{ ~std::uintptr_t{} };
+        std::string name{};
+        if ( range.size() == 2 ) {
+            auto const start{ resolve_location( range[ 0 ] ) };
+            auto const length{ range[ 1 ].starts_with( '+' ) ? parse_number< std::uintptr_t >( range[ 1 ].substr( 1 ) ) : std::nullopt };
+            auto const end{ length && start ? std::optional{ *start + static_cast< std::intptr_t >( *length ) } : resolve_location( range[ 1 ] ) };
+            if ( !start || !end || *end <= *start ) {
+                std::cerr << "Invalid range '" << range[ 0 ] << ' ' << range[ 1 ] << "'\n";
+                return;
+            }
+            lo = static_cast< std::uintptr_t >( *start );
+            hi = static_cast< std::uintptr_t >( *end );
+        } else if ( range.size() == 1 ) {
+            name = range[ 0 ] == "heap" || range[ 0 ] == "stack" ? "[" + std::string{ range[ 0 ] } + "]" : std::string{ range[ 0 ] };
+        }
+
+        auto const kernel{ select_kernel( pattern ) };
+        auto const started{ std::chrono::steady_clock::now() };
+        std::vector< std::byte > buffer( chunk_size + pattern.size() - 1 );
+        std::vector< std::size_t > offsets{};
+        std::uint64_t matches{};
+        std::uint64_t searched{};
+        std::size_t regions{};
+
+        for ( auto const & region : read_memory_maps( pid ) ) {
+            // the vDSO's data pages cannot all be read, and nothing of ours is in them
+            if ( !region.readable || region.path == "[vvar]" || region.path == "[vvar_vclock]" || region.path == "[vsyscall]" ) continue;
+            if ( !name.empty() && region.path != name && !region.path.ends_with( "/" + name ) ) continue;
+            auto const from{ std::max( region.start, lo ) };
+            auto const to{ std::min( region.end, hi ) };
+            if ( from >= to ) continue;
+            ++regions;
+
+            std::size_t kept{};   // the last bytes of the previous chunk, a match can start in them
+            for ( auto addr{ from }; addr < to; ) {
+                auto const wanted{ static_cast< std::size_t >( std::min< std::uint64_t >( chunk_size, to - addr ) ) };
+                auto const chunk{ std::span{ buffer }.subspan( kept, wanted ) };
+                auto const n{ read_memory( static_cast< std::intptr_t >( addr ), chunk ) };
+                breakpoints.restore_original( static_cast< std::intptr_t >( addr ), chunk.first( n ) );
+                searched += n;
+
+                auto const data{ std::span{ buffer }.first( kept + n ) };
+                offsets.clear();
+                find_pattern( kernel, data, pattern, offsets );
+                for ( auto const offset : offsets ) {
+                    if ( matches++ < max_listed ) report_match( addr - kept + offset, region );
+                }
+
+                if ( n < wanted ) {
+                    // a page that cannot be read, like one past the end of a mapped file; go on after it
+                    addr = ( addr + n + page_size ) & ~( page_size - 1 );
+                    kept = 0;
+                    continue;
+                }
+                addr += n;
+                kept = std::min( pattern.size() - 1, data.size() );
+                std::memmove( buffer.data(), data.data() + data.size() - kept, kept );
+            }
+        }
+
+        auto const seconds{ std::chrono::duration< double >( std::chrono::steady_clock::now() - started ).count() };
+        if ( batch ) {
+            json.begin( "find" ).field( "matches", static_cast< std::int64_t >( matches ) ).field( "searched", static_cast< std::int64_t >( searched ) )
+                .field( "regions", static_cast< std::int64_t >( regions ) ).field( "kernel", describe( kernel ) ).end();
+            return;
+        }
+        if ( matches > max_listed ) std::cout << "... and " << std::dec << matches - max_listed << " more\n";
+        std::cout << std::dec << matches << " match(es) in " << ( searched < 1 << 20 ? searched : searched >> 20 ) << ( searched < 1 << 20 ? " bytes" : " MiB" )
+                  << " of " << regions << " region(s), "
+                  << describe( kernel ) << ", " << std::fixed << std::setprecision( 3 ) << seconds << std::defaultfloat << " s\n";
+    }
+
+    void report_match( std::uint64_t const addr, MemoryRegion const & region )
+    {
+        if ( batch ) {
+            json.begin( "match" ).hex( "addr", addr ).field( "region", region.path ).end();
+            return;
+        }
+        std::cout << std::setfill('0') << std::setw(16) << std::hex << addr << describe_address( addr );
+        if ( !region.path.empty() ) std::cout << " in " << region.path;
+        std::cout << '\n';
+    }
+
+    // streamed a megabyte at a time, up to the first byte that cannot be read
+    void dump_memory( std::intptr_t const addr, std::size_t const len, std::string const & path )
+    {
+        static constexpr std::size_t chunk_size{ 1 << 20 };
+        if ( !require_process() ) return;
+
+        std::ofstream out{ path, std::ios::binary };
+        if ( !out ) {
+            std::cerr << "Cannot open '" << path << "'\n";
+            return;
+        }
+
+        std::vector< std::byte > buffer( std::min( len, chunk_size ) );
+        std::size_t dumped{};
+        while ( dumped < len && out ) {
+            auto const chunk{ std::span{ buffer }.first( std::min( len - dumped, chunk_size ) ) };
+            auto const n{ read_memory( addr + static_cast< std::intptr_t >( dumped ), chunk ) };
+            out.write( reinterpret_cast< char const * >( chunk.data() ), static_cast< std::streamsize >( n ) );
+            dumped += n;
+            if ( n < chunk.size() ) break;
+        }
+        if ( !out ) {
+            std::cerr << "Cannot write to '" << path << "'\n";
+            return;
+        }
+        if ( dumped < len ) {
+            std::cerr << "Could only read " << std::dec << dumped << " of " << len << " bytes\n";
+        }
+        std::cout << "Dumped " << std::dec << dumped << " bytes to " << path << '\n';
+    }
+
+    void reload_registers()
+    {
+        auto const & regs{ current_registers() };
+        for ( auto & r : registers ) {
+            r.value = regs.get( r.r );
+        }
+    }
+
+    void emit_registers()
+    {
+        reload_registers();
+        json.begin( "registers" ).field( "tid", current_tid );
+        for ( auto const & r : registers ) json.hex( r.name, r.value );
+        json.end();
     }
 
     void print_registers()
     {
         reload_registers();
         for ( auto const & r : registers ) {
-            std::cout << r.name << " 0x" << std::setfill('0') << std::setw(16) << std::hex << r.value << '\n';
+            std::cout << r.name << " 0x" << std::setfill('0') << std::setw(16) << std::hex << r.value;
+            if ( r.r == Register::rip ) std::cout << describe_address( r.value );
+            std::cout << '\n';
         }
     }
 
 private:
     std::string prog_name{};
     pid_t pid{};
-    std::unordered_map< std::intptr_t, Breakpoint > breakpoints{};
+    pid_t current_tid{};
+    ThreadTable threads;
+    bool running{};
+    bool non_stop{};
+    std::deque< pid_t > parked{};
+    std::vector< pid_t > held{};
+    std::unordered_set< std::intptr_t > retired{};
+    Coverage coverage{};
+    bool interrupt_requested{};
+    bool attached{};   // seized while running rather than launched by us
+    bool batch{};
+    JsonLines json{ STDOUT_FILENO };
+    std::string input{};
+    std::deque< std::string > commands{};
+    bool input_closed{};
+    BreakpointSet breakpoints{};
+    Memory memory{};
+    DebugRegisters debug_registers{};
+    ScratchSpace scratch{};
+    std::unordered_map< std::intptr_t, DisplacedInstruction > displaced{};
+    ElfFile elf{};
+    SymbolIndex symbols{};
+    LineIndex lines{};
+    Unwinder unwinder{};
+    std::map< std::uint32_t, Checkpoint > checkpoints{};
+    std::uint32_t next_checkpoint_id{ 1 };
+    std::unordered_set< long > caught_syscalls{};
+    std::unordered_set< long > filtered_syscalls{};
+    SyscallLogWriter recording{};
+    SyscallLogReader replaying{};
+    std::map< std::uint32_t, Tracepoint > tracepoints{};
+    std::uint32_t next_tracepoint_id{ 1 };
+    TraceRing trace_ring{};
+    std::uint64_t reported_drops{};
+    int trace_timer{ -1 };
+    int core_event{ -1 };   // an eventfd, written to when a core file is done
+    std::vector< std::unique_ptr< BackgroundCore > > core_files{};
+    std::unordered_map< std::string, std::vector< std::string > > sources{};
+    std::optional< std::uint64_t > load_base{};
     std::array< RegisterDescriptor, 27 > registers{ init_registers() };
 };
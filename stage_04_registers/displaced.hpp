@@ -0,0 +1,159 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "x86.hpp"
+
+// How to get past the instruction under a breakpoint without taking the breakpoint out
+enum class DisplacedAction : std::uint8_t {
+    in_place,        // cannot be moved, lift the breakpoint and single-step it where it is
+    emulate,         // jmp/call rel and ret, done by changing registers only
+    run_in_slot,     // a relocated copy followed by a jmp back, the tracee can simply continue from it
+    step_in_slot,    // a relocated copy that has to be single-stepped so its side effects can be fixed up
+};
+
+struct DisplacedInstruction {
+    Instruction insn{};
+    DisplacedAction action{ DisplacedAction::in_place };
+    std::intptr_t slot{};
+    std::uint8_t fallthrough{};   // offset in the slot where execution ends up if no branch is taken
+
+    std::intptr_t target( std::intptr_t const from ) const { return from + insn.length + insn.relative; }
+};
+
+// relative jumps, calls and returns are emulated, the rest but a few run from a scratch slot
+inline bool needs_slot( Instruction const & insn ) {
+    switch ( insn.kind ) {
+        case InstructionKind::jump_relative:
+        case InstructionKind::call_relative:
+        case InstructionKind::ret:
+        case InstructionKind::loop_relative:
+        case InstructionKind::other_control:
+            return false;
+        default:
+            return true;
+    }
+}
+
+namespace displaced_detail
+{
+    inline bool fits_rel32( std::int64_t const value ) {
+        return value >= std::numeric_limits< std::int32_t >::min() && value <= std::numeric_limits< std::int32_t >::max();
+    }
+
+    inline void append_rel32( std::vector< std::byte > & code, std::int64_t const value ) {
+        auto const rel{ static_cast< std::int32_t >( value ) };
+        auto const at{ code.size() };
+        code.resize( at + sizeof( rel ) );
+        std::memcpy( code.data() + at, &rel, sizeof( rel ) );
+    }
+}
+
+// Works out what to do with `insn` (encoded in `bytes`, originally at `from`), and for the
+// actions that execute a copy fills `code` with what has to be written to `slot`.
+inline DisplacedInstruction relocate_instruction( Instruction const & insn, std::span< std::byte const > const bytes,
+                                                  std::intptr_t const from, std::intptr_t const slot, std::vector< std::byte > & code )
+{
+    using namespace displaced_detail;
+
+    DisplacedInstruction displaced{ insn };
+    code.clear();
+
+    switch ( insn.kind ) {
+        case InstructionKind::jump_relative:
+        case InstructionKind::call_relative:
+        case InstructionKind::ret:
+            displaced.action = DisplacedAction::emulate;
+            return displaced;
+        case InstructionKind::loop_relative:
+        case InstructionKind::other_control:
+            return displaced;
+        default:
+            break;
+    }
+
+    // everything else runs from the slot, which has to be within reach of rel32 operands
+    auto const delta{ from - slot };
+
+    if ( insn.kind == InstructionKind::conditional_relative ) {
+        // re-encoded as jcc rel32 to the original target, then jmp rel32 back
+        code.push_back( std::byte{ 0x0f } );
+        code.push_back( std::byte( 0x80 | insn.condition ) );
+        auto const taken{ displaced.target( from ) - ( slot + 6 ) };
+        if ( !fits_rel32( taken ) ) {
+            code.clear();
+            return displaced;
+        }
+        append_rel32( code, taken );
+    } else {
+        code.assign( std::begin( bytes ), std::begin( bytes ) + insn.length );
+        if ( insn.is_rip_relative() ) {
+            std::int32_t disp{};
+            std::memcpy( &disp, code.data() + insn.disp_offset, sizeof( disp ) );
+            auto const moved{ std::int64_t{ disp } + delta };
+            if ( !fits_rel32( moved ) ) {
+                code.clear();
+                return displaced;
+            }
+            disp = static_cast< std::int32_t >( moved );
+            std::memcpy( code.data() + insn.disp_offset, &disp, sizeof( disp ) );
+        }
+    }
+
+    displaced.fallthrough = static_cast< std::uint8_t >( code.size() );
+
+    auto const back{ ( from + insn.length ) - ( slot + static_cast< std::intptr_t >( code.size() ) + 5 ) };
+    if ( !fits_rel32( back ) ) {
+        code.clear();
+        return displaced;
+    }
+    code.push_back( std::byte{ 0xe9 } );
+    append_rel32( code, back );
+
+    displaced.slot = slot;
+    // a relocated call would push the slot as its return address, that needs fixing after the step
+    displaced.action = insn.kind == InstructionKind::call_indirect ? DisplacedAction::step_in_slot : DisplacedAction::run_in_slot;
+    return displaced;
+}
+
+// Scratch pages mapped into the tracee, carved into fixed size slots
+struct ScratchSpace {
+    static constexpr std::intptr_t page_size{ 4096 };
+    static constexpr std::intptr_t slot_size{ 32 };
+
+    // `count` free slots in a row within rel32 reach of `near`, if an existing page has them
+    std::optional< std::intptr_t > take_slot( std::intptr_t const near, std::intptr_t const count = 1 ) {
+        for ( auto & page : pages ) {
+            if ( ( page.used + count ) * slot_size > page_size ) continue;
+            auto const distance{ page.addr > near ? page.addr - near : near - page.addr };
+            if ( distance >= std::intptr_t{ std::numeric_limits< std::int32_t >::max() } - page_size ) continue;
+            auto const slot{ page.addr + page.used * slot_size };
+            page.used += count;
+            return slot;
+        }
+        return std::nullopt;
+    }
+
+    void add_page( std::intptr_t const addr, std::intptr_t const reserved = 0 ) {
+        pages.push_back( { addr, reserved } );
+    }
+
+    bool empty() const { return pages.empty(); }
+    std::intptr_t first_page() const { return pages.front().addr; }
+
+    void clear() { pages.clear(); }
+
+private:
+    struct Page {
+        std::intptr_t addr;
+        std::intptr_t used;
+    };
+
+    std::vector< Page > pages{};
+};
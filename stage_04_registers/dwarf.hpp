@@ -0,0 +1,605 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <elf.h>
+
+#include "elf.hpp"
+
+// Bounds checked cursor over a DWARF section.
+// Reading past the end yields zeroes and marks the reader as failed instead of crashing.
+struct DwarfReader {
+    DwarfReader() = default;
+    explicit DwarfReader( std::span< std::byte const > const data, std::size_t const pos = 0 ) : data{ data }, pos{ pos } {}
+
+    std::uint8_t  u8()  { return read< std::uint8_t  >(); }
+    std::uint16_t u16() { return read< std::uint16_t >(); }
+    std::uint32_t u32() { return read< std::uint32_t >(); }
+    std::uint64_t u64() { return read< std::uint64_t >(); }
+
+    std::uint64_t uleb() {
+        std::uint64_t result{};
+        for ( unsigned shift{}; ; shift += 7 ) {
+            auto const byte{ u8() };
+            if ( shift < 64 ) result |= std::uint64_t{ byte & 0x7fU } << shift;
+            if ( !( byte & 0x80 ) || failed ) return result;
+        }
+    }
+
+    std::int64_t sleb() {
+        std::int64_t result{};
+        unsigned shift{};
+        std::uint8_t byte{};
+        do {
+            byte = u8();
+            if ( shift < 64 ) result |= std::int64_t{ byte & 0x7f } << shift;
+            shift += 7;
+        } while ( ( byte & 0x80 ) && !failed );
+
+        if ( shift < 64 && ( byte & 0x40 ) ) result |= -( std::int64_t{ 1 } << shift );
+        return result;
+    }
+
+    std::string_view cstr() {
+        if ( pos >= data.size() ) { failed = true; return {}; }
+        auto const * const begin{ reinterpret_cast< char const * >( data.data() + pos ) };
+        auto const len{ strnlen( begin, data.size() - pos ) };
+        pos += len + 1;
+        return { begin, len };
+    }
+
+    // section offsets are 4 bytes in 32-bit DWARF and 8 bytes in 64-bit DWARF
+    std::uint64_t offset( bool const is_64 ) { return is_64 ? u64() : u32(); }
+
+    std::uint64_t address( std::uint8_t const size ) {
+        switch ( size ) {
+            case 1: return u8();
+            case 2: return u16();
+            case 4: return u32();
+            default: return u64();
+        }
+    }
+
+    // reads the initial length of a unit, returns the offset one past its end
+    std::size_t unit_length( bool & is_64 ) {
+        std::uint64_t length{ u32() };
+        is_64 = length == 0xffffffff;
+        if ( is_64 ) length = u64();
+        return pos + length;
+    }
+
+    void skip( std::size_t const n ) {
+        if ( n > data.size() - std::min( pos, data.size() ) ) { failed = true; pos = data.size(); return; }
+        pos += n;
+    }
+
+    bool at_end() const { return failed || pos >= data.size(); }
+
+    std::span< std::byte const > data{};
+    std::size_t pos{};
+    bool failed{};
+
+private:
+    template< typename T >
+    T read() {
+        T value{};
+        if ( pos + sizeof( T ) > data.size() ) { failed = true; pos = data.size(); return value; }
+        std::memcpy( &value, data.data() + pos, sizeof( T ) );
+        pos += sizeof( T );
+        return value;
+    }
+};
+
+struct SourceLocation {
+    std::string file{};
+    std::uint32_t line{};
+    std::uint64_t addr{};   // start of the line table row covering the address
+    bool is_stmt{};
+};
+
+// Address <-> (file, line) index over .debug_line.
+//
+// Nothing is decoded up front. The list of line programs is found by hopping
+// over their unit lengths, and a program is only run when an address or a
+// file:line inside it is first asked for. The decoded rows of a unit are kept
+// as one compact vector sorted by address.
+struct LineIndex {
+    LineIndex() = default;
+
+    explicit LineIndex( ElfFile const & elf ) {
+        if ( !elf.is_valid() ) return;
+
+        auto const section{ [&elf]( char const * name ) -> std::span< std::byte const > {
+            auto const * const s{ elf.find_section( name ) };
+            return s ? elf.contents( *s ) : std::span< std::byte const >{};
+        } };
+        debug_line     = section( ".debug_line" );
+        debug_line_str = section( ".debug_line_str" );
+        debug_str      = section( ".debug_str" );
+        debug_info     = section( ".debug_info" );
+        debug_abbrev   = section( ".debug_abbrev" );
+        debug_aranges  = section( ".debug_aranges" );
+    }
+
+    LineIndex( LineIndex const & ) = delete;
+    LineIndex & operator=( LineIndex const & ) = delete;
+
+    LineIndex( LineIndex && ) = default;
+    LineIndex & operator=( LineIndex && ) = default;
+
+    bool has_line_info() const { return !debug_line.empty(); }
+
+    std::optional< SourceLocation > find_location( std::uint64_t const addr ) {
+        auto * const unit{ find_unit( addr ) };
+        if ( !unit ) return std::nullopt;
+
+        auto const * const row{ find_row( *unit, addr ) };
+        if ( !row ) return std::nullopt;
+
+        return SourceLocation{ file_path( *unit, row->file ), row->line, row->addr, static_cast< bool >( row->is_stmt ) };
+    }
+
+    // lowest statement address for `line` of every file whose path ends in `file`;
+    // falls back to the closest following line that has code, like other debuggers do
+    std::optional< std::uint64_t > find_address( std::string_view const file, std::uint32_t const line ) {
+        discover_units();
+
+        std::optional< std::uint64_t > best_addr{};
+        std::uint32_t best_line{ ~std::uint32_t{} };
+
+        for ( auto & unit : units ) {
+            if ( !parse_header( unit ) ) continue;
+
+            std::vector< bool > matches( unit.files.size() );
+            auto any{ false };
+            for ( std::size_t i{}; i < unit.files.size(); ++i ) {
+                matches[ i ] = path_matches( file_path( unit, static_cast< std::uint16_t >( i ) ), file );
+                any |= matches[ i ];
+            }
+            if ( !any ) continue;
+
+            decode( unit );
+            for ( auto const & row : unit.rows ) {
+                if ( row.end_sequence || !row.is_stmt || row.line < line || row.file >= matches.size() || !matches[ row.file ] ) continue;
+                if ( row.line < best_line || ( row.line == best_line && row.addr < *best_addr ) ) {
+                    best_line = row.line;
+                    best_addr = row.addr;
+                }
+            }
+        }
+        return best_addr;
+    }
+
+    // the address of every row that starts a statement, of every line program; unsorted, with repeats
+    template< typename F >
+    void for_each_statement( F && f ) {
+        discover_units();
+        for ( auto & unit : units ) {
+            decode( unit );
+            for ( auto const & row : unit.rows ) {
+                if ( row.is_stmt && !row.end_sequence ) f( row.addr );
+            }
+        }
+    }
+
+    std::size_t decoded_units() const {
+        return static_cast< std::size_t >( std::count_if( std::begin( units ), std::end( units ), []( auto const & u ) { return u.decoded; } ) );
+    }
+
+private:
+    struct Row {
+        std::uint64_t addr;
+        std::uint32_t line;
+        std::uint16_t file;
+        std::uint8_t  is_stmt      : 1;
+        std::uint8_t  end_sequence : 1;
+    };
+
+    struct File {
+        std::string_view name;
+        std::uint64_t dir;
+    };
+
+    struct Unit {
+        std::size_t offset{};
+        std::size_t end{};
+        bool header_parsed{};
+        bool header_valid{};
+        bool decoded{};
+
+        std::uint16_t version{};
+        std::uint8_t address_size{ 8 };
+        std::uint8_t min_inst_length{ 1 };
+        bool default_is_stmt{};
+        std::int8_t line_base{};
+        std::uint8_t line_range{ 1 };
+        std::uint8_t opcode_base{ 1 };
+        std::vector< std::uint8_t > opcode_lengths{};
+        std::vector< std::string_view > dirs{};
+        std::vector< File > files{};
+        std::size_t program{};
+
+        std::vector< Row > rows{};
+    };
+
+    struct Arange {
+        std::uint64_t lo;
+        std::uint64_t hi;
+        std::uint64_t info_offset;
+    };
+
+    // DWARF constants, see the DWARF 5 standard, chapter 7
+    enum : std::uint8_t {
+        DW_LNS_copy = 1, DW_LNS_advance_pc, DW_LNS_advance_line, DW_LNS_set_file, DW_LNS_set_column,
+        DW_LNS_negate_stmt, DW_LNS_set_basic_block, DW_LNS_const_add_pc, DW_LNS_fixed_advance_pc,
+    };
+    enum : std::uint8_t { DW_LNE_end_sequence = 1, DW_LNE_set_address, DW_LNE_define_file };
+    enum : std::uint16_t { DW_LNCT_path = 1, DW_LNCT_directory_index };
+    enum : std::uint16_t { DW_AT_stmt_list = 0x10 };
+    enum : std::uint16_t {
+        DW_FORM_addr = 0x01, DW_FORM_block2 = 0x03, DW_FORM_block4, DW_FORM_data2, DW_FORM_data4, DW_FORM_data8,
+        DW_FORM_string, DW_FORM_block, DW_FORM_block1, DW_FORM_data1, DW_FORM_flag, DW_FORM_sdata, DW_FORM_strp,
+        DW_FORM_udata, DW_FORM_ref_addr, DW_FORM_ref1, DW_FORM_ref2, DW_FORM_ref4, DW_FORM_ref8, DW_FORM_ref_udata,
+        DW_FORM_indirect, DW_FORM_sec_offset, DW_FORM_exprloc, DW_FORM_flag_present, DW_FORM_strx, DW_FORM_addrx,
+        DW_FORM_ref_sup4, DW_FORM_strp_sup, DW_FORM_data16, DW_FORM_line_strp, DW_FORM_ref_sig8, DW_FORM_implicit_const,
+        DW_FORM_loclistx, DW_FORM_rnglistx, DW_FORM_ref_sup8, DW_FORM_strx1, DW_FORM_strx2, DW_FORM_strx3, DW_FORM_strx4,
+        DW_FORM_addrx1, DW_FORM_addrx2, DW_FORM_addrx3, DW_FORM_addrx4,
+    };
+
+    static bool path_matches( std::string_view const path, std::string_view const suffix ) {
+        if ( !path.ends_with( suffix ) ) return false;
+        return path.size() == suffix.size() || path[ path.size() - suffix.size() - 1 ] == '/';
+    }
+
+    void discover_units() {
+        if ( units_discovered ) return;
+        units_discovered = true;
+
+        DwarfReader r{ debug_line };
+        while ( !r.at_end() ) {
+            Unit unit{};
+            unit.offset = r.pos;
+            bool is_64{};
+            unit.end = r.unit_length( is_64 );
+            if ( r.failed || unit.end > debug_line.size() ) break;
+
+            units.push_back( std::move( unit ) );
+            r.pos = units.back().end;
+        }
+    }
+
+    Unit * unit_at_offset( std::uint64_t const offset ) {
+        discover_units();
+        auto const it{ std::lower_bound( std::begin( units ), std::end( units ), offset, []( auto const & u, auto const o ) { return u.offset < o; } ) };
+        return it != std::end( units ) && it->offset == offset ? &*it : nullptr;
+    }
+
+    // reads one attribute value in `form`, returns it if it fits in an integer
+    std::uint64_t read_form( DwarfReader & r, std::uint64_t const form, bool const is_64, std::uint8_t const address_size, std::int64_t const implicit_const = 0 ) {
+        switch ( form ) {
+            case DW_FORM_addr          : return r.address( address_size );
+            case DW_FORM_block2        : r.skip( r.u16() ); return 0;
+            case DW_FORM_block4        : r.skip( r.u32() ); return 0;
+            case DW_FORM_data2         : case DW_FORM_ref2: case DW_FORM_strx2: case DW_FORM_addrx2: return r.u16();
+            case DW_FORM_data4         : case DW_FORM_ref4: case DW_FORM_ref_sup4: case DW_FORM_strx4: case DW_FORM_addrx4: return r.u32();
+            case DW_FORM_data8         : case DW_FORM_ref8: case DW_FORM_ref_sig8: case DW_FORM_ref_sup8: return r.u64();
+            case DW_FORM_string        : r.cstr(); return 0;
+            case DW_FORM_block         : case DW_FORM_exprloc: r.skip( r.uleb() ); return 0;
+            case DW_FORM_block1        : r.skip( r.u8() ); return 0;
+            case DW_FORM_data1         : case DW_FORM_ref1: case DW_FORM_flag: case DW_FORM_strx1: case DW_FORM_addrx1: return r.u8();
+            case DW_FORM_sdata         : return static_cast< std::uint64_t >( r.sleb() );
+            case DW_FORM_strp          : case DW_FORM_ref_addr: case DW_FORM_sec_offset: case DW_FORM_strp_sup: case DW_FORM_line_strp: return r.offset( is_64 );
+            case DW_FORM_udata         : case DW_FORM_ref_udata: case DW_FORM_strx: case DW_FORM_addrx: case DW_FORM_loclistx: case DW_FORM_rnglistx: return r.uleb();
+            case DW_FORM_indirect      : return read_form( r, r.uleb(), is_64, address_size );
+            case DW_FORM_flag_present  : return 1;
+            case DW_FORM_data16        : r.skip( 16 ); return 0;
+            case DW_FORM_implicit_const: return static_cast< std::uint64_t >( implicit_const );
+            case DW_FORM_strx3         : case DW_FORM_addrx3: { auto const lo{ r.u16() }; return lo | std::uint64_t{ r.u8() } << 16; }
+        }
+        r.failed = true;
+        return 0;
+    }
+
+    // DW_AT_stmt_list of the compilation unit at `info_offset`, i.e. where its line program lives
+    std::optional< std::uint64_t > stmt_list( std::uint64_t const info_offset ) {
+        DwarfReader r{ debug_info, static_cast< std::size_t >( info_offset ) };
+        bool is_64{};
+        r.unit_length( is_64 );
+        auto const version{ r.u16() };
+
+        std::uint64_t abbrev_offset{};
+        std::uint8_t address_size{};
+        if ( version >= 5 ) {
+            r.u8();   // unit type
+            address_size = r.u8();
+            abbrev_offset = r.offset( is_64 );
+        } else {
+            abbrev_offset = r.offset( is_64 );
+            address_size = r.u8();
+        }
+
+        auto const code{ r.uleb() };
+        DwarfReader abbrev{ debug_abbrev, static_cast< std::size_t >( abbrev_offset ) };
+        while ( !abbrev.at_end() ) {
+            auto const entry_code{ abbrev.uleb() };
+            if ( entry_code == 0 ) return std::nullopt;
+            abbrev.uleb();   // tag
+            abbrev.u8();     // has children
+
+            auto const is_unit_die{ entry_code == code };
+            while ( !abbrev.at_end() ) {
+                auto const attr{ abbrev.uleb() };
+                auto const form{ abbrev.uleb() };
+                auto const implicit_const{ form == DW_FORM_implicit_const ? abbrev.sleb() : 0 };
+                if ( attr == 0 && form == 0 ) break;
+
+                if ( is_unit_die ) {
+                    auto const value{ read_form( r, form, is_64, address_size, implicit_const ) };
+                    if ( r.failed ) return std::nullopt;
+                    if ( attr == DW_AT_stmt_list ) return value;
+                }
+            }
+            if ( is_unit_die ) return std::nullopt;
+        }
+        return std::nullopt;
+    }
+
+    void load_aranges() {
+        if ( aranges_loaded ) return;
+        aranges_loaded = true;
+
+        DwarfReader r{ debug_aranges };
+        while ( !r.at_end() ) {
+            auto const set_start{ r.pos };
+            bool is_64{};
+            auto const end{ r.unit_length( is_64 ) };
+            r.u16();   // version
+            auto const info_offset{ r.offset( is_64 ) };
+            auto const address_size{ r.u8() };
+            r.u8();    // segment selector size
+            if ( r.failed || address_size == 0 ) break;
+
+            // tuples are aligned to twice the address size from the start of the set
+            auto const tuple{ 2U * address_size };
+            auto const misalignment{ ( r.pos - set_start ) % tuple };
+            if ( misalignment ) r.skip( tuple - misalignment );
+
+            while ( r.pos < end && !r.failed ) {
+                auto const lo{ r.address( address_size ) };
+                auto const length{ r.address( address_size ) };
+                if ( lo == 0 && length == 0 ) break;
+                aranges.push_back( { lo, lo + length, info_offset } );
+            }
+            r.pos = end;
+        }
+
+        std::sort( std::begin( aranges ), std::end( aranges ), []( auto const & a, auto const & b ) { return a.lo < b.lo; } );
+    }
+
+    Unit * find_unit( std::uint64_t const addr ) {
+        if ( !debug_aranges.empty() ) {
+            load_aranges();
+            auto it{ std::upper_bound( std::begin( aranges ), std::end( aranges ), addr, []( auto const a, auto const & r ) { return a < r.lo; } ) };
+            if ( it == std::begin( aranges ) || addr >= std::prev( it )->hi ) return nullptr;
+
+            auto const offset{ stmt_list( std::prev( it )->info_offset ) };
+            if ( !offset ) return nullptr;
+            auto * const unit{ unit_at_offset( *offset ) };
+            if ( unit ) decode( *unit );
+            return unit;
+        }
+
+        // no address ranges, decode line programs in order until one covers the address
+        discover_units();
+        for ( auto & unit : units ) {
+            decode( unit );
+            if ( find_row( unit, addr ) ) return &unit;
+        }
+        return nullptr;
+    }
+
+    static Row const * find_row( Unit const & unit, std::uint64_t const addr ) {
+        auto const it{ std::upper_bound( std::begin( unit.rows ), std::end( unit.rows ), addr, []( auto const a, auto const & r ) { return a < r.addr; } ) };
+        if ( it == std::begin( unit.rows ) ) return nullptr;
+        auto const & row{ *std::prev( it ) };
+        return row.end_sequence ? nullptr : &row;
+    }
+
+    std::string file_path( Unit const & unit, std::uint16_t const index ) const {
+        if ( index >= unit.files.size() ) return {};
+
+        auto const & file{ unit.files[ index ] };
+        if ( file.name.starts_with( '/' ) || file.dir >= unit.dirs.size() ) return std::string{ file.name };
+
+        std::string path{ unit.dirs[ file.dir ] };
+        // directories other than the compilation directory may be relative to it
+        if ( !path.starts_with( '/' ) && file.dir != 0 && !unit.dirs[ 0 ].empty() ) {
+            path = std::string{ unit.dirs[ 0 ] } + '/' + path;
+        }
+        if ( !path.empty() ) path += '/';
+        return path + std::string{ file.name };
+    }
+
+    std::string_view read_entry_string( DwarfReader & r, std::uint64_t const form, bool const is_64 ) {
+        if ( form == DW_FORM_string ) return r.cstr();
+
+        auto const offset{ read_form( r, form, is_64, 8 ) };
+        auto const table{ form == DW_FORM_line_strp ? debug_line_str : form == DW_FORM_strp ? debug_str : std::span< std::byte const >{} };
+        if ( offset >= table.size() ) return {};
+        DwarfReader s{ table, static_cast< std::size_t >( offset ) };
+        return s.cstr();
+    }
+
+    // DWARF 5 directory and file tables are self-describing: a list of (content, form) pairs per entry
+    template< typename F >
+    void read_entry_table( DwarfReader & r, bool const is_64, F && on_entry ) {
+        std::vector< std::pair< std::uint64_t, std::uint64_t > > format( r.u8() );
+        for ( auto & [ content, form ] : format ) {
+            content = r.uleb();
+            form = r.uleb();
+        }
+
+        auto const count{ r.uleb() };
+        for ( std::uint64_t i{}; i < count && !r.at_end(); ++i ) {
+            File entry{};
+            for ( auto const & [ content, form ] : format ) {
+                if ( content == DW_LNCT_path ) {
+                    entry.name = read_entry_string( r, form, is_64 );
+                } else if ( content == DW_LNCT_directory_index ) {
+                    entry.dir = read_form( r, form, is_64, 8 );
+                } else {
+                    read_form( r, form, is_64, 8 );
+                }
+            }
+            on_entry( entry );
+        }
+    }
+
+    bool parse_header( Unit & unit ) {
+        if ( unit.header_parsed ) return unit.header_valid;
+        unit.header_parsed = true;
+
+        DwarfReader r{ debug_line.subspan( 0, unit.end ), unit.offset };
+        bool is_64{};
+        r.unit_length( is_64 );
+        unit.version = r.u16();
+        if ( unit.version < 2 || unit.version > 5 ) return false;
+
+        if ( unit.version >= 5 ) {
+            unit.address_size = r.u8();
+            r.u8();   // segment selector size
+        }
+        auto const header_length{ r.offset( is_64 ) };
+        unit.program = r.pos + header_length;
+
+        unit.min_inst_length = r.u8();
+        if ( unit.version >= 4 ) r.u8();   // maximum operations per instruction, only != 1 on VLIW
+        unit.default_is_stmt = r.u8() != 0;
+        unit.line_base = static_cast< std::int8_t >( r.u8() );
+        unit.line_range = r.u8();
+        unit.opcode_base = r.u8();
+        if ( unit.line_range == 0 || unit.opcode_base == 0 ) return false;
+
+        unit.opcode_lengths.resize( unit.opcode_base - 1U );
+        for ( auto & length : unit.opcode_lengths ) length = r.u8();
+
+        if ( unit.version >= 5 ) {
+            read_entry_table( r, is_64, [&unit]( File const & dir  ) { unit.dirs.push_back( dir.name ); } );
+            read_entry_table( r, is_64, [&unit]( File const & file ) { unit.files.push_back( file ); } );
+        } else {
+            // before DWARF 5 entry 0 is the compilation directory / primary file, which are not listed
+            unit.dirs.emplace_back();
+            while ( true ) {
+                auto const dir{ r.cstr() };
+                if ( dir.empty() || r.failed ) break;
+                unit.dirs.push_back( dir );
+            }
+            unit.files.emplace_back();
+            while ( true ) {
+                auto const name{ r.cstr() };
+                if ( name.empty() || r.failed ) break;
+                auto const dir{ r.uleb() };
+                r.uleb();   // modification time
+                r.uleb();   // length
+                unit.files.push_back( { name, dir } );
+            }
+        }
+
+        unit.header_valid = !r.failed && unit.program <= unit.end;
+        return unit.header_valid;
+    }
+
+    void decode( Unit & unit ) {
+        if ( unit.decoded ) return;
+        unit.decoded = true;
+        if ( !parse_header( unit ) ) return;
+
+        DwarfReader r{ debug_line.subspan( 0, unit.end ), unit.program };
+
+        std::uint64_t addr{};
+        std::int64_t line{ 1 };
+        std::uint16_t file{ 1 };
+        bool is_stmt{ unit.default_is_stmt };
+
+        auto const reset{ [&] {
+            addr = 0;
+            line = 1;
+            file = 1;
+            is_stmt = unit.default_is_stmt;
+        } };
+        auto const emit{ [&]( bool const end_sequence ) {
+            unit.rows.push_back( Row{ addr, static_cast< std::uint32_t >( line ), file, is_stmt, end_sequence } );
+        } };
+
+        while ( !r.at_end() ) {
+            auto const opcode{ r.u8() };
+
+            if ( opcode >= unit.opcode_base ) {
+                auto const adjusted{ opcode - unit.opcode_base };
+                addr += std::uint64_t( adjusted / unit.line_range ) * unit.min_inst_length;
+                line += unit.line_base + adjusted % unit.line_range;
+                emit( false );
+                continue;
+            }
+
+            switch ( opcode ) {
+                case 0: {
+                    auto const length{ r.uleb() };
+                    auto const next{ r.pos + length };
+                    switch ( r.u8() ) {
+                        case DW_LNE_end_sequence:
+                            emit( true );
+                            reset();
+                            break;
+                        case DW_LNE_set_address:
+                            addr = r.address( static_cast< std::uint8_t >( length - 1 ) );
+                            break;
+                        default:
+                            // DW_LNE_define_file is deprecated, discriminators are of no use here
+                            break;
+                    }
+                    r.pos = next;
+                    break;
+                }
+                case DW_LNS_copy         : emit( false ); break;
+                case DW_LNS_advance_pc   : addr += r.uleb() * unit.min_inst_length; break;
+                case DW_LNS_advance_line : line += r.sleb(); break;
+                case DW_LNS_set_file     : file = static_cast< std::uint16_t >( r.uleb() ); break;
+                case DW_LNS_negate_stmt  : is_stmt = !is_stmt; break;
+                case DW_LNS_const_add_pc : addr += std::uint64_t( ( 255 - unit.opcode_base ) / unit.line_range ) * unit.min_inst_length; break;
+                case DW_LNS_fixed_advance_pc: addr += r.u16(); break;
+                default:
+                    // standard opcodes we do not care about, skip their operands
+                    for ( auto i{ 0U }; i < unit.opcode_lengths[ opcode - 1 ]; ++i ) r.uleb();
+                    break;
+            }
+        }
+
+        // sequences can come in any order; an end of sequence sorts before a row starting at the same address
+        std::stable_sort( std::begin( unit.rows ), std::end( unit.rows ), []( auto const & a, auto const & b ) {
+            return a.addr != b.addr ? a.addr < b.addr : a.end_sequence > b.end_sequence;
+        } );
+        unit.rows.shrink_to_fit();
+    }
+
+    std::span< std::byte const > debug_line{};
+    std::span< std::byte const > debug_line_str{};
+    std::span< std::byte const > debug_str{};
+    std::span< std::byte const > debug_info{};
+    std::span< std::byte const > debug_abbrev{};
+    std::span< std::byte const > debug_aranges{};
+
+    bool units_discovered{};
+    std::vector< Unit > units{};
+    bool aranges_loaded{};
+    std::vector< Arange > aranges{};
+};
@@ -0,0 +1,275 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Read-only, memory-mapped view of a 64-bit ELF file.
+// Nothing is copied out of the file, sections are handed out as spans into the mapping.
+struct ElfFile {
+    ElfFile() = default;
+
+    explicit ElfFile( std::string const & path ) {
+        auto const fd{ open( path.c_str(), O_RDONLY | O_CLOEXEC ) };
+        if ( fd < 0 ) return;
+
+        struct stat st{};
+        if ( fstat( fd, &st ) == 0 && static_cast< std::size_t >( st.st_size ) >= sizeof( Elf64_Ehdr ) ) {
+            auto * const mapping{ mmap( nullptr, static_cast< std::size_t >( st.st_size ), PROT_READ, MAP_PRIVATE, fd, 0 ) };
+            if ( mapping != MAP_FAILED ) {
+                data = static_cast< std::byte const * >( mapping );
+                size = static_cast< std::size_t >( st.st_size );
+            }
+        }
+        close( fd );
+
+        if ( data && !validate() ) {
+            unmap();
+        }
+    }
+
+    ElfFile( ElfFile const & ) = delete;
+    ElfFile & operator=( ElfFile const & ) = delete;
+
+    ElfFile( ElfFile && other ) noexcept : data{ std::exchange( other.data, nullptr ) }, size{ std::exchange( other.size, 0 ) } {}
+    ElfFile & operator=( ElfFile && other ) noexcept {
+        if ( this != &other ) {
+            unmap();
+            data = std::exchange( other.data, nullptr );
+            size = std::exchange( other.size, 0 );
+        }
+        return *this;
+    }
+
+    ~ElfFile() { unmap(); }
+
+    bool is_valid() const { return data != nullptr; }
+
+    Elf64_Ehdr const & header() const { return *reinterpret_cast< Elf64_Ehdr const * >( data ); }
+
+    // position independent executables are loaded at a base address chosen at runtime
+    bool is_position_independent() const { return header().e_type == ET_DYN; }
+
+    std::span< Elf64_Shdr const > sections() const {
+        auto const & h{ header() };
+        return { reinterpret_cast< Elf64_Shdr const * >( data + h.e_shoff ), h.e_shnum };
+    }
+
+    std::span< Elf64_Phdr const > segments() const {
+        auto const & h{ header() };
+        return { reinterpret_cast< Elf64_Phdr const * >( data + h.e_phoff ), h.e_phnum };
+    }
+
+    // inside a loaded segment that is mapped executable
+    bool is_code( std::uint64_t const addr ) const {
+        return std::any_of( std::begin( segments() ), std::end( segments() ), [addr]( auto const & s ) {
+            return s.p_type == PT_LOAD && ( s.p_flags & PF_X ) && addr >= s.p_vaddr && addr < s.p_vaddr + s.p_memsz;
+        } );
+    }
+
+    std::string_view section_name( Elf64_Shdr const & section ) const {
+        auto const & names{ sections()[ header().e_shstrndx ] };
+        return string_at( names, section.sh_name );
+    }
+
+    Elf64_Shdr const * find_section( std::string_view const name ) const {
+        for ( auto const & section : sections() ) {
+            if ( section_name( section ) == name ) return &section;
+        }
+        return nullptr;
+    }
+
+    std::span< std::byte const > contents( Elf64_Shdr const & section ) const {
+        // the sum could overflow in a malformed file
+        if ( section.sh_type == SHT_NOBITS || section.sh_offset > size || section.sh_size > size - section.sh_offset ) return {};
+        return { data + section.sh_offset, section.sh_size };
+    }
+
+    // the NUL-terminated string at `offset` of a string table section, no copy
+    std::string_view string_at( Elf64_Shdr const & strtab, std::uint64_t const offset ) const {
+        auto const table{ contents( strtab ) };
+        if ( offset >= table.size() ) return {};
+        auto const * const begin{ reinterpret_cast< char const * >( table.data() + offset ) };
+        return { begin, strnlen( begin, table.size() - offset ) };
+    }
+
+    std::byte const * base() const { return data; }
+
+private:
+    bool validate() const {
+        if ( std::memcmp( data, ELFMAG, SELFMAG ) != 0 ) return false;
+
+        auto const & h{ header() };
+        if ( h.e_ident[ EI_CLASS ] != ELFCLASS64 ) return false;
+        if ( h.e_shoff + std::uint64_t{ h.e_shnum } * sizeof( Elf64_Shdr ) > size ) return false;
+        if ( h.e_phoff + std::uint64_t{ h.e_phnum } * sizeof( Elf64_Phdr ) > size ) return false;
+        if ( h.e_shnum != 0 && h.e_shstrndx >= h.e_shnum ) return false;
+        return true;
+    }
+
+    void unmap() {
+        if ( data ) {
+            munmap( const_cast< std::byte * >( data ), size );
+        }
+        data = nullptr;
+        size = 0;
+    }
+
+    std::byte const * data{};
+    std::size_t size{};
+};
+
+struct Symbol {
+    std::uint64_t addr{};
+    std::uint64_t size{};
+    std::string_view name{};
+};
+
+// Name <-> address index over .symtab and .dynsym.
+//
+// Names are not copied: they stay in the mapped string tables and the index
+// only keeps their offset into the mapping. Address lookups binary search a
+// vector sorted by address, name lookups go through an open addressing hash
+// table of indices into that same vector.
+struct SymbolIndex {
+    SymbolIndex() = default;
+
+    explicit SymbolIndex( ElfFile const & elf ) : base{ elf.base() } {
+        if ( !elf.is_valid() ) return;
+
+        for ( auto const * const name : { ".symtab", ".dynsym" } ) {
+            if ( auto const * const table{ elf.find_section( name ) }; table ) {
+                add_table( elf, *table );
+            }
+        }
+
+        // functions sort ahead of other symbols at the same address, they are the better name for it
+        std::sort( std::begin( entries ), std::end( entries ), []( auto const & a, auto const & b ) {
+            return a.addr != b.addr ? a.addr < b.addr : a.is_function > b.is_function;
+        } );
+
+        build_hash();
+    }
+
+    std::size_t size() const { return entries.size(); }
+
+    std::optional< std::uint64_t > find_address( std::string_view const name ) const {
+        if ( slots.empty() ) return std::nullopt;
+
+        auto const mask{ slots.size() - 1 };
+        for ( auto slot{ hash( name ) & mask }; slots[ slot ] != empty; slot = ( slot + 1 ) & mask ) {
+            auto const & entry{ entries[ slots[ slot ] ] };
+            if ( name_of( entry ) == name ) return entry.addr;
+        }
+        return std::nullopt;
+    }
+
+    // the symbol containing `addr`; symbols without a size (like _end) only match exactly
+    std::optional< Symbol > find_symbol( std::uint64_t const addr ) const {
+        auto it{ std::upper_bound( std::begin( entries ), std::end( entries ), addr, []( auto const a, auto const & e ) { return a < e.addr; } ) };
+        if ( it == std::begin( entries ) ) return std::nullopt;
+
+        auto const last{ std::prev( it )->addr };
+        it = std::lower_bound( std::begin( entries ), it, last, []( auto const & e, auto const a ) { return e.addr < a; } );
+
+        if ( it->size == 0 ? addr != it->addr : addr >= it->addr + it->size ) return std::nullopt;
+        return Symbol{ it->addr, it->size, name_of( *it ) };
+    }
+
+    template< typename F >
+    void for_each_function( F && f ) const {
+        for ( auto const & e : entries ) {
+            if ( e.is_function ) f( Symbol{ e.addr, e.size, name_of( e ) } );
+        }
+    }
+
+private:
+    struct Entry {
+        std::uint64_t addr;
+        std::uint64_t size;
+        std::uint64_t name_offset;   // from the start of the mapping, which may be over 4 GiB with full debug info
+        std::uint32_t name_length;
+        bool is_function;
+    };
+
+    static constexpr std::uint32_t empty{ ~std::uint32_t{} };
+
+    static std::uint64_t hash( std::string_view const s ) {
+        // FNV-1a
+        std::uint64_t h{ 0xcbf29ce484222325ULL };
+        for ( auto const c : s ) {
+            h ^= static_cast< unsigned char >( c );
+            h *= 0x100000001b3ULL;
+        }
+        return h;
+    }
+
+    std::string_view name_of( Entry const & e ) const {
+        return { reinterpret_cast< char const * >( base + e.name_offset ), e.name_length };
+    }
+
+    void add_table( ElfFile const & elf, Elf64_Shdr const & table ) {
+        auto const bytes{ elf.contents( table ) };
+        auto const sections{ elf.sections() };
+        if ( table.sh_link >= sections.size() ) return;
+        auto const & strtab{ sections[ table.sh_link ] };
+
+        std::span< Elf64_Sym const > const symbols{ reinterpret_cast< Elf64_Sym const * >( bytes.data() ), bytes.size() / sizeof( Elf64_Sym ) };
+        entries.reserve( entries.size() + symbols.size() );
+
+        for ( auto const & sym : symbols ) {
+            auto const type{ ELF64_ST_TYPE( sym.st_info ) };
+            if ( sym.st_shndx == SHN_UNDEF || sym.st_value == 0 ) continue;
+            if ( type != STT_FUNC && type != STT_OBJECT && type != STT_NOTYPE ) continue;
+
+            auto const name{ elf.string_at( strtab, sym.st_name ) };
+            if ( name.empty() ) continue;
+
+            entries.push_back( Entry{
+                sym.st_value,
+                sym.st_size,
+                static_cast< std::uint64_t >( reinterpret_cast< std::byte const * >( name.data() ) - base ),
+                static_cast< std::uint32_t >( name.size() ),
+                type == STT_FUNC,
+            } );
+        }
+    }
+
+    void build_hash() {
+        if ( entries.empty() ) return;
+
+        slots.assign( std::bit_ceil( entries.size() * 2 ), empty );
+        auto const mask{ slots.size() - 1 };
+
+        for ( std::uint32_t i{}; i < entries.size(); ++i ) {
+            auto const name{ name_of( entries[ i ] ) };
+            auto slot{ hash( name ) & mask };
+            // names present in both .symtab and .dynsym keep their first entry
+            while ( slots[ slot ] != empty && name_of( entries[ slots[ slot ] ] ) != name ) {
+                slot = ( slot + 1 ) & mask;
+            }
+            if ( slots[ slot ] == empty ) {
+                slots[ slot ] = i;
+            }
+        }
+    }
+
+    std::byte const * base{};
+    std::vector< Entry > entries{};
+    std::vector< std::uint32_t > slots{};
+};
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cerrno>
+#include <csignal>
+#include <functional>
+#include <initializer_list>
+#include <unordered_map>
+#include <utility>
+
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+
+#include "stats.hpp"
+
+// epoll over a handful of file descriptors, each with a callback run when it becomes readable
+struct EventLoop {
+    EventLoop() : epoll_fd{ epoll_create1( EPOLL_CLOEXEC ) } {}
+
+    EventLoop( EventLoop const & ) = delete;
+    EventLoop & operator=( EventLoop const & ) = delete;
+
+    ~EventLoop() {
+        if ( epoll_fd >= 0 ) close( epoll_fd );
+    }
+
+    bool add( int const fd, std::function< void() > callback ) {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if ( epoll_ctl( epoll_fd, EPOLL_CTL_ADD, fd, &event ) != 0 ) return false;
+        callbacks[ fd ] = std::move( callback );
+        return true;
+    }
+
+    void remove( int const fd ) {
+        epoll_ctl( epoll_fd, EPOLL_CTL_DEL, fd, nullptr );
+        callbacks.erase( fd );
+    }
+
+    bool empty() const { return callbacks.empty(); }
+
+    // waits for events and runs their callbacks, returns false if waiting failed
+    bool run_once( int const timeout_ms = -1 ) {
+        epoll_event events[ 8 ];
+        auto const n{ instrumented::epoll_wait( epoll_fd, events, 8, timeout_ms ) };
+        if ( n < 0 ) return errno == EINTR;
+
+        for ( auto i{ 0 }; i < n; ++i ) {
+            // a callback may have removed a descriptor that still has an event in this batch
+            if ( auto const it{ callbacks.find( events[ i ].data.fd ) }; it != std::end( callbacks ) ) {
+                auto const callback{ it->second };
+                callback();
+            }
+        }
+        return true;
+    }
+
+private:
+    int epoll_fd{ -1 };
+    std::unordered_map< int, std::function< void() > > callbacks{};
+};
+
+// Blocks the given signals and delivers them through a file descriptor instead
+struct SignalFd {
+    SignalFd( std::initializer_list< int > const signals ) {
+        sigemptyset( &mask );
+        for ( auto const s : signals ) sigaddset( &mask, s );
+        sigprocmask( SIG_BLOCK, &mask, &previous );
+        fd = signalfd( -1, &mask, SFD_CLOEXEC | SFD_NONBLOCK );
+    }
+
+    SignalFd( SignalFd const & ) = delete;
+    SignalFd & operator=( SignalFd const & ) = delete;
+
+    ~SignalFd() {
+        if ( fd >= 0 ) close( fd );
+        sigprocmask( SIG_SETMASK, &previous, nullptr );
+    }
+
+    int get() const { return fd; }
+
+    // the next pending signal, 0 if there is none
+    int take() {
+        signalfd_siginfo info{};
+        if ( read( fd, &info, sizeof( info ) ) != sizeof( info ) ) return 0;
+        return static_cast< int >( info.ssi_signo );
+    }
+
+private:
+    int fd{ -1 };
+    sigset_t mask{};
+    sigset_t previous{};
+};
+
+// A file descriptor that becomes readable once the process has exited, -1 if unsupported
+inline int open_pidfd( pid_t const pid ) {
+#ifdef SYS_pidfd_open
+    return static_cast< int >( syscall( SYS_pidfd_open, pid, 0 ) );
+#else
+    return -1;
+#endif
+}
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <sys/ptrace.h>
+#include <sys/types.h>
+#include <sys/user.h>
+
+#include "stats.hpp"
+
+// What a debug register traps on, the values are the R/W bits of DR7
+enum class HardwareCondition : std::uint8_t {
+    execute    = 0b00,
+    write      = 0b01,
+    read_write = 0b11,   // x86 cannot trap on reads alone
+};
+
+struct HardwareBreakpoint {
+    std::intptr_t addr{};
+    std::uint8_t len{ 1 };
+    HardwareCondition condition{ HardwareCondition::execute };
+
+    bool is_watchpoint() const { return condition != HardwareCondition::execute; }
+};
+
+// The x86 debug registers of a tracee: DR0-DR3 hold up to four addresses,
+// DR7 enables them and says what to trap on, DR6 reports which one fired.
+// They live in `struct user`, so they are written with PTRACE_POKEUSER,
+// and every thread has its own set, so each of them gets the same values.
+struct DebugRegisters {
+    static constexpr std::size_t slot_count{ 4 };
+
+    DebugRegisters() = default;
+    explicit DebugRegisters( pid_t const pid ) : threads{ pid } {}
+
+    // a new thread starts with its debug registers cleared, it gets the current ones
+    void add_thread( pid_t const tid ) {
+        threads.push_back( tid );
+        if ( empty() ) return;
+        for ( std::size_t i{}; i < slot_count; ++i ) {
+            if ( slots[ i ] ) poke( tid, i, static_cast< std::uint64_t >( slots[ i ]->addr ) );
+        }
+        poke( tid, 7, control() );
+    }
+
+    void remove_thread( pid_t const tid ) { std::erase( threads, tid ); }
+
+    // forgets every slot and thread without writing anything, an exec has already cleared
+    // the registers of the one thread left
+    void reset( pid_t const pid ) {
+        threads = { pid };
+        slots = {};
+    }
+
+    // the tracee was replaced by a process (a fork) whose one thread has none of the debug
+    // registers set, it gets the current ones
+    void rebind( pid_t const pid ) {
+        threads.clear();
+        add_thread( pid );
+    }
+
+    static bool is_valid_length( std::uint8_t const len ) { return len == 1 || len == 2 || len == 4 || len == 8; }
+
+    // returns the slot used, or nothing with `error` saying why: all four are taken, the
+    // hardware cannot do it, or the registers of a thread could not be written
+    std::optional< std::size_t > add( HardwareBreakpoint const & bp, std::string & error ) {
+        if ( !is_valid_length( bp.len ) || bp.addr % bp.len != 0 || ( bp.condition == HardwareCondition::execute && bp.len != 1 ) ) {
+            error = "The hardware cannot trap on that";
+            return std::nullopt;
+        }
+
+        for ( std::size_t i{}; i < slot_count; ++i ) {
+            if ( slots[ i ] ) continue;
+
+            if ( !poke_all( i, static_cast< std::uint64_t >( bp.addr ) ) ) {
+                error = std::string{ "Cannot write the debug registers: " } + std::strerror( errno );
+                return std::nullopt;
+            }
+            slots[ i ] = bp;
+            if ( !poke_all( 7, control() ) ) {
+                error = std::string{ "Cannot write the debug registers: " } + std::strerror( errno );
+                slots[ i ].reset();
+                poke_all( 7, control() );
+                return std::nullopt;
+            }
+            return i;
+        }
+        error = "No free debug register";
+        return std::nullopt;
+    }
+
+    void remove( std::size_t const slot ) {
+        if ( slot >= slot_count || !slots[ slot ] ) return;
+        slots[ slot ].reset();
+        poke_all( 7, control() );
+    }
+
+    // temporarily masks a slot in the DR7 of one thread, e.g. while it steps over the breakpoint
+    void set_enabled( pid_t const tid, std::size_t const slot, bool const enabled ) {
+        if ( slot >= slot_count ) return;
+        auto const local_enable{ std::uint64_t{ 1 } << ( slot * 2 ) };
+        poke( tid, 7, enabled ? control() : control() & ~local_enable );
+    }
+
+    std::optional< HardwareBreakpoint > const & operator[]( std::size_t const slot ) const { return slots[ slot ]; }
+
+    bool empty() const {
+        for ( auto const & slot : slots ) {
+            if ( slot ) return false;
+        }
+        return true;
+    }
+
+    std::optional< std::size_t > find_execute( std::intptr_t const addr ) const {
+        for ( std::size_t i{}; i < slot_count; ++i ) {
+            if ( slots[ i ] && !slots[ i ]->is_watchpoint() && slots[ i ]->addr == addr ) return i;
+        }
+        return std::nullopt;
+    }
+
+    // DR6, bits 0-3 say which slot triggered the last debug exception; cleared after reading,
+    // the CPU never clears it by itself. 0 if it cannot be read, e.g. of a thread that another
+    // thread's exit_group killed since its stop
+    std::uint64_t take_status( pid_t const tid ) {
+        errno = 0;
+        auto const status{ static_cast< std::uint64_t >( instrumented::ptrace( PTRACE_PEEKUSER, tid, debugreg_offset( 6 ), nullptr ) ) };
+        if ( errno != 0 ) return 0;
+        if ( status & 0xf ) {
+            poke( tid, 6, 0 );
+        }
+        return status;
+    }
+
+private:
+    static std::uintptr_t debugreg_offset( std::size_t const index ) {
+        return offsetof( struct user, u_debugreg ) + index * sizeof( user::u_debugreg[ 0 ] );
+    }
+
+    static bool poke( pid_t const tid, std::size_t const index, std::uint64_t const value ) {
+        return instrumented::ptrace( PTRACE_POKEUSER, tid, debugreg_offset( index ), value ) == 0;
+    }
+
+    bool poke_all( std::size_t const index, std::uint64_t const value ) {
+        auto ok{ true };
+        auto error{ 0 };
+        for ( auto const tid : threads ) {
+            if ( !poke( tid, index, value ) && ok ) {
+                ok = false;
+                error = errno;
+            }
+        }
+        // the first failure is the one reported
+        if ( !ok ) errno = error;
+        return ok;
+    }
+
+    std::uint64_t control() const {
+        std::uint64_t dr7{};
+        for ( std::size_t i{}; i < slot_count; ++i ) {
+            if ( !slots[ i ] ) continue;
+
+            // LEN encoding: 1 -> 00, 2 -> 01, 8 -> 10, 4 -> 11
+            std::uint64_t len{};
+            switch ( slots[ i ]->len ) {
+                case 2: len = 0b01; break;
+                case 8: len = 0b10; break;
+                case 4: len = 0b11; break;
+            }
+
+            dr7 |= std::uint64_t{ 1 } << ( i * 2 );   // local enable
+            dr7 |= static_cast< std::uint64_t >( slots[ i ]->condition ) << ( 16 + i * 4 );
+            dr7 |= len << ( 18 + i * 4 );
+        }
+        return dr7;
+    }
+
+    std::vector< pid_t > threads{};
+    std::array< std::optional< HardwareBreakpoint >, slot_count > slots{};
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <csignal>
+#include <sched.h>
+#include <unistd.h>
+
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+
+#include "memory.hpp"
+#include "stats.hpp"
+
+inline constexpr std::array< std::byte, 2 > syscall_instruction{ std::byte{ 0x0f }, std::byte{ 0x05 } };
+
+// Makes the stopped tracee run one system call on our behalf: the registers
+// are loaded with the call, a `syscall` instruction at `site` is single-stepped
+// and everything is put back afterwards. If `site` does not already hold a
+// syscall instruction, one is patched in for the duration of the call.
+//
+// Returns the raw result, -errno on failure like the kernel does.
+inline std::int64_t inject_syscall( pid_t const pid, Memory & memory, user_regs_struct const & saved, std::intptr_t const site,
+                                    std::uint64_t const nr, std::array< std::uint64_t, 6 > const & args )
+{
+    std::array< std::byte, 2 > original{};
+    if ( memory.read_memory( site, original ) != original.size() ) return -1;
+
+    auto const patch{ original != syscall_instruction };
+    if ( patch && memory.write_memory( site, syscall_instruction ) != syscall_instruction.size() ) return -1;
+
+    auto regs{ saved };
+    regs.rax = nr;
+    regs.rdi = args[ 0 ];
+    regs.rsi = args[ 1 ];
+    regs.rdx = args[ 2 ];
+    regs.r10 = args[ 3 ];
+    regs.r8  = args[ 4 ];
+    regs.r9  = args[ 5 ];
+    regs.rip = static_cast< std::uint64_t >( site );
+    // not in a system call, so the kernel does not try to restart one
+    regs.orig_rax = ~std::uint64_t{};
+
+    instrumented::ptrace( PTRACE_SETREGS, pid, nullptr, &regs );
+
+    // The step is over once its SIGTRAP comes from past the syscall instruction. Before that
+    // a call a seccomp filter of ours traps, or a traced fork, stops with an event and just goes
+    // on; a signal that was pending stops it before the call ran, or interrupts the call, which
+    // the kernel restarts. Those signals are held back and sent again once the call is done.
+    std::vector< int > held{};
+    int status{};
+    for ( ;; ) {
+        instrumented::ptrace( PTRACE_SINGLESTEP, pid, nullptr, nullptr );
+        if ( instrumented::waitpid( pid, &status, __WALL ) != pid ) status = 0;
+        if ( !WIFSTOPPED( status ) ) break;
+        if ( status >> 16 != 0 ) continue;
+        if ( WSTOPSIG( status ) == SIGTRAP ) {
+            instrumented::ptrace( PTRACE_GETREGS, pid, nullptr, &regs );
+            if ( regs.rip == static_cast< std::uint64_t >( site ) + syscall_instruction.size() ) break;
+        }
+        held.push_back( WSTOPSIG( status ) );
+    }
+
+    if ( WIFSTOPPED( status ) ) instrumented::ptrace( PTRACE_SETREGS, pid, nullptr, &saved );
+    if ( patch ) memory.write_memory( site, original );
+    for ( auto const sig : held ) syscall( SYS_tkill, pid, sig );
+
+    if ( !WIFSTOPPED( status ) ) return -1;
+    return static_cast< std::int64_t >( regs.rax );
+}
+
+// Forks the stopped tracee with an injected system call, see inject_syscall(). The copy is
+// made a sibling of the tracee, i.e. a child of ours, and is traced from the start: it is
+// left stopped with the registers the tracee had before the call, and with `options`.
+//
+// `site` must already hold a syscall instruction, or the copy gets the patched code.
+inline pid_t inject_fork( pid_t const pid, Memory & memory, user_regs_struct const & saved, std::intptr_t const site, long const options )
+{
+    instrumented::ptrace( PTRACE_SETOPTIONS, pid, nullptr, options | PTRACE_O_TRACEFORK );
+    auto const child{ inject_syscall( pid, memory, saved, site, SYS_clone, { CLONE_PARENT | SIGCHLD, 0, 0, 0, 0, 0 } ) };
+    instrumented::ptrace( PTRACE_SETOPTIONS, pid, nullptr, options );
+    if ( child <= 0 ) return -1;
+
+    // an automatically attached child starts with a SIGSTOP, which it is left in
+    int status{};
+    auto const tid{ static_cast< pid_t >( child ) };
+    if ( instrumented::waitpid( tid, &status, __WALL ) != tid || !WIFSTOPPED( status ) ) return -1;
+    instrumented::ptrace( PTRACE_SETOPTIONS, tid, nullptr, options );
+    instrumented::ptrace( PTRACE_SETREGS, tid, nullptr, &saved );
+    return tid;
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string_view>
+
+#include <unistd.h>
+
+// JSON objects, one per line, formatted straight into a buffer allocated once and
+// written out with a single write() when it fills up or is flushed; no streams and
+// no formatting state. 64 bit values go out as "0x..." strings, JSON numbers are doubles.
+struct JsonLines {
+    static constexpr std::size_t capacity{ 65536 };
+
+    explicit JsonLines( int const fd ) : fd{ fd }, buffer{ std::make_unique< char[] >( capacity ) } {}
+
+    JsonLines( JsonLines const & ) = delete;
+    JsonLines & operator=( JsonLines const & ) = delete;
+
+    ~JsonLines() { flush(); }
+
+    // {"event":"<event>"
+    JsonLines & begin( std::string_view const event ) {
+        raw( "{\"event\":" );
+        quoted( event );
+        return *this;
+    }
+
+    JsonLines & field( std::string_view const key, std::string_view const value ) {
+        name( key );
+        quoted( value );
+        return *this;
+    }
+
+    JsonLines & field( std::string_view const key, char const * const value ) { return field( key, std::string_view{ value } ); }
+
+    JsonLines & field( std::string_view const key, std::int64_t const value ) {
+        name( key );
+        reserve( 24 );
+        used = static_cast< std::size_t >( std::to_chars( buffer.get() + used, buffer.get() + capacity, value ).ptr - buffer.get() );
+        return *this;
+    }
+
+    JsonLines & flag( std::string_view const key, bool const value ) {
+        name( key );
+        raw( value ? "true" : "false" );
+        return *this;
+    }
+
+    JsonLines & hex( std::string_view const key, std::uint64_t const value ) {
+        name( key );
+        reserve( 20 );
+        buffer[ used++ ] = '"';
+        buffer[ used++ ] = '0';
+        buffer[ used++ ] = 'x';
+        used = static_cast< std::size_t >( std::to_chars( buffer.get() + used, buffer.get() + capacity, value, 16 ).ptr - buffer.get() );
+        buffer[ used++ ] = '"';
+        return *this;
+    }
+
+    // two hex digits per byte, in chunks when it does not fit the buffer
+    JsonLines & bytes( std::string_view const key, std::span< std::byte const > const data ) {
+        static constexpr std::string_view digits{ "0123456789abcdef" };
+        name( key );
+        raw( "\"" );
+        for ( auto const b : data ) {
+            reserve( 2 );
+            buffer[ used++ ] = digits[ std::to_integer< unsigned >( b ) >> 4 ];
+            buffer[ used++ ] = digits[ std::to_integer< unsigned >( b ) & 0xf ];
+        }
+        raw( "\"" );
+        return *this;
+    }
+
+    void end() { raw( "}\n" ); }
+
+    void flush() {
+        std::size_t done{};
+        while ( done < used ) {
+            auto const n{ write( fd, buffer.get() + done, used - done ) };
+            if ( n < 0 && errno == EINTR ) continue;
+            if ( n <= 0 ) break;
+            done += static_cast< std::size_t >( n );
+        }
+        used = 0;
+    }
+
+private:
+    void reserve( std::size_t const n ) {
+        if ( capacity - used < n ) flush();
+    }
+
+    void raw( std::string_view const s ) {
+        for ( std::size_t done{}; done < s.size(); ) {
+            reserve( 1 );
+            auto const n{ std::min( s.size() - done, capacity - used ) };
+            s.copy( buffer.get() + used, n, done );
+            used += n;
+            done += n;
+        }
+    }
+
+    void name( std::string_view const key ) {
+        raw( ",\"" );
+        raw( key );
+        raw( "\":" );
+    }
+
+    void quoted( std::string_view const s ) {
+        static constexpr std::string_view digits{ "0123456789abcdef" };
+        reserve( 1 );
+        buffer[ used++ ] = '"';
+        for ( auto const c : s ) {
+            reserve( 6 );
+            auto const u{ static_cast< unsigned char >( c ) };
+            if ( c == '"' || c == '\\' ) {
+                buffer[ used++ ] = '\\';
+                buffer[ used++ ] = c;
+            } else if ( u < 0x20 ) {
+                std::array< char, 6 > const escaped{ '\\', 'u', '0', '0', digits[ u >> 4 ], digits[ u & 0xf ] };
+                for ( auto const e : escaped ) buffer[ used++ ] = e;
+            } else {
+                buffer[ used++ ] = c;
+            }
+        }
+        reserve( 1 );
+        buffer[ used++ ] = '"';
+    }
+
+    int fd{ -1 };
+    std::unique_ptr< char[] > buffer;
+    std::size_t used{};
+};
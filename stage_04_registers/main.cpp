@@ -1,37 +1,65 @@
 #include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <string_view>
 #include <unistd.h>
 
 #include <sys/ptrace.h>
 #include <sys/personality.h>
+#include <sys/prctl.h>
 
 #include "debugger.hpp"
 
-#include <chrono>
-#include <thread>
-
-using namespace std::chrono_literals;
-
 int main( int const argc, char const * argv[] ) {
-    if ( argc < 2 ) {
-        std::printf( "Program not specified!\n" );
+    // --batch <script> runs the script's commands, stdout then only carries their JSON lines
+    char const * script{};
+    auto first{ 1 };
+    if ( argc > 2 && std::string_view{ argv[ 1 ] } == "--batch" ) {
+        script = argv[ 2 ];
+        first = 3;
+        std::cout.rdbuf( std::cerr.rdbuf() );
+    }
+
+    if ( argc <= first ) {
+        std::printf( "Program not specified! Usage: dbgg [--batch <script>] <program> or dbgg [--batch <script>] --attach <pid>\n" );
         return -1;
     }
 
-    auto prog{ argv[ 1 ] };
+    if ( std::string_view{ argv[ first ] } == "--attach" ) {
+        auto const pid{ argc > first + 1 ? static_cast< pid_t >( std::strtol( argv[ first + 1 ], nullptr, 10 ) ) : 0 };
+        if ( pid <= 0 ) {
+            std::printf( "No pid to attach to!\n" );
+            return -1;
+        }
+        std::error_code ec{};
+        auto const prog{ std::filesystem::read_symlink( "/proc/" + std::to_string( pid ) + "/exe", ec ) };
+
+        Debugger dbg{ prog.string(), pid };
+        if ( script && !dbg.load_script( script ) ) return -1;
+        if ( !dbg.attach() ) return -1;
+        dbg.run();
+        return 0;
+    }
+
+    auto prog{ argv[ first ] };
     auto pid{ fork() };
 
     if ( pid == 0 ) {
         // child process ( debugee )
-        printf("PID of the child is: %d\n", getpid() );
+        if ( !script ) printf("PID of the child is: %d\n", getpid() );
         personality( ADDR_NO_RANDOMIZE );
+        // lets the debugger install seccomp filters in us for `catch syscall` without privileges
+        prctl( PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0 );
         ptrace( PTRACE_TRACEME, 0, nullptr, nullptr );
         execl( prog, prog, nullptr );
     } else if ( pid >= 1 ) {
-        // parent process ( debugger )
-        std::this_thread::sleep_for( 1s );
-        printf( "Hello world, I am the parent! I am going to debug!\n" );
+        // parent process ( debugger ), no need to wait for the child: run() waits for its exec stop
+        if ( !script ) printf( "Hello world, I am the parent! I am going to debug!\n" );
 
         Debugger dbg{ prog, pid };
+        if ( script && !dbg.load_script( script ) ) return -1;
         dbg.run();
     }
     return 0;
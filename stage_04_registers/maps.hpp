@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/types.h>
+
+// One line of /proc/<pid>/maps
+struct MemoryRegion {
+    std::uintptr_t start{};
+    std::uintptr_t end{};
+    std::uint64_t offset{};
+    std::uint64_t inode{};
+    bool readable{};
+    bool writable{};
+    bool executable{};
+    bool shared{};
+    std::string path{};
+
+    std::uint64_t size() const { return end - start; }
+};
+
+inline std::vector< MemoryRegion > read_memory_maps( pid_t const pid ) {
+    std::vector< MemoryRegion > regions{};
+    std::ifstream maps{ "/proc/" + std::to_string( pid ) + "/maps" };
+
+    for ( std::string line; std::getline( maps, line ); ) {
+        // 555555554000-555555555000 r--p 00000000 fe:01 1234   /path/to/prog
+        std::istringstream ss{ line };
+        MemoryRegion region{};
+        std::string range, perms, device;
+        ss >> range >> perms >> std::hex >> region.offset >> device >> std::dec >> region.inode;
+        std::getline( ss >> std::ws, region.path );
+
+        auto const dash{ range.find( '-' ) };
+        if ( dash == std::string::npos || perms.size() < 4 ) continue;
+        region.start      = std::stoull( range.substr( 0, dash ), nullptr, 16 );
+        region.end        = std::stoull( range.substr( dash + 1 ), nullptr, 16 );
+        region.readable   = perms[ 0 ] == 'r';
+        region.writable   = perms[ 1 ] == 'w';
+        region.executable = perms[ 2 ] == 'x';
+        region.shared     = perms[ 3 ] == 's';
+
+        regions.push_back( std::move( region ) );
+    }
+    return regions;
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/ptrace.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "stats.hpp"
+
+// Bulk access to the tracee's address space.
+//
+// Reads go through process_vm_readv, which copies a whole range with one
+// syscall. Its counterpart process_vm_writev honours page protections and
+// cannot write into the read-only text pages breakpoints live in, so writes go through
+// /proc/<pid>/mem, which the kernel lets a tracer write regardless of
+// protections. Word-by-word PTRACE_PEEKDATA/POKEDATA is only the fallback
+// for when neither of those is available.
+struct Memory {
+    Memory() = default;
+    explicit Memory( pid_t const pid ) : pid{ pid } {}
+
+    Memory( Memory const & ) = delete;
+    Memory & operator=( Memory const & ) = delete;
+
+    Memory( Memory && other ) noexcept : pid{ other.pid }, mem_fd{ std::exchange( other.mem_fd, -1 ) } {}
+    Memory & operator=( Memory && other ) noexcept {
+        if ( this != &other ) {
+            close_mem();
+            pid = other.pid;
+            mem_fd = std::exchange( other.mem_fd, -1 );
+        }
+        return *this;
+    }
+
+    ~Memory() { close_mem(); }
+
+    // the tracee changed (e.g. after exec), the cached /proc/<pid>/mem is stale
+    void reset( pid_t const new_pid ) {
+        close_mem();
+        pid = new_pid;
+    }
+
+    // returns the number of bytes read, less than out.size() only if the range is (partially) unmapped
+    std::size_t read_memory( std::intptr_t const addr, std::span< std::byte > const out ) {
+        if ( out.empty() ) return 0;
+
+        std::size_t done{};
+        while ( done < out.size() ) {
+            iovec local { out.data() + done, out.size() - done };
+            iovec remote{ reinterpret_cast< void * >( addr + done ), out.size() - done };
+
+            auto const n{ instrumented::process_vm_readv( pid, &local, 1, &remote, 1, 0 ) };
+            if ( n <= 0 ) break;
+            done += static_cast< std::size_t >( n );
+        }
+
+        if ( done < out.size() ) {
+            done += read_proc_mem( addr + done, out.subspan( done ) );
+        }
+        if ( done < out.size() ) {
+            done += peek( addr + done, out.subspan( done ) );
+        }
+        return done;
+    }
+
+    // returns the number of bytes written
+    std::size_t write_memory( std::intptr_t const addr, std::span< std::byte const > const in ) {
+        if ( in.empty() ) return 0;
+
+        auto done{ write_proc_mem( addr, in ) };
+        if ( done < in.size() ) {
+            done += poke( addr + done, in.subspan( done ) );
+        }
+        return done;
+    }
+
+    template< typename T >
+    bool read_value( std::intptr_t const addr, T & value ) {
+        return read_memory( addr, std::as_writable_bytes( std::span{ &value, 1 } ) ) == sizeof( T );
+    }
+
+    template< typename T >
+    bool write_value( std::intptr_t const addr, T const & value ) {
+        return write_memory( addr, std::as_bytes( std::span{ &value, 1 } ) ) == sizeof( T );
+    }
+
+private:
+    bool open_mem() {
+        if ( mem_fd >= 0 ) return true;
+
+        auto const path{ "/proc/" + std::to_string( pid ) + "/mem" };
+        mem_fd = open( path.c_str(), O_RDWR | O_CLOEXEC );
+        return mem_fd >= 0;
+    }
+
+    void close_mem() {
+        if ( mem_fd >= 0 ) {
+            close( mem_fd );
+        }
+        mem_fd = -1;
+    }
+
+    std::size_t read_proc_mem( std::intptr_t const addr, std::span< std::byte > const out ) {
+        if ( !open_mem() ) return 0;
+
+        std::size_t done{};
+        while ( done < out.size() ) {
+            auto const n{ instrumented::pread( mem_fd, out.data() + done, out.size() - done, static_cast< off_t >( addr + done ) ) };
+            if ( n < 0 && errno == EINTR ) continue;
+            if ( n <= 0 ) break;
+            done += static_cast< std::size_t >( n );
+        }
+        return done;
+    }
+
+    std::size_t write_proc_mem( std::intptr_t const addr, std::span< std::byte const > const in ) {
+        if ( !open_mem() ) return 0;
+
+        std::size_t done{};
+        while ( done < in.size() ) {
+            auto const n{ instrumented::pwrite( mem_fd, in.data() + done, in.size() - done, static_cast< off_t >( addr + done ) ) };
+            if ( n < 0 && errno == EINTR ) continue;
+            if ( n <= 0 ) break;
+            done += static_cast< std::size_t >( n );
+        }
+        return done;
+    }
+
+    std::size_t peek( std::intptr_t const addr, std::span< std::byte > const out ) {
+        std::size_t done{};
+        while ( done < out.size() ) {
+            errno = 0;
+            auto const word{ instrumented::ptrace( PTRACE_PEEKDATA, pid, addr + done, nullptr ) };
+            if ( errno != 0 ) break;
+
+            auto const n{ std::min( sizeof( word ), out.size() - done ) };
+            std::memcpy( out.data() + done, &word, n );
+            done += n;
+        }
+        return done;
+    }
+
+    std::size_t poke( std::intptr_t const addr, std::span< std::byte const > const in ) {
+        std::size_t done{};
+        while ( done < in.size() ) {
+            long word{};
+            auto const n{ std::min( sizeof( word ), in.size() - done ) };
+            if ( n < sizeof( word ) ) {
+                // partial word, keep the bytes past the end of the range
+                errno = 0;
+                word = instrumented::ptrace( PTRACE_PEEKDATA, pid, addr + done, nullptr );
+                if ( errno != 0 ) break;
+            }
+            std::memcpy( &word, in.data() + done, n );
+            if ( instrumented::ptrace( PTRACE_POKEDATA, pid, addr + done, word ) < 0 ) break;
+            done += n;
+        }
+        return done;
+    }
+
+    pid_t pid{};
+    int mem_fd{ -1 };
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+// FNV-1a over the name, started from a seed and mixed at the end so the low bits depend on every byte
+constexpr std::uint32_t hash_name( std::string_view const name, std::uint32_t const seed ) {
+    std::uint32_t h{ 2166136261U ^ ( seed * 0x9e3779b9U ) };
+    for ( auto const c : name ) {
+        h ^= static_cast< unsigned char >( c );
+        h *= 16777619U;
+    }
+    h ^= h >> 16;
+    h *= 0x45d9f3bU;
+    h ^= h >> 16;
+    return h;
+}
+
+// A perfect hash over a fixed set of names, built at compile time by hash and displace:
+// the names are spread over buckets by one hash, then every bucket, the fullest first,
+// is given the seed that sends each of its names to a slot of its own. A lookup is two
+// hashes and one compare, whatever the number of names.
+template< typename Value, std::size_t N >
+struct PerfectHash {
+    static constexpr std::size_t bucket_count{ N / 2 + 1 };
+    static constexpr std::size_t slot_count{ std::bit_ceil( 2 * N ) };
+
+    struct Entry {
+        std::string_view name{};
+        Value value{};
+    };
+
+    consteval explicit PerfectHash( std::array< Entry, N > const & entries ) {
+        std::array< std::size_t, N > bucket_of{};
+        std::array< std::size_t, bucket_count > sizes{};
+        for ( std::size_t i{}; i < N; ++i ) {
+            bucket_of[ i ] = hash_name( entries[ i ].name, 0 ) % bucket_count;
+            ++sizes[ bucket_of[ i ] ];
+        }
+
+        std::array< bool, slot_count > taken{};
+        for ( auto size{ N }; size > 0; --size ) {
+            for ( std::size_t bucket{}; bucket < bucket_count; ++bucket ) {
+                if ( sizes[ bucket ] != size ) continue;
+
+                for ( std::uint32_t seed{ 1 }; ; ++seed ) {
+                    // two equal names never get slots of their own
+                    if ( seed > 100000 ) throw "no perfect hash for these names, is one of them there twice?";
+                    auto tried{ taken };
+                    auto fits{ true };
+                    for ( std::size_t i{}; i < N && fits; ++i ) {
+                        if ( bucket_of[ i ] != bucket ) continue;
+                        auto const slot{ hash_name( entries[ i ].name, seed ) & ( slot_count - 1 ) };
+                        fits = !tried[ slot ];
+                        tried[ slot ] = true;
+                    }
+                    if ( !fits ) continue;
+
+                    seeds[ bucket ] = seed;
+                    for ( std::size_t i{}; i < N; ++i ) {
+                        if ( bucket_of[ i ] == bucket ) slots[ hash_name( entries[ i ].name, seed ) & ( slot_count - 1 ) ] = entries[ i ];
+                    }
+                    taken = tried;
+                    break;
+                }
+            }
+        }
+    }
+
+    constexpr std::optional< Value > find( std::string_view const name ) const {
+        if ( name.empty() ) return std::nullopt;
+        auto const & entry{ slots[ hash_name( name, seeds[ hash_name( name, 0 ) % bucket_count ] ) & ( slot_count - 1 ) ] };
+        if ( entry.name != name ) return std::nullopt;
+        return entry.value;
+    }
+
+private:
+    std::array< std::uint32_t, bucket_count > seeds{};
+    std::array< Entry, slot_count > slots{};
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+
+// Sample counts per distinct stack, in a fixed-size open-addressing table.
+//
+// Filled and read by the debugger's thread only, between its waits for the
+// tracee, so nothing in it is synchronised. A sample costs a hash of its
+// frames and a probe or two; nothing is allocated once the table exists.
+// Nothing is ever removed and the table never grows; once it is full, new
+// stacks are only counted as dropped.
+struct StackHistogram {
+    static constexpr std::size_t max_depth{ 64 };
+
+    // `capacity` has to be a power of two
+    explicit StackHistogram( std::size_t const capacity = 4096 ) : mask{ capacity - 1 }, slots{ std::make_unique< Slot[] >( capacity ) } {}
+
+    std::size_t capacity() const { return mask + 1; }
+
+    bool add( std::span< std::uint64_t const > stack ) {
+        if ( stack.size() > max_depth ) stack = stack.first( max_depth );
+        auto const key{ hash( stack ) | 1 };    // 0 marks a free slot
+
+        for ( std::size_t probe{}; probe <= mask; ++probe ) {
+            auto & slot{ slots[ ( key + probe ) & mask ] };
+
+            if ( slot.key == 0 ) {
+                slot.key = key;
+                slot.depth = static_cast< std::uint32_t >( stack.size() );
+                std::copy( std::begin( stack ), std::end( stack ), std::begin( slot.frames ) );
+                slot.count = 1;
+                return true;
+            }
+            if ( slot.key == key && slot.depth == stack.size() && std::equal( std::begin( stack ), std::end( stack ), std::begin( slot.frames ) ) ) {
+                ++slot.count;
+                return true;
+            }
+        }
+        ++dropped;
+        return false;
+    }
+
+    // f( std::span< std::uint64_t const > stack, std::uint64_t count ), leaf first
+    template< typename F >
+    void for_each( F && f ) const {
+        for ( std::size_t i{}; i <= mask; ++i ) {
+            auto const & slot{ slots[ i ] };
+            if ( slot.key == 0 ) continue;
+            f( std::span{ slot.frames }.first( slot.depth ), slot.count );
+        }
+    }
+
+    std::uint64_t dropped_samples() const { return dropped; }
+
+private:
+    struct Slot {
+        std::uint64_t key{};
+        std::uint64_t count{};
+        std::uint32_t depth{};
+        std::array< std::uint64_t, max_depth > frames{};
+    };
+
+    // FNV-1a over the frame addresses
+    static std::uint64_t hash( std::span< std::uint64_t const > const stack ) {
+        std::uint64_t h{ 0xcbf29ce484222325ULL };
+        for ( auto const frame : stack ) {
+            h ^= frame;
+            h *= 0x100000001b3ULL;
+        }
+        return h;
+    }
+
+    std::size_t mask{};
+    std::unique_ptr< Slot[] > slots{};
+    std::uint64_t dropped{};
+};
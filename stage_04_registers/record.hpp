@@ -0,0 +1,243 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysinfo.h>
+
+// A system call whose result comes from outside the process, and the buffer it fills in:
+// argument `buffer` points to it, its length is `unit` bytes times the result, times
+// argument `count`, or just `unit` bytes
+struct RecordedSyscall {
+    static constexpr int from_result{ -1 };
+    static constexpr int fixed{ -2 };
+
+    long nr;
+    int buffer;
+    int count;
+    std::size_t unit;
+};
+
+inline constexpr std::array< RecordedSyscall, 11 > recorded_syscalls{{
+    { SYS_read,          1, RecordedSyscall::from_result, 1                        },
+    { SYS_pread64,       1, RecordedSyscall::from_result, 1                        },
+    { SYS_recvfrom,      1, RecordedSyscall::from_result, 1                        },
+    { SYS_getrandom,     0, RecordedSyscall::from_result, 1                        },
+    { SYS_epoll_wait,    1, RecordedSyscall::from_result, 12                       },   // packed epoll_event
+    { SYS_epoll_pwait,   1, RecordedSyscall::from_result, 12                       },
+    { SYS_poll,          0, 1,                            8                        },   // pollfd, revents
+    { SYS_clock_gettime, 1, RecordedSyscall::fixed,       16                       },   // timespec
+    { SYS_gettimeofday,  0, RecordedSyscall::fixed,       16                       },   // timeval
+    { SYS_time,          0, RecordedSyscall::fixed,       8                        },
+    { SYS_sysinfo,       0, RecordedSyscall::fixed,       sizeof( struct sysinfo ) },
+}};
+
+inline RecordedSyscall const * find_recorded_syscall( long const nr ) {
+    auto const it{ std::find_if( std::begin( recorded_syscalls ), std::end( recorded_syscalls ), [nr]( auto const & s ) { return s.nr == nr; } ) };
+    return it != std::end( recorded_syscalls ) ? &*it : nullptr;
+}
+
+// how many bytes of the buffer the call with these arguments filled in
+inline std::size_t recorded_length( RecordedSyscall const & s, std::array< std::uint64_t, 6 > const & args, std::int64_t const result ) {
+    if ( result < 0 || args[ static_cast< std::size_t >( s.buffer ) ] == 0 ) return 0;
+    switch ( s.count ) {
+        case RecordedSyscall::from_result: return static_cast< std::size_t >( result ) * s.unit;
+        case RecordedSyscall::fixed:       return s.unit;
+        default:                           return args[ static_cast< std::size_t >( s.count ) ] * s.unit;
+    }
+}
+
+// ERESTARTSYS to ERESTART_RESTARTBLOCK, only a tracer ever sees these at the exit of a call that will be restarted
+inline bool is_restarted( std::int64_t const result ) {
+    return result <= -512 && result >= -516;
+}
+
+// The log file: a header, then one entry per system call in the order they returned,
+// each followed by the bytes the call wrote, padded to 8. Nothing refers back, the
+// file is only ever appended to and can be replayed, or mapped, as far as it got.
+namespace syscall_log {
+    inline constexpr std::uint64_t magic{ 0x31474f4c47474244 };   // "DBGGLOG1"
+
+    struct Entry {
+        std::int64_t result;
+        std::uint32_t nr;
+        std::uint32_t size;   // of the data that follows
+    };
+    static_assert( sizeof( Entry ) == 16 );
+
+    inline constexpr std::size_t padded( std::size_t const size ) { return ( size + 7 ) & ~std::size_t{ 7 }; }
+}
+
+// Appends entries to a log through a buffer, a write() only every 64 KiB
+struct SyscallLogWriter {
+    static constexpr std::size_t buffer_size{ 65536 };
+
+    SyscallLogWriter() = default;
+
+    explicit SyscallLogWriter( std::string const & path ) : fd{ open( path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 ) } {
+        buffer.reserve( buffer_size );
+        if ( fd >= 0 ) put( &syscall_log::magic, sizeof( syscall_log::magic ) );
+    }
+
+    SyscallLogWriter( SyscallLogWriter const & ) = delete;
+    SyscallLogWriter & operator=( SyscallLogWriter const & ) = delete;
+
+    SyscallLogWriter( SyscallLogWriter && other ) noexcept : fd{ std::exchange( other.fd, -1 ) }, buffer{ std::move( other.buffer ) }, count{ other.count } {}
+    SyscallLogWriter & operator=( SyscallLogWriter && other ) noexcept {
+        if ( this != &other ) {
+            close_log();
+            fd = std::exchange( other.fd, -1 );
+            buffer = std::move( other.buffer );
+            count = other.count;
+        }
+        return *this;
+    }
+
+    ~SyscallLogWriter() { close_log(); }
+
+    bool is_open() const { return fd >= 0; }
+    std::uint64_t entries() const { return count; }
+
+    // `fill` writes the call's data straight into the buffer and returns how much it could;
+    // whatever it could not read is logged as zeroes, the entry keeps its size
+    template< typename F >
+    void append( long const nr, std::int64_t const result, std::size_t const size, F && fill ) {
+        syscall_log::Entry const entry{ result, static_cast< std::uint32_t >( nr ), static_cast< std::uint32_t >( size ) };
+        put( &entry, sizeof( entry ) );
+
+        auto const padded{ syscall_log::padded( size ) };
+        if ( buffer.size() + padded > buffer_size ) flush();
+        auto const at{ buffer.size() };
+        buffer.resize( at + padded );
+        auto const data{ std::span{ buffer }.subspan( at, size ) };
+        auto const n{ fill( data ) };
+        std::fill( std::begin( buffer ) + static_cast< std::ptrdiff_t >( at + std::min( n, size ) ), std::end( buffer ), std::byte{} );
+        if ( buffer.size() >= buffer_size ) flush();
+        ++count;
+    }
+
+    bool flush() {
+        std::size_t done{};
+        while ( fd >= 0 && done < buffer.size() ) {
+            auto const n{ write( fd, buffer.data() + done, buffer.size() - done ) };
+            if ( n < 0 && errno == EINTR ) continue;
+            if ( n <= 0 ) break;
+            done += static_cast< std::size_t >( n );
+        }
+        auto const ok{ done == buffer.size() };
+        buffer.clear();
+        return ok;
+    }
+
+private:
+    void put( void const * const data, std::size_t const size ) {
+        if ( buffer.size() + size > buffer_size ) flush();
+        auto const * const bytes{ static_cast< std::byte const * >( data ) };
+        buffer.insert( std::end( buffer ), bytes, bytes + size );
+    }
+
+    void close_log() {
+        if ( fd >= 0 ) {
+            flush();
+            close( fd );
+        }
+        fd = -1;
+    }
+
+    int fd{ -1 };
+    std::vector< std::byte > buffer{};
+    std::uint64_t count{};
+};
+
+// Walks a log mapped read-only, one entry at a time
+struct SyscallLogReader {
+    struct Entry {
+        long nr;
+        std::int64_t result;
+        std::span< std::byte const > data;
+    };
+
+    SyscallLogReader() = default;
+
+    explicit SyscallLogReader( std::string const & path ) {
+        auto const fd{ open( path.c_str(), O_RDONLY | O_CLOEXEC ) };
+        if ( fd < 0 ) return;
+        struct stat st{};
+        if ( fstat( fd, &st ) == 0 && static_cast< std::size_t >( st.st_size ) >= sizeof( syscall_log::magic ) ) {
+            auto * const mapped{ mmap( nullptr, static_cast< std::size_t >( st.st_size ), PROT_READ, MAP_PRIVATE, fd, 0 ) };
+            if ( mapped != MAP_FAILED ) {
+                madvise( mapped, static_cast< std::size_t >( st.st_size ), MADV_SEQUENTIAL );
+                data = static_cast< std::byte const * >( mapped );
+                size = static_cast< std::size_t >( st.st_size );
+            }
+        }
+        close( fd );
+
+        std::uint64_t magic{};
+        if ( data ) std::memcpy( &magic, data, sizeof( magic ) );
+        if ( magic != syscall_log::magic ) {
+            unmap();
+            return;
+        }
+        offset = sizeof( magic );
+    }
+
+    SyscallLogReader( SyscallLogReader const & ) = delete;
+    SyscallLogReader & operator=( SyscallLogReader const & ) = delete;
+
+    SyscallLogReader( SyscallLogReader && other ) noexcept : data{ std::exchange( other.data, nullptr ) }, size{ other.size }, offset{ other.offset }, count{ other.count } {}
+    SyscallLogReader & operator=( SyscallLogReader && other ) noexcept {
+        if ( this != &other ) {
+            unmap();
+            data = std::exchange( other.data, nullptr );
+            size = other.size;
+            offset = other.offset;
+            count = other.count;
+        }
+        return *this;
+    }
+
+    ~SyscallLogReader() { unmap(); }
+
+    bool is_open() const { return data != nullptr; }
+    std::uint64_t entries() const { return count; }
+
+    // the next entry, nothing at the end of the log or of what was written of it
+    std::optional< Entry > next() {
+        syscall_log::Entry entry{};
+        if ( !data || size - offset < sizeof( entry ) ) return std::nullopt;
+        std::memcpy( &entry, data + offset, sizeof( entry ) );
+        if ( size - offset - sizeof( entry ) < entry.size ) return std::nullopt;
+
+        Entry const out{ static_cast< long >( entry.nr ), entry.result, { data + offset + sizeof( entry ), entry.size } };
+        offset = std::min( size, offset + sizeof( entry ) + syscall_log::padded( entry.size ) );
+        ++count;
+        return out;
+    }
+
+private:
+    void unmap() {
+        if ( data ) munmap( const_cast< std::byte * >( data ), size );
+        data = nullptr;
+    }
+
+    std::byte const * data{};
+    std::size_t size{};
+    std::size_t offset{};
+    std::uint64_t count{};
+};
@@ -1,8 +1,15 @@
+#pragma once
+
 #include <sys/ptrace.h>
 #include <sys/user.h>
 
 #include <array>
+#include <optional>
 #include <string>
+#include <string_view>
+
+#include "perfect_hash.hpp"
+#include "stats.hpp"
 
 enum class Register {
   r15,
@@ -34,6 +41,12 @@ enum class Register {
   gs
 };
 
+// EFLAGS.RF, suppresses instruction breakpoints for the next instruction
+inline constexpr std::uint64_t resume_flag{ 1U << 16 };
+
+// EFLAGS.TF, what single-stepping sets
+inline constexpr std::uint64_t trap_flag{ 1U << 8 };
+
 struct RegisterDescriptor {
     Register r;
     int dwarf_id{};
@@ -49,7 +62,7 @@ inline auto init_registers() {
         { r13      , 13 , "r13"      , 0 } ,
         { r12      , 12 , "r12"      , 0 } ,
         { rbp      ,  6 , "rbp"      , 0 } ,
-        { rbx      ,  7 , "rbx"      , 0 } ,
+        { rbx      ,  3 , "rbx"      , 0 } ,
         { r11      , 11 , "r11"      , 0 } ,
         { r10      , 10 , "r10"      , 0 } ,
         { r9       ,  9 , "r9"       , 0 } ,
@@ -60,7 +73,7 @@ inline auto init_registers() {
         { rsi      ,  4 , "rsi"      , 0 } ,
         { rdi      ,  5 , "rdi"      , 0 } ,
         { orig_rax , -1 , "orig_rax" , 0 } ,
-        { rip      , -1 , "rip"      , 0 } ,
+        { rip      , 16 , "rip"      , 0 } ,
         { cs       , 51 , "cs"       , 0 } ,
         { eflags   , 49 , "eflags"   , 0 } ,
         { rsp      ,  7 , "rsp"      , 0 } ,
@@ -74,12 +87,9 @@ inline auto init_registers() {
     }};
 }
 
-inline std::uint64_t get_register_value( pid_t const pid, Register const r ) {
+inline std::uint64_t get_register_value( user_regs_struct const & regs, Register const r ) {
     using enum Register;
 
-    user_regs_struct regs;
-    ptrace( PTRACE_GETREGS, pid, nullptr, &regs );
-
     switch( r ) {
         case r15      : return regs.r15;
         case r14      : return regs.r14;
@@ -109,14 +119,12 @@ inline std::uint64_t get_register_value( pid_t const pid, Register const r ) {
         case fs       : return regs.fs;
         case gs       : return regs.gs;
     }
+    return {};
 }
 
-inline void set_register_value( pid_t const pid, Register const r, std::uint64_t const value ) {
+inline void set_register_value( user_regs_struct & regs, Register const r, std::uint64_t const value ) {
     using enum Register;
 
-    user_regs_struct regs;
-    ptrace( PTRACE_GETREGS, pid, nullptr, &regs );
-
     switch( r ) {
         case r15      : regs.r15      = value; break;
         case r14      : regs.r14      = value; break;
@@ -146,12 +154,67 @@ inline void set_register_value( pid_t const pid, Register const r, std::uint64_t
         case fs       : regs.fs       = value; break;
         case gs       : regs.gs       = value; break;
     }
+}
+
+inline std::uint64_t get_register_value( pid_t const pid, Register const r ) {
+    user_regs_struct regs;
+    instrumented::ptrace( PTRACE_GETREGS, pid, nullptr, &regs );
+
+    return get_register_value( regs, r );
+}
+
+inline void set_register_value( pid_t const pid, Register const r, std::uint64_t const value ) {
+    user_regs_struct regs;
+    instrumented::ptrace( PTRACE_GETREGS, pid, nullptr, &regs );
 
-    ptrace( PTRACE_SETREGS, pid, nullptr, &regs );
+    set_register_value( regs, r, value );
+
+    instrumented::ptrace( PTRACE_SETREGS, pid, nullptr, &regs );
 }
 
-/*
-// Register - DRAWF register number
+// Snapshot of the tracee's registers for a single stop.
+// Fetched once with PTRACE_GETREGS when the tracee stops, and written
+// back with a single PTRACE_SETREGS before it is resumed, if modified.
+struct RegisterFile {
+    void fetch( pid_t const pid ) {
+        instrumented::ptrace( PTRACE_GETREGS, pid, nullptr, &regs );
+        valid = true;
+        dirty = false;
+    }
+
+    // writes pending changes back, the snapshot stays usable
+    void write_back( pid_t const pid ) {
+        if ( dirty ) {
+            instrumented::ptrace( PTRACE_SETREGS, pid, nullptr, &regs );
+        }
+        dirty = false;
+    }
+
+    void flush( pid_t const pid ) {
+        write_back( pid );
+        // the tracee is about to run, the snapshot will be stale
+        valid = false;
+    }
+
+    std::uint64_t get( Register const r ) const { return get_register_value( regs, r ); }
+
+    void set( Register const r, std::uint64_t const value ) {
+        set_register_value( regs, r, value );
+        dirty = true;
+    }
+
+    bool is_valid() const { return valid; }
+    bool is_dirty() const { return dirty; }
+
+    user_regs_struct const & raw() const { return regs; }
+
+private:
+    user_regs_struct regs{};
+    bool valid{};
+    bool dirty{};
+};
+
+// Register - DWARF register number
 // taken from DWARF x86_64 ABI - https://www.uclibc.org/docs/psABI-x86_64.pdf
 //  rax      -  0
 //  rdx      -  1
@@ -169,6 +232,7 @@ inline void set_register_value( pid_t const pid, Register const r, std::uint64_t
 //  r13      - 13
 //  r14      - 14
 //  r15      - 15
+//  rip      - 16 (the return address column of the CFI)
 //  eflags   - 49
 //  es       - 50
 //  cs       - 51
@@ -179,70 +243,81 @@ inline void set_register_value( pid_t const pid, Register const r, std::uint64_t
 //  fs_base  - 58
 //  gs_base  - 59
 //  orig_rax - -1
-//  rip      - -1
 //
-inline std::uint64_t get_register_value_from_dwarf_register( pid_t pid, unsigned int regnum ) {
+inline std::uint64_t get_register_value_from_dwarf_register( user_regs_struct const & regs, unsigned int const regnum ) {
     using enum Register;
     switch ( regnum ) {
-        case  0: return get_register_value( pid, rax );
-        case  1: return get_register_value( pid, rdx ); 
-        case  2: return get_register_value( pid, rcx );
-        case  3: return get_register_value( pid, rbx );
-        case  4: return get_register_value( pid, rsi );
-        case  5: return get_register_value( pid, rdi );
-        case  6: return get_register_value( pid, rbp );
-        case  7: return get_register_value( pid, rsp );
-        case  8: return get_register_value( pid, r8 );
-        case  9: return get_register_value( pid, r9 );
-        case 10: return get_register_value( pid, r10 );
-        case 11: return get_register_value( pid, r11 );
-        case 12: return get_register_value( pid, r12 );
-        case 13: return get_register_value( pid, r13 );
-        case 14: return get_register_value( pid, r14 );
-        case 15: return get_register_value( pid, r15 );
-        case 49: return get_register_value( pid, eflags );
-        case 50: return get_register_value( pid, es );
-        case 51: return get_register_value( pid, cs );
-        case 52: return get_register_value( pid, ss );
-        case 53: return get_register_value( pid, ds );
-        case 54: return get_register_value( pid, fs );
-        case 55: return get_register_value( pid, gs );
-        case 58: return get_register_value( pid, fs_base );
-        case 59: return get_register_value( pid, gs_base );
+        case  0: return get_register_value( regs, rax );
+        case  1: return get_register_value( regs, rdx );
+        case  2: return get_register_value( regs, rcx );
+        case  3: return get_register_value( regs, rbx );
+        case  4: return get_register_value( regs, rsi );
+        case  5: return get_register_value( regs, rdi );
+        case  6: return get_register_value( regs, rbp );
+        case  7: return get_register_value( regs, rsp );
+        case  8: return get_register_value( regs, r8 );
+        case  9: return get_register_value( regs, r9 );
+        case 10: return get_register_value( regs, r10 );
+        case 11: return get_register_value( regs, r11 );
+        case 12: return get_register_value( regs, r12 );
+        case 13: return get_register_value( regs, r13 );
+        case 14: return get_register_value( regs, r14 );
+        case 15: return get_register_value( regs, r15 );
+        case 16: return get_register_value( regs, rip );
+        case 49: return get_register_value( regs, eflags );
+        case 50: return get_register_value( regs, es );
+        case 51: return get_register_value( regs, cs );
+        case 52: return get_register_value( regs, ss );
+        case 53: return get_register_value( regs, ds );
+        case 54: return get_register_value( regs, fs );
+        case 55: return get_register_value( regs, gs );
+        case 58: return get_register_value( regs, fs_base );
+        case 59: return get_register_value( regs, gs_base );
     }
     return {};
 }
-*/
 
-inline Register get_register_from_name( std::string const & name ) {
+inline std::uint64_t get_register_value_from_dwarf_register( pid_t const pid, unsigned int const regnum ) {
+    user_regs_struct regs;
+    instrumented::ptrace( PTRACE_GETREGS, pid, nullptr, &regs );
+
+    return get_register_value_from_dwarf_register( regs, regnum );
+}
+
+// every name the user can give a register by, looked up with a perfect hash
+inline constexpr PerfectHash< Register, 27 > register_names{ [] {
     using enum Register;
-    if ( name == "rax"      ) return rax;
-    if ( name == "rdx"      ) return rdx;
-    if ( name == "rcx"      ) return rcx;
-    if ( name == "rbx"      ) return rbx;
-    if ( name == "rsi"      ) return rsi;
-    if ( name == "rdi"      ) return rdi;
-    if ( name == "rbp"      ) return rbp;
-    if ( name == "rsp"      ) return rsp;
-    if ( name == "r8 "      ) return r8;
-    if ( name == "r9 "      ) return r9;
-    if ( name == "r10"      ) return r10;
-    if ( name == "r11"      ) return r11;
-    if ( name == "r12"      ) return r12;
-    if ( name == "r13"      ) return r13;
-    if ( name == "r14"      ) return r14;
-    if ( name == "r15"      ) return r15;
-    if ( name == "eflags"   ) return eflags;
-    if ( name == "es"       ) return es;
-    if ( name == "cs"       ) return cs;
-    if ( name == "ss"       ) return ss;
-    if ( name == "ds"       ) return ds;
-    if ( name == "fs"       ) return fs;
-    if ( name == "gs"       ) return gs;
-    if ( name == "fs_base"  ) return fs_base;
-    if ( name == "gs_base"  ) return gs_base;
-    if ( name == "orig_rax" ) return orig_rax;
-    if ( name == "rip"      ) return rip;
-
-    return rip;
+    return std::array< PerfectHash< Register, 27 >::Entry, 27 >{{
+        { "rax"      , rax      } ,
+        { "rdx"      , rdx      } ,
+        { "rcx"      , rcx      } ,
+        { "rbx"      , rbx      } ,
+        { "rsi"      , rsi      } ,
+        { "rdi"      , rdi      } ,
+        { "rbp"      , rbp      } ,
+        { "rsp"      , rsp      } ,
+        { "r8"       , r8       } ,
+        { "r9"       , r9       } ,
+        { "r10"      , r10      } ,
+        { "r11"      , r11      } ,
+        { "r12"      , r12      } ,
+        { "r13"      , r13      } ,
+        { "r14"      , r14      } ,
+        { "r15"      , r15      } ,
+        { "eflags"   , eflags   } ,
+        { "es"       , es       } ,
+        { "cs"       , cs       } ,
+        { "ss"       , ss       } ,
+        { "ds"       , ds       } ,
+        { "fs"       , fs       } ,
+        { "gs"       , gs       } ,
+        { "fs_base"  , fs_base  } ,
+        { "gs_base"  , gs_base  } ,
+        { "orig_rax" , orig_rax } ,
+        { "rip"      , rip      } ,
+    }};
+}() };
+
+inline std::optional< Register > get_register_from_name( std::string_view const name ) {
+    return register_names.find( name );
 }
@@ -0,0 +1,276 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#if defined( __x86_64__ )
+#include <immintrin.h>
+#endif
+
+// Bytes to look for, each with a mask of the bits that have to match: 0xff for
+// an exact byte, 0x00 for any byte, 0xf0 or 0x0f for a byte of which one hex digit is given
+struct BytePattern {
+    std::vector< std::byte > bytes{};
+    std::vector< std::byte > mask{};
+
+    std::size_t size() const { return bytes.size(); }
+    bool empty() const { return bytes.empty(); }
+
+    void push( std::byte const b, std::byte const m = std::byte{ 0xff } ) {
+        bytes.push_back( b & m );
+        mask.push_back( m );
+    }
+
+    bool matches( std::byte const * const at ) const {
+        for ( std::size_t i{}; i < bytes.size(); ++i ) {
+            if ( ( at[ i ] & mask[ i ] ) != bytes[ i ] ) return false;
+        }
+        return true;
+    }
+
+    // the first and the last byte that have to match exactly, what the vector kernels look for
+    std::optional< std::pair< std::size_t, std::size_t > > anchors() const {
+        std::optional< std::size_t > first{};
+        std::size_t last{};
+        for ( std::size_t i{}; i < mask.size(); ++i ) {
+            if ( mask[ i ] != std::byte{ 0xff } ) continue;
+            if ( !first ) first = i;
+            last = i;
+        }
+        if ( !first ) return std::nullopt;
+        return std::pair{ *first, last };
+    }
+};
+
+namespace search_detail {
+    inline std::optional< std::uint64_t > parse_integer( std::string_view s ) {
+        auto const negative{ s.starts_with( '-' ) };
+        if ( negative ) s.remove_prefix( 1 );
+        auto base{ 10 };
+        if ( s.starts_with( "0x" ) || s.starts_with( "0X" ) ) {
+            base = 16;
+            s.remove_prefix( 2 );
+        }
+        std::uint64_t value{};
+        auto const [ ptr, ec ]{ std::from_chars( s.data(), s.data() + s.size(), value, base ) };
+        if ( ec != std::errc{} || ptr != s.data() + s.size() || s.empty() ) return std::nullopt;
+        return negative ? ~value + 1 : value;
+    }
+
+    inline std::optional< unsigned > hex_digit( char const c ) {
+        if ( c >= '0' && c <= '9' ) return static_cast< unsigned >( c - '0' );
+        if ( c >= 'a' && c <= 'f' ) return static_cast< unsigned >( c - 'a' + 10 );
+        if ( c >= 'A' && c <= 'F' ) return static_cast< unsigned >( c - 'A' + 10 );
+        return std::nullopt;
+    }
+}
+
+// Parses the pattern at the start of `text` and returns it with what follows it:
+//
+//   "text"                  the bytes of a string, with \n \t \0 \\ \" and \xHH escapes
+//   u8: u16: u32: u64:N     an integer of that width, little endian; N may be negative
+//   ...:N/M                 the same, only the bits set in M have to match
+//   N                       an integer, 32 bits wide if it fits and 64 otherwise
+//   bytes:de??be?f          hex bytes, ? for any hex digit
+//
+// nothing, with `error` set, if it is none of these
+inline std::optional< BytePattern > parse_pattern( std::string_view text, std::string_view & rest, std::string & error ) {
+    using search_detail::hex_digit;
+    using search_detail::parse_integer;
+
+    while ( text.starts_with( ' ' ) || text.starts_with( '\t' ) ) text.remove_prefix( 1 );
+    BytePattern pattern{};
+
+    if ( text.starts_with( '"' ) ) {
+        std::size_t i{ 1 };
+        for ( ; i < text.size() && text[ i ] != '"'; ++i ) {
+            if ( text[ i ] != '\\' ) {
+                pattern.push( static_cast< std::byte >( text[ i ] ) );
+                continue;
+            }
+            if ( ++i == text.size() ) break;
+            switch ( text[ i ] ) {
+                case 'n': pattern.push( std::byte{ '\n' } ); break;
+                case 't': pattern.push( std::byte{ '\t' } ); break;
+                case '0': pattern.push( std::byte{ 0 } ); break;
+                case 'x': {
+                    auto const hi{ i + 1 < text.size() ? hex_digit( text[ i + 1 ] ) : std::nullopt };
+                    auto const lo{ i + 2 < text.size() ? hex_digit( text[ i + 2 ] ) : std::nullopt };
+                    if ( !hi || !lo ) {
+                        error = "\\x needs two hex digits";
+                        return std::nullopt;
+                    }
+                    pattern.push( static_cast< std::byte >( *hi << 4 | *lo ) );
+                    i += 2;
+                    break;
+                }
+                default: pattern.push( static_cast< std::byte >( text[ i ] ) ); break;
+            }
+        }
+        if ( i >= text.size() ) {
+            error = "unterminated string";
+            return std::nullopt;
+        }
+        rest = text.substr( i + 1 );
+    } else {
+        auto const end{ std::min( text.find_first_of( " \t" ), text.size() ) };
+        auto word{ text.substr( 0, end ) };
+        rest = text.substr( end );
+
+        if ( word.starts_with( "bytes:" ) ) {
+            word.remove_prefix( 6 );
+            if ( word.size() % 2 != 0 ) {
+                error = "bytes need two hex digits each";
+                return std::nullopt;
+            }
+            for ( std::size_t i{}; i < word.size(); i += 2 ) {
+                unsigned value{};
+                unsigned mask{};
+                for ( auto const c : word.substr( i, 2 ) ) {
+                    auto const digit{ hex_digit( c ) };
+                    if ( !digit && c != '?' ) {
+                        error = "not a hex digit or ?: '" + std::string{ 1, c } + "'";
+                        return std::nullopt;
+                    }
+                    value = value << 4 | digit.value_or( 0 );
+                    mask = mask << 4 | ( digit ? 0xf : 0 );
+                }
+                pattern.push( static_cast< std::byte >( value ), static_cast< std::byte >( mask ) );
+            }
+        } else {
+            std::size_t width{};
+            for ( auto const & [ prefix, bytes ] : { std::pair{ "u8:", 1 }, { "u16:", 2 }, { "u32:", 4 }, { "u64:", 8 } } ) {
+                if ( word.starts_with( prefix ) ) {
+                    width = static_cast< std::size_t >( bytes );
+                    word.remove_prefix( std::string_view{ prefix }.size() );
+                }
+            }
+            auto const slash{ word.find( '/' ) };
+            auto const value{ parse_integer( word.substr( 0, slash ) ) };
+            auto const mask{ slash == std::string_view::npos ? std::optional< std::uint64_t >{ ~std::uint64_t{} } : parse_integer( word.substr( slash + 1 ) ) };
+            if ( !value || !mask ) {
+                error = "not a string, an integer or bytes: '" + std::string{ word } + "'";
+                return std::nullopt;
+            }
+            if ( width == 0 ) width = *value <= 0xffffffff || ~*value < 0x80000000 ? 4 : 8;
+            if ( width < 8 && ( *value >> ( width * 8 ) ) != 0 && ( ~*value >> ( width * 8 - 1 ) ) != 0 ) {
+                error = "does not fit in " + std::to_string( width * 8 ) + " bits";
+                return std::nullopt;
+            }
+            for ( std::size_t i{}; i < width; ++i ) {
+                pattern.push( static_cast< std::byte >( *value >> ( i * 8 ) ), static_cast< std::byte >( *mask >> ( i * 8 ) ) );
+            }
+        }
+    }
+
+    if ( pattern.empty() ) {
+        error = "empty pattern";
+        return std::nullopt;
+    }
+    return pattern;
+}
+
+// How a block of memory is scanned: candidates are the positions where both anchor bytes
+// are right, found 32 or 16 at a time with AVX2 or SSE2 compares, and only those are checked
+// against the whole pattern. A pattern without an exact byte has no anchors and is checked
+// at every position.
+enum class SearchKernel : std::uint8_t {
+    scalar,
+    sse2,
+    avx2,
+};
+
+inline std::string_view describe( SearchKernel const kernel ) {
+    switch ( kernel ) {
+        case SearchKernel::avx2: return "avx2";
+        case SearchKernel::sse2: return "sse2";
+        default:                 return "scalar";
+    }
+}
+
+namespace search_detail {
+    // positions [from, count) of `data` at which the pattern starts
+    inline void find_scalar( std::byte const * const data, std::size_t const from, std::size_t const count,
+                             BytePattern const & pattern, std::vector< std::size_t > & out ) {
+        for ( auto i{ from }; i < count; ++i ) {
+            if ( pattern.matches( data + i ) ) out.push_back( i );
+        }
+    }
+
+#if defined( __x86_64__ )
+    __attribute__(( target( "sse2" ) ))
+    inline void find_sse2( std::byte const * const data, std::size_t const count, BytePattern const & pattern,
+                           std::size_t const first, std::size_t const last, std::vector< std::size_t > & out ) {
+        auto const a{ _mm_set1_epi8( static_cast< char >( pattern.bytes[ first ] ) ) };
+        auto const b{ _mm_set1_epi8( static_cast< char >( pattern.bytes[ last ] ) ) };
+        std::size_t i{};
+        for ( ; i + 16 <= count; i += 16 ) {
+            auto const x{ _mm_loadu_si128( reinterpret_cast< __m128i const * >( data + i + first ) ) };
+            auto const y{ _mm_loadu_si128( reinterpret_cast< __m128i const * >( data + i + last ) ) };
+            auto bits{ static_cast< std::uint32_t >( _mm_movemask_epi8( _mm_and_si128( _mm_cmpeq_epi8( x, a ), _mm_cmpeq_epi8( y, b ) ) ) ) };
+            for ( ; bits; bits &= bits - 1 ) {
+                auto const at{ i + static_cast< std::size_t >( std::countr_zero( bits ) ) };
+                if ( pattern.matches( data + at ) ) out.push_back( at );
+            }
+        }
+        find_scalar( data, i, count, pattern, out );
+    }
+
+    __attribute__(( target( "avx2" ) ))
+    inline void find_avx2( std::byte const * const data, std::size_t const count, BytePattern const & pattern,
+                           std::size_t const first, std::size_t const last, std::vector< std::size_t > & out ) {
+        auto const a{ _mm256_set1_epi8( static_cast< char >( pattern.bytes[ first ] ) ) };
+        auto const b{ _mm256_set1_epi8( static_cast< char >( pattern.bytes[ last ] ) ) };
+        std::size_t i{};
+        for ( ; i + 32 <= count; i += 32 ) {
+            auto const x{ _mm256_loadu_si256( reinterpret_cast< __m256i const * >( data + i + first ) ) };
+            auto const y{ _mm256_loadu_si256( reinterpret_cast< __m256i const * >( data + i + last ) ) };
+            auto bits{ static_cast< std::uint32_t >( _mm256_movemask_epi8( _mm256_and_si256( _mm256_cmpeq_epi8( x, a ), _mm256_cmpeq_epi8( y, b ) ) ) ) };
+            for ( ; bits; bits &= bits - 1 ) {
+                auto const at{ i + static_cast< std::size_t >( std::countr_zero( bits ) ) };
+                if ( pattern.matches( data + at ) ) out.push_back( at );
+            }
+        }
+        find_scalar( data, i, count, pattern, out );
+    }
+#endif
+}
+
+// the best kernel this CPU has for the pattern
+inline SearchKernel select_kernel( BytePattern const & pattern ) {
+    if ( !pattern.anchors() ) return SearchKernel::scalar;
+#if defined( __x86_64__ )
+    static auto const has_avx2{ __builtin_cpu_supports( "avx2" ) != 0 };
+    return has_avx2 ? SearchKernel::avx2 : SearchKernel::sse2;
+#else
+    return SearchKernel::scalar;
+#endif
+}
+
+// appends the offsets in `data` at which the pattern starts, it has to end inside `data`
+inline void find_pattern( [[maybe_unused]] SearchKernel const kernel, std::span< std::byte const > const data, BytePattern const & pattern, std::vector< std::size_t > & out ) {
+    if ( data.size() < pattern.size() ) return;
+    auto const count{ data.size() - pattern.size() + 1 };
+#if defined( __x86_64__ )
+    // a pattern without an exact byte has nothing for the vector kernels to compare
+    if ( auto const anchors{ pattern.anchors() }; anchors && kernel != SearchKernel::scalar ) {
+        auto const [ first, last ]{ *anchors };
+        if ( kernel == SearchKernel::avx2 ) {
+            search_detail::find_avx2( data.data(), count, pattern, first, last, out );
+        } else {
+            search_detail::find_sse2( data.data(), count, pattern, first, last, out );
+        }
+        return;
+    }
+#endif
+    search_detail::find_scalar( data.data(), 0, count, pattern, out );
+}
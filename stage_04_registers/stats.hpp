@@ -0,0 +1,359 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/ptrace.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+// What the debugger asks of the kernel, one entry per kind of call, in the order they are reported
+enum class Operation : std::uint8_t {
+    peekdata,
+    pokedata,
+    peekuser,
+    pokeuser,
+    getregs,
+    setregs,
+    cont,
+    syscall,
+    singlestep,
+    interrupt,
+    seize,
+    setoptions,
+    geteventmsg,
+    getsiginfo,
+    other_ptrace,
+    process_vm_readv,
+    mem_read,         // pread of /proc/<pid>/mem
+    mem_write,        // pwrite of /proc/<pid>/mem
+    waitpid_nohang,
+    waitpid,          // blocked until a thread changes state
+    epoll_wait,       // blocked until the tracee stops, a timer fires or a command comes in
+    count,
+};
+
+inline constexpr std::size_t operation_count{ static_cast< std::size_t >( Operation::count ) };
+
+inline constexpr std::array< std::string_view, operation_count > operation_names{
+    "PTRACE_PEEKDATA",
+    "PTRACE_POKEDATA",
+    "PTRACE_PEEKUSER",
+    "PTRACE_POKEUSER",
+    "PTRACE_GETREGS",
+    "PTRACE_SETREGS",
+    "PTRACE_CONT",
+    "PTRACE_SYSCALL",
+    "PTRACE_SINGLESTEP",
+    "PTRACE_INTERRUPT",
+    "PTRACE_SEIZE",
+    "PTRACE_SETOPTIONS",
+    "PTRACE_GETEVENTMSG",
+    "PTRACE_GETSIGINFO",
+    "ptrace (other)",
+    "process_vm_readv",
+    "pread mem",
+    "pwrite mem",
+    "waitpid WNOHANG",
+    "waitpid",
+    "epoll_wait",
+};
+
+// the time spent in these is the tracee's (or the user's), not ours
+inline constexpr bool is_blocking( Operation const op ) {
+    return op == Operation::waitpid || op == Operation::epoll_wait;
+}
+
+inline constexpr Operation operation_of( __ptrace_request const request ) {
+    switch ( request ) {
+        case PTRACE_PEEKDATA:    return Operation::peekdata;
+        case PTRACE_POKEDATA:    return Operation::pokedata;
+        case PTRACE_PEEKUSER:    return Operation::peekuser;
+        case PTRACE_POKEUSER:    return Operation::pokeuser;
+        case PTRACE_GETREGS:     return Operation::getregs;
+        case PTRACE_SETREGS:     return Operation::setregs;
+        case PTRACE_CONT:        return Operation::cont;
+        case PTRACE_SYSCALL:     return Operation::syscall;
+        case PTRACE_SINGLESTEP:  return Operation::singlestep;
+        case PTRACE_INTERRUPT:   return Operation::interrupt;
+        case PTRACE_SEIZE:       return Operation::seize;
+        case PTRACE_SETOPTIONS:  return Operation::setoptions;
+        case PTRACE_GETEVENTMSG: return Operation::geteventmsg;
+        case PTRACE_GETSIGINFO:  return Operation::getsiginfo;
+        default:                 return Operation::other_ptrace;
+    }
+}
+
+// Log-linear buckets, the layout of an HdrHistogram: values below 16 get a bucket each,
+// every power of two above that is split into 16, so any value is known to within 1/16th
+// from 1 ns to centuries, in under a thousand buckets
+namespace latency {
+    inline constexpr unsigned sub_bits{ 4 };
+    inline constexpr std::size_t sub_count{ std::size_t{ 1 } << sub_bits };
+    inline constexpr std::size_t bucket_count{ ( 64 - sub_bits + 1 ) * sub_count };
+
+    inline constexpr std::size_t bucket_of( std::uint64_t const ns ) {
+        if ( ns < sub_count ) return static_cast< std::size_t >( ns );
+        auto const shift{ static_cast< unsigned >( std::bit_width( ns ) ) - 1 - sub_bits };
+        return ( shift + 1 ) * sub_count + static_cast< std::size_t >( ( ns >> shift ) & ( sub_count - 1 ) );
+    }
+
+    // the highest value that lands in the bucket
+    inline constexpr std::uint64_t highest_in( std::size_t const bucket ) {
+        if ( bucket < sub_count ) return bucket;
+        auto const shift{ bucket / sub_count - 1 };
+        auto const lowest{ ( sub_count + bucket % sub_count ) << shift };
+        return lowest + ( std::uint64_t{ 1 } << shift ) - 1;
+    }
+
+    static_assert( bucket_of( ~std::uint64_t{} ) == bucket_count - 1 );
+    static_assert( highest_in( bucket_of( 1000 ) ) >= 1000 && highest_in( bucket_of( 1000 ) - 1 ) < 1000 );
+}
+
+// The calls of one kind, summed over every thread of the debugger
+struct OperationTotals {
+    std::uint64_t calls{};
+    std::uint64_t errors{};
+    std::uint64_t total_ns{};
+    int last_error{};
+    std::vector< std::uint64_t > buckets = std::vector< std::uint64_t >( latency::bucket_count );
+
+    // the latency `fraction` of the calls stayed under, to within a bucket
+    std::uint64_t percentile( double const fraction ) const {
+        auto const wanted{ static_cast< std::uint64_t >( fraction * static_cast< double >( calls ) + 0.5 ) };
+        std::uint64_t seen{};
+        for ( std::size_t i{}; i < buckets.size(); ++i ) {
+            seen += buckets[ i ];
+            if ( seen > 0 && seen >= wanted ) return latency::highest_in( i );
+        }
+        return 0;
+    }
+
+    std::uint64_t max() const {
+        for ( auto i{ buckets.size() }; i > 0; --i ) {
+            if ( buckets[ i - 1 ] ) return latency::highest_in( i - 1 );
+        }
+        return 0;
+    }
+};
+
+struct StatsSnapshot {
+    std::uint64_t elapsed_ns{};
+    std::array< OperationTotals, operation_count > operations{};
+};
+
+namespace stats_detail {
+    inline std::uint64_t now() {
+        timespec ts{};
+        clock_gettime( CLOCK_MONOTONIC, &ts );
+        return static_cast< std::uint64_t >( ts.tv_sec ) * 1'000'000'000 + static_cast< std::uint64_t >( ts.tv_nsec );
+    }
+
+    // Written by its own thread only, with plain loads and stores, and read by whoever
+    // collects them; relaxed atomics so that reading is not a data race, no locked instructions
+    struct Counter {
+        void add( std::uint64_t const n ) { value.store( value.load( std::memory_order_relaxed ) + n, std::memory_order_relaxed ); }
+        std::uint64_t get() const { return value.load( std::memory_order_relaxed ); }
+
+    private:
+        std::atomic< std::uint64_t > value{};
+    };
+
+    struct OperationCounters {
+        Counter calls{};
+        Counter errors{};
+        Counter total_ns{};
+        std::atomic< int > last_error{};
+        std::array< Counter, latency::bucket_count > buckets{};
+    };
+
+    using ThreadCounters = std::array< OperationCounters, operation_count >;
+
+    // the counters of every thread that ever made a call, kept once the thread is gone;
+    // `baseline` is what they were at the last reset
+    struct Registry {
+        std::mutex mutex{};
+        std::vector< std::unique_ptr< ThreadCounters > > threads{};
+        StatsSnapshot baseline{};
+        std::uint64_t started{ now() };
+    };
+
+    inline Registry & registry() {
+        static Registry r{};
+        return r;
+    }
+
+    inline ThreadCounters & counters() {
+        thread_local ThreadCounters * const mine{ [] {
+            auto & r{ registry() };
+            std::lock_guard const lock{ r.mutex };
+            return r.threads.emplace_back( std::make_unique< ThreadCounters >() ).get();
+        }() };
+        return *mine;
+    }
+
+    inline void record( Operation const op, std::uint64_t const start, int const error ) {
+        auto const ns{ now() - start };
+        auto & c{ counters()[ static_cast< std::size_t >( op ) ] };
+        c.calls.add( 1 );
+        c.total_ns.add( ns );
+        c.buckets[ latency::bucket_of( ns ) ].add( 1 );
+        if ( error ) {
+            c.errors.add( 1 );
+            c.last_error.store( error, std::memory_order_relaxed );
+        }
+    }
+
+    // everything counted since the program started
+    inline StatsSnapshot collect_all( Registry & r ) {
+        StatsSnapshot out{};
+        out.elapsed_ns = now() - r.started;
+        for ( auto const & thread : r.threads ) {
+            for ( std::size_t op{}; op < operation_count; ++op ) {
+                auto const & from{ ( *thread )[ op ] };
+                auto & to{ out.operations[ op ] };
+                to.calls += from.calls.get();
+                to.errors += from.errors.get();
+                to.total_ns += from.total_ns.get();
+                if ( auto const e{ from.last_error.load( std::memory_order_relaxed ) }; e ) to.last_error = e;
+                for ( std::size_t i{}; i < latency::bucket_count; ++i ) to.buckets[ i ] += from.buckets[ i ].get();
+            }
+        }
+        return out;
+    }
+}
+
+#ifdef DEBUGGER_STATS
+inline constexpr bool stats_enabled{ true };
+#else
+inline constexpr bool stats_enabled{ false };
+#endif
+
+// what was counted since the last reset_stats(), or since the start
+inline StatsSnapshot collect_stats() {
+    auto & r{ stats_detail::registry() };
+    std::lock_guard const lock{ r.mutex };
+    auto out{ stats_detail::collect_all( r ) };
+    out.elapsed_ns -= r.baseline.elapsed_ns;
+    for ( std::size_t op{}; op < operation_count; ++op ) {
+        auto & to{ out.operations[ op ] };
+        auto const & before{ r.baseline.operations[ op ] };
+        to.calls -= before.calls;
+        to.errors -= before.errors;
+        to.total_ns -= before.total_ns;
+        if ( to.errors == 0 ) to.last_error = 0;
+        for ( std::size_t i{}; i < latency::bucket_count; ++i ) to.buckets[ i ] -= before.buckets[ i ];
+    }
+    return out;
+}
+
+// the counters are never written by anyone but their thread, a reset only moves the baseline
+inline void reset_stats() {
+    auto & r{ stats_detail::registry() };
+    std::lock_guard const lock{ r.mutex };
+    r.baseline = stats_detail::collect_all( r );
+}
+
+// The system calls the debugger makes about its tracee, under their own names. Built with
+// DEBUGGER_STATS each one is timed and counted, failures too, with its errno; without it
+// they are the plain calls and nothing is left of the counting.
+namespace instrumented {
+#ifdef DEBUGGER_STATS
+    template< typename... Args >
+    inline long ptrace( __ptrace_request const request, pid_t const pid, Args const... args ) {
+        auto const start{ stats_detail::now() };
+        // PTRACE_PEEK* return any value, only errno tells a failure
+        errno = 0;
+        auto const result{ ::ptrace( request, pid, args... ) };
+        auto const error{ errno };
+        stats_detail::record( operation_of( request ), start, result == -1 ? error : 0 );
+        errno = error;
+        return result;
+    }
+
+    inline pid_t waitpid( pid_t const pid, int * const status, int const options ) {
+        auto const start{ stats_detail::now() };
+        auto const result{ ::waitpid( pid, status, options ) };
+        auto const error{ errno };
+        stats_detail::record( options & WNOHANG ? Operation::waitpid_nohang : Operation::waitpid, start, result < 0 ? error : 0 );
+        errno = error;
+        return result;
+    }
+
+    inline int epoll_wait( int const epoll_fd, epoll_event * const events, int const max_events, int const timeout_ms ) {
+        auto const start{ stats_detail::now() };
+        auto const result{ ::epoll_wait( epoll_fd, events, max_events, timeout_ms ) };
+        auto const error{ errno };
+        stats_detail::record( Operation::epoll_wait, start, result < 0 ? error : 0 );
+        errno = error;
+        return result;
+    }
+
+    inline ssize_t process_vm_readv( pid_t const pid, iovec const * const local, unsigned long const local_count,
+                                     iovec const * const remote, unsigned long const remote_count, unsigned long const flags ) {
+        auto const start{ stats_detail::now() };
+        auto const result{ ::process_vm_readv( pid, local, local_count, remote, remote_count, flags ) };
+        auto const error{ errno };
+        stats_detail::record( Operation::process_vm_readv, start, result < 0 ? error : 0 );
+        errno = error;
+        return result;
+    }
+
+    inline ssize_t pread( int const fd, void * const buffer, std::size_t const size, off_t const offset ) {
+        auto const start{ stats_detail::now() };
+        auto const result{ ::pread( fd, buffer, size, offset ) };
+        auto const error{ errno };
+        stats_detail::record( Operation::mem_read, start, result < 0 ? error : 0 );
+        errno = error;
+        return result;
+    }
+
+    inline ssize_t pwrite( int const fd, void const * const buffer, std::size_t const size, off_t const offset ) {
+        auto const start{ stats_detail::now() };
+        auto const result{ ::pwrite( fd, buffer, size, offset ) };
+        auto const error{ errno };
+        stats_detail::record( Operation::mem_write, start, result < 0 ? error : 0 );
+        errno = error;
+        return result;
+    }
+#else
+    template< typename... Args >
+    inline long ptrace( __ptrace_request const request, pid_t const pid, Args const... args ) {
+        return ::ptrace( request, pid, args... );
+    }
+
+    inline pid_t waitpid( pid_t const pid, int * const status, int const options ) {
+        return ::waitpid( pid, status, options );
+    }
+
+    inline int epoll_wait( int const epoll_fd, epoll_event * const events, int const max_events, int const timeout_ms ) {
+        return ::epoll_wait( epoll_fd, events, max_events, timeout_ms );
+    }
+
+    inline ssize_t process_vm_readv( pid_t const pid, iovec const * const local, unsigned long const local_count,
+                                     iovec const * const remote, unsigned long const remote_count, unsigned long const flags ) {
+        return ::process_vm_readv( pid, local, local_count, remote, remote_count, flags );
+    }
+
+    inline ssize_t pread( int const fd, void * const buffer, std::size_t const size, off_t const offset ) {
+        return ::pread( fd, buffer, size, offset );
+    }
+
+    inline ssize_t pwrite( int const fd, void const * const buffer, std::size_t const size, off_t const offset ) {
+        return ::pwrite( fd, buffer, size, offset );
+    }
+#endif
+}
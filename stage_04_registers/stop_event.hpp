@@ -0,0 +1,83 @@
+#pragma once
+
+#include <csignal>
+#include <cstdint>
+
+#include <sys/ptrace.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+enum class StopReason : std::uint8_t {
+    none,
+    breakpoint,     // int3 of one of our breakpoints
+    hardware,       // debug register breakpoint or watchpoint
+    single_step,
+    signal,         // signal-delivery-stop, the signal is passed on when resuming
+    interrupted,    // stopped on request, nothing to pass on
+    exec,
+    clone,
+    syscall,        // seccomp-stop, about to make a system call a filter of ours traps
+    syscall_exit,   // syscall-exit-stop, after a system call followed with PTRACE_SYSCALL
+    exited,
+    killed,
+};
+
+struct StopEvent {
+    StopReason reason{ StopReason::none };
+    pid_t tid{};
+    int signal{};                 // stopping or terminating signal
+    int exit_code{};
+    unsigned long message{};      // PTRACE_GETEVENTMSG, e.g. the new thread of a clone
+
+    bool is_stopped() const { return reason != StopReason::none && reason != StopReason::exited && reason != StopReason::killed; }
+    bool has_ended()  const { return reason == StopReason::exited || reason == StopReason::killed; }
+};
+
+// What a wait status says by itself. Plain SIGTRAPs come back as StopReason::signal,
+// only the debugger knows whether it was single-stepping or which breakpoints are armed.
+inline StopEvent decode_wait_status( pid_t const tid, int const status ) {
+    StopEvent event{};
+    event.tid = tid;
+
+    if ( WIFEXITED( status ) ) {
+        event.reason = StopReason::exited;
+        event.exit_code = WEXITSTATUS( status );
+    } else if ( WIFSIGNALED( status ) ) {
+        event.reason = StopReason::killed;
+        event.signal = WTERMSIG( status );
+    } else if ( WIFSTOPPED( status ) ) {
+        event.signal = WSTOPSIG( status );
+        event.reason = StopReason::signal;
+
+        // PTRACE_O_TRACESYSGOOD marks syscall-stops
+        if ( event.signal == ( SIGTRAP | 0x80 ) ) {
+            event.signal = SIGTRAP;
+            event.reason = StopReason::syscall_exit;
+        }
+        switch ( status >> 16 ) {
+            case PTRACE_EVENT_EXEC   : event.reason = StopReason::exec;        break;
+            case PTRACE_EVENT_CLONE  : event.reason = StopReason::clone;       break;
+            case PTRACE_EVENT_STOP   : event.reason = StopReason::interrupted; break;
+            case PTRACE_EVENT_SECCOMP: event.reason = StopReason::syscall;     break;
+        }
+    }
+    return event;
+}
+
+inline char const * describe( StopReason const reason ) {
+    switch ( reason ) {
+        case StopReason::none       : return "none";
+        case StopReason::breakpoint : return "breakpoint";
+        case StopReason::hardware   : return "hardware breakpoint";
+        case StopReason::single_step: return "single step";
+        case StopReason::signal     : return "signal";
+        case StopReason::interrupted: return "interrupted";
+        case StopReason::exec       : return "exec";
+        case StopReason::clone      : return "clone";
+        case StopReason::syscall    : return "syscall";
+        case StopReason::syscall_exit: return "syscall exit";
+        case StopReason::exited     : return "exited";
+        case StopReason::killed     : return "killed";
+    }
+    return "unknown";
+}
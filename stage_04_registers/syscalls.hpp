@@ -0,0 +1,167 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+
+#include <sys/syscall.h>
+#include <sys/user.h>
+
+// A system call by name, with how to show each of its arguments: 'd' an int,
+// 'l' a long, 'x' a hex value, 's' a string in the tracee's memory
+struct SyscallInfo {
+    long nr;
+    std::string_view name;
+    std::string_view args;
+};
+
+inline constexpr std::array< SyscallInfo, 104 > syscall_table{{
+    { SYS_read,            "read",            "dxl"    },
+    { SYS_write,           "write",           "dxl"    },
+    { SYS_open,            "open",            "sxx"    },
+    { SYS_close,           "close",           "d"      },
+    { SYS_stat,            "stat",            "sx"     },
+    { SYS_fstat,           "fstat",           "dx"     },
+    { SYS_lstat,           "lstat",           "sx"     },
+    { SYS_poll,            "poll",            "xdd"    },
+    { SYS_lseek,           "lseek",           "dld"    },
+    { SYS_mmap,            "mmap",            "xlxxdx" },
+    { SYS_mprotect,        "mprotect",        "xlx"    },
+    { SYS_munmap,          "munmap",          "xl"     },
+    { SYS_brk,             "brk",             "x"      },
+    { SYS_rt_sigaction,    "rt_sigaction",    "dxxd"   },
+    { SYS_rt_sigprocmask,  "rt_sigprocmask",  "dxxd"   },
+    { SYS_rt_sigreturn,    "rt_sigreturn",    ""       },
+    { SYS_ioctl,           "ioctl",           "dxx"    },
+    { SYS_pread64,         "pread64",         "dxll"   },
+    { SYS_pwrite64,        "pwrite64",        "dxll"   },
+    { SYS_readv,           "readv",           "dxd"    },
+    { SYS_writev,          "writev",          "dxd"    },
+    { SYS_access,          "access",          "sx"     },
+    { SYS_pipe,            "pipe",            "x"      },
+    { SYS_select,          "select",          "dxxxx"  },
+    { SYS_sched_yield,     "sched_yield",     ""       },
+    { SYS_mremap,          "mremap",          "xllxx"  },
+    { SYS_msync,           "msync",           "xlx"    },
+    { SYS_madvise,         "madvise",         "xld"    },
+    { SYS_dup,             "dup",             "d"      },
+    { SYS_dup2,            "dup2",            "dd"     },
+    { SYS_nanosleep,       "nanosleep",       "xx"     },
+    { SYS_getpid,          "getpid",          ""       },
+    { SYS_socket,          "socket",          "ddd"    },
+    { SYS_connect,         "connect",         "dxd"    },
+    { SYS_accept,          "accept",          "dxx"    },
+    { SYS_sendto,          "sendto",          "dxlxxd" },
+    { SYS_recvfrom,        "recvfrom",        "dxlxxx" },
+    { SYS_sendmsg,         "sendmsg",         "dxx"    },
+    { SYS_recvmsg,         "recvmsg",         "dxx"    },
+    { SYS_bind,            "bind",            "dxd"    },
+    { SYS_listen,          "listen",          "dd"     },
+    { SYS_clone,           "clone",           "xxxxx"  },
+    { SYS_fork,            "fork",            ""       },
+    { SYS_vfork,           "vfork",           ""       },
+    { SYS_execve,          "execve",          "sxx"    },
+    { SYS_exit,            "exit",            "d"      },
+    { SYS_wait4,           "wait4",           "dxxx"   },
+    { SYS_kill,            "kill",            "dd"     },
+    { SYS_uname,           "uname",           "x"      },
+    { SYS_fcntl,           "fcntl",           "ddx"    },
+    { SYS_flock,           "flock",           "dd"     },
+    { SYS_fsync,           "fsync",           "d"      },
+    { SYS_ftruncate,       "ftruncate",       "dl"     },
+    { SYS_getdents64,      "getdents64",      "dxl"    },
+    { SYS_getcwd,          "getcwd",          "xl"     },
+    { SYS_chdir,           "chdir",           "s"      },
+    { SYS_rename,          "rename",          "ss"     },
+    { SYS_mkdir,           "mkdir",           "sx"     },
+    { SYS_rmdir,           "rmdir",           "s"      },
+    { SYS_unlink,          "unlink",          "s"      },
+    { SYS_readlink,        "readlink",        "sxl"    },
+    { SYS_chmod,           "chmod",           "sx"     },
+    { SYS_umask,           "umask",           "x"      },
+    { SYS_getrlimit,       "getrlimit",       "dx"     },
+    { SYS_sysinfo,         "sysinfo",         "x"      },
+    { SYS_getuid,          "getuid",          ""       },
+    { SYS_getgid,          "getgid",          ""       },
+    { SYS_geteuid,         "geteuid",         ""       },
+    { SYS_getegid,         "getegid",         ""       },
+    { SYS_getppid,         "getppid",         ""       },
+    { SYS_setsid,          "setsid",          ""       },
+    { SYS_prctl,           "prctl",           "dxxxx"  },
+    { SYS_arch_prctl,      "arch_prctl",      "xx"     },
+    { SYS_gettid,          "gettid",          ""       },
+    { SYS_futex,           "futex",           "xdxxxx" },
+    { SYS_sched_getaffinity, "sched_getaffinity", "ddx" },
+    { SYS_set_tid_address, "set_tid_address", "x"      },
+    { SYS_clock_gettime,   "clock_gettime",   "dx"     },
+    { SYS_clock_nanosleep, "clock_nanosleep", "ddxx"   },
+    { SYS_exit_group,      "exit_group",      "d"      },
+    { SYS_epoll_wait,      "epoll_wait",      "dxdd"   },
+    { SYS_epoll_ctl,       "epoll_ctl",       "dddx"   },
+    { SYS_tgkill,          "tgkill",          "ddd"    },
+    { SYS_openat,          "openat",          "dsxx"   },
+    { SYS_mkdirat,         "mkdirat",         "dsx"    },
+    { SYS_newfstatat,      "newfstatat",      "dsxx"   },
+    { SYS_unlinkat,        "unlinkat",        "dsx"    },
+    { SYS_readlinkat,      "readlinkat",      "dsxl"   },
+    { SYS_faccessat,       "faccessat",       "dsx"    },
+    { SYS_set_robust_list, "set_robust_list", "xl"     },
+    { SYS_epoll_pwait,     "epoll_pwait",     "dxddxd" },
+    { SYS_eventfd2,        "eventfd2",        "dx"     },
+    { SYS_epoll_create1,   "epoll_create1",   "x"      },
+    { SYS_dup3,            "dup3",            "ddx"    },
+    { SYS_pipe2,           "pipe2",           "xx"     },
+    { SYS_prlimit64,       "prlimit64",       "ddxx"   },
+    { SYS_getrandom,       "getrandom",       "xlx"    },
+    { SYS_memfd_create,    "memfd_create",    "sx"     },
+    { SYS_seccomp,         "seccomp",         "dxx"    },
+    { SYS_execveat,        "execveat",        "dsxxx"  },
+    { SYS_statx,           "statx",           "dsxxx"  },
+    { SYS_rseq,            "rseq",            "xdxx"   },
+    { SYS_clone3,          "clone3",          "xl"     },
+    { SYS_close_range,     "close_range",     "ddx"    },
+}};
+
+// the arguments of a system call, in the order of the calling convention
+inline std::array< std::uint64_t, 6 > syscall_arguments( user_regs_struct const & regs ) {
+    return { regs.rdi, regs.rsi, regs.rdx, regs.r10, regs.r8, regs.r9 };
+}
+
+inline SyscallInfo const * find_syscall( std::string_view const name ) {
+    auto const it{ std::find_if( std::begin( syscall_table ), std::end( syscall_table ), [name]( auto const & s ) { return s.name == name; } ) };
+    return it != std::end( syscall_table ) ? &*it : nullptr;
+}
+
+inline SyscallInfo const * find_syscall( long const nr ) {
+    auto const it{ std::find_if( std::begin( syscall_table ), std::end( syscall_table ), [nr]( auto const & s ) { return s.nr == nr; } ) };
+    return it != std::end( syscall_table ) ? &*it : nullptr;
+}
+
+// A seccomp filter that has the kernel stop the tracee, with PTRACE_EVENT_SECCOMP, right before
+// any of `nrs` and lets everything else through without involving us. Filters can only ever be
+// added, each one for the system calls that are not trapped yet.
+//
+// At most 255 numbers, the jumps to the final return are 8 bits.
+inline std::vector< sock_filter > build_syscall_filter( std::span< long const > const nrs ) {
+    std::vector< sock_filter > filter{
+        BPF_STMT( BPF_LD | BPF_W | BPF_ABS, offsetof( seccomp_data, arch ) ),
+        BPF_JUMP( BPF_JMP | BPF_JEQ | BPF_K, AUDIT_ARCH_X86_64, 1, 0 ),
+        BPF_STMT( BPF_RET | BPF_K, SECCOMP_RET_ALLOW ),
+        BPF_STMT( BPF_LD | BPF_W | BPF_ABS, offsetof( seccomp_data, nr ) ),
+    };
+    for ( std::size_t i{}; i < nrs.size(); ++i ) {
+        filter.push_back( BPF_JUMP( BPF_JMP | BPF_JEQ | BPF_K, static_cast< std::uint32_t >( nrs[ i ] ), static_cast< std::uint8_t >( nrs.size() - i ), 0 ) );
+    }
+    filter.push_back( BPF_STMT( BPF_RET | BPF_K, SECCOMP_RET_ALLOW ) );
+    filter.push_back( BPF_STMT( BPF_RET | BPF_K, SECCOMP_RET_TRACE ) );
+    return filter;
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <csignal>
+#include <cstdint>
+#include <map>
+#include <utility>
+
+#include <unistd.h>
+
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+
+#include "registers.hpp"
+#include "stats.hpp"
+#include "stop_event.hpp"
+
+enum class ThreadState : std::uint8_t {
+    running,
+    stopped,
+    exited,
+};
+
+struct Thread {
+    pid_t tid{};
+    ThreadState state{ ThreadState::running };
+    StopEvent last_event{};
+    RegisterFile registers{};
+    std::uint64_t debug_status{};   // DR6 of the last stop
+    int pending_signal{};           // delivered to the thread when it resumes
+    bool stepping{};                // last resumed with PTRACE_SINGLESTEP
+    bool expect_stop{};             // a stop we asked for is on its way and must not be reported
+    bool unreported{};              // stopped for a reason the user has not been told about yet
+    bool is_new{};                  // created by the tracee, its first stop has not been seen
+    bool await_exit{};              // in a system call that is being recorded, followed to its exit
+
+    bool is_stopped() const { return state == ThreadState::stopped; }
+
+    // any pending register writes have to land before the thread runs again
+    void resume( __ptrace_request request ) {
+        if ( request == PTRACE_CONT && await_exit ) request = PTRACE_SYSCALL;
+        registers.flush( tid );
+        stepping = request == PTRACE_SINGLESTEP;
+        state = ThreadState::running;
+        instrumented::ptrace( request, tid, nullptr, static_cast< long >( std::exchange( pending_signal, 0 ) ) );
+    }
+
+    // PTRACE_INTERRUPT only works on tracees attached with PTRACE_SEIZE, the others get a SIGSTOP
+    void interrupt( pid_t const pid ) {
+        expect_stop = true;
+        if ( instrumented::ptrace( PTRACE_INTERRUPT, tid, nullptr, nullptr ) != 0 ) {
+            syscall( SYS_tgkill, pid, tid, SIGSTOP );
+        }
+    }
+};
+
+// Every thread of the tracee, by tid. The leader (tid == pid) is always there,
+// even once it has exited, so there is always a thread to select.
+struct ThreadTable {
+    explicit ThreadTable( pid_t const pid ) : pid{ pid } {
+        threads[ pid ].tid = pid;
+    }
+
+    Thread & leader() { return threads[ pid ]; }
+
+    Thread * find( pid_t const tid ) {
+        auto const it{ threads.find( tid ) };
+        return it != std::end( threads ) ? &it->second : nullptr;
+    }
+
+    // a thread the tracee has just created; it starts with a SIGSTOP
+    Thread & add( pid_t const tid ) {
+        auto const [ it, added ]{ threads.try_emplace( tid ) };
+        if ( added ) {
+            it->second.tid = tid;
+            it->second.is_new = true;
+            it->second.expect_stop = true;
+        }
+        return it->second;
+    }
+
+    void remove( pid_t const tid ) {
+        if ( tid != pid ) threads.erase( tid );
+    }
+
+    // after an exec only the leader is left
+    void retain_leader() {
+        std::erase_if( threads, [this]( auto const & entry ) { return entry.first != pid; } );
+    }
+
+    Thread * first_running() {
+        for ( auto & [ tid, thread ] : threads ) {
+            if ( thread.state == ThreadState::running ) return &thread;
+        }
+        return nullptr;
+    }
+
+    // batched: every running thread is sent its stop before the caller waits for the first one
+    void interrupt_all() {
+        for ( auto & [ tid, thread ] : threads ) {
+            if ( thread.state == ThreadState::running && !thread.expect_stop ) thread.interrupt( pid );
+        }
+    }
+
+    void resume_all( __ptrace_request const request ) {
+        for ( auto & [ tid, thread ] : threads ) {
+            if ( thread.is_stopped() ) thread.resume( request );
+        }
+    }
+
+    std::size_t size() const { return threads.size(); }
+
+    auto begin() { return std::begin( threads ); }
+    auto end()   { return std::end( threads ); }
+
+private:
+    pid_t pid{};
+    std::map< pid_t, Thread > threads{};
+};
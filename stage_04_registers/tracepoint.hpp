@@ -0,0 +1,275 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <optional>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#include "displaced.hpp"
+#include "registers.hpp"
+#include "x86.hpp"
+
+// A fast tracepoint: the instructions at `addr` are replaced with a jmp to a
+// trampoline that records the chosen registers into the trace ring, runs the
+// replaced instructions and jumps back. The tracee never stops for a hit.
+struct Tracepoint {
+    static constexpr std::size_t max_registers{ 6 };
+    static constexpr std::size_t jump_size{ 5 };
+    static constexpr std::intptr_t trampoline_size{ 256 };
+
+    std::uint32_t id{};
+    std::intptr_t addr{};
+    std::vector< Register > registers{};
+    std::vector< std::byte > original{};   // the instructions the jmp replaced
+    std::intptr_t trampoline{};
+    std::uint64_t hits{};                  // records drained so far
+
+    bool covers( std::intptr_t const a ) const { return a >= addr && a < addr + static_cast< std::intptr_t >( original.size() ); }
+    bool in_trampoline( std::intptr_t const pc ) const { return pc >= trampoline && pc < trampoline + trampoline_size; }
+};
+
+// The ring the trampolines write into: a memfd mapped into the tracee and into us.
+//
+// Writers, any tracee thread, reserve a record by moving `head` on with a
+// cmpxchg while the ring is not full, fill it in and publish it by writing its
+// sequence number (index + 1) last. We are the only reader: records are taken
+// in order for as long as their sequence number matches, then `tail` is moved
+// on. A full ring drops records and counts them, it never holds up the tracee.
+struct TraceRing {
+    static constexpr std::uint64_t capacity{ 65536 };   // a power of two
+    static constexpr std::size_t record_size{ 64 };
+    // the two sides write different cache lines
+    static constexpr std::size_t head_offset{ 0 };
+    static constexpr std::size_t tail_offset{ 64 };
+    static constexpr std::size_t dropped_offset{ 128 };
+    static constexpr std::size_t records_offset{ 4096 };
+    static constexpr std::size_t size{ records_offset + capacity * record_size };
+
+    struct Record {
+        std::uint64_t sequence;
+        std::uint64_t id;
+        std::array< std::uint64_t, Tracepoint::max_registers > values;
+    };
+    static_assert( sizeof( Record ) == record_size );
+
+    TraceRing() = default;
+
+    // maps the memfd the tracee has mapped at `remote`, takes ownership of `fd`
+    TraceRing( int const fd, std::intptr_t const remote ) : remote{ remote } {
+        auto * const mapped{ mmap( nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 ) };
+        close( fd );
+        if ( mapped != MAP_FAILED ) local = static_cast< std::byte * >( mapped );
+    }
+
+    TraceRing( TraceRing const & ) = delete;
+    TraceRing & operator=( TraceRing const & ) = delete;
+
+    TraceRing( TraceRing && other ) noexcept : local{ std::exchange( other.local, nullptr ) }, remote{ other.remote } {}
+    TraceRing & operator=( TraceRing && other ) noexcept {
+        if ( this != &other ) {
+            unmap();
+            local = std::exchange( other.local, nullptr );
+            remote = other.remote;
+        }
+        return *this;
+    }
+
+    ~TraceRing() { unmap(); }
+
+    bool is_mapped() const { return local != nullptr; }
+    std::intptr_t remote_address() const { return remote; }
+
+    std::uint64_t dropped() const { return word( dropped_offset ).load( std::memory_order_relaxed ); }
+
+    // hands every published record to `f`, oldest first, and returns how many there were
+    template< typename F >
+    std::size_t drain( F && f ) {
+        auto const tail{ word( tail_offset ) };
+        auto const first{ tail.load( std::memory_order_relaxed ) };
+        auto next{ first };
+        for ( ;; ++next ) {
+            auto & record{ record_at( next ) };
+            if ( std::atomic_ref{ record.sequence }.load( std::memory_order_acquire ) != next + 1 ) break;
+            f( record );
+            // the slot goes back to the writers once it has been read, in batches
+            if ( ( next + 1 ) % 256 == 0 ) tail.store( next + 1, std::memory_order_release );
+        }
+        tail.store( next, std::memory_order_release );
+        return static_cast< std::size_t >( next - first );
+    }
+
+private:
+    std::atomic_ref< std::uint64_t > word( std::size_t const offset ) const {
+        return std::atomic_ref{ *reinterpret_cast< std::uint64_t * >( local + offset ) };
+    }
+
+    Record & record_at( std::uint64_t const index ) const {
+        return *reinterpret_cast< Record * >( local + records_offset + ( index & ( capacity - 1 ) ) * record_size );
+    }
+
+    void unmap() {
+        if ( local ) munmap( local, size );
+        local = nullptr;
+    }
+
+    std::byte * local{};
+    std::intptr_t remote{};
+};
+
+namespace tracepoint_detail
+{
+    inline void emit( std::vector< std::byte > & code, std::initializer_list< std::uint8_t > const bytes ) {
+        for ( auto const b : bytes ) code.push_back( std::byte{ b } );
+    }
+
+    template< typename T >
+    void emit_value( std::vector< std::byte > & code, T const value ) {
+        auto const at{ code.size() };
+        code.resize( at + sizeof( value ) );
+        std::memcpy( code.data() + at, &value, sizeof( value ) );
+    }
+
+    // the number in ModRM/REX of the general purpose registers, nothing for the others
+    inline std::optional< std::uint8_t > encoding( Register const r ) {
+        using enum Register;
+        switch ( r ) {
+            case rax: return 0;  case rcx: return 1;  case rdx: return 2;  case rbx: return 3;
+            case rsp: return 4;  case rbp: return 5;  case rsi: return 6;  case rdi: return 7;
+            case r8:  return 8;  case r9:  return 9;  case r10: return 10; case r11: return 11;
+            case r12: return 12; case r13: return 13; case r14: return 14; case r15: return 15;
+            default:  return std::nullopt;
+        }
+    }
+}
+
+// what a trampoline can record: the general purpose registers, rip and eflags
+inline bool is_traceable( Register const r ) {
+    return tracepoint_detail::encoding( r ) || r == Register::rip || r == Register::eflags;
+}
+
+// The whole instructions a jmp at the start of `code` overwrites, nothing if one of them
+// cannot be moved: only plain instructions, nothing that branches
+inline std::optional< std::vector< Instruction > > replaced_instructions( std::span< std::byte const > const code ) {
+    std::vector< Instruction > instructions{};
+    std::size_t length{};
+    while ( length < Tracepoint::jump_size ) {
+        auto const insn{ decode_instruction( code.subspan( length ) ) };
+        if ( !insn || insn->kind != InstructionKind::normal ) return std::nullopt;
+        instructions.push_back( *insn );
+        length += insn->length;
+    }
+    return instructions;
+}
+
+// Fills `code` with the trampoline of `tp`, to be written at `tp.trampoline`: it records into the
+// ring at `ring`, runs `instructions` (the decoded `tp.original`) moved there and jumps back.
+// Returns false if a rip-relative operand is out of reach from the trampoline.
+inline bool assemble_trampoline( Tracepoint const & tp, std::intptr_t const ring, std::span< Instruction const > const instructions,
+                                 std::vector< std::byte > & code )
+{
+    using namespace tracepoint_detail;
+    using displaced_detail::append_rel32;
+    using displaced_detail::fits_rel32;
+
+    code.clear();
+    // below the red zone, then everything the recording clobbers
+    emit( code, { 0x48, 0x8d, 0x64, 0x24, 0x80 } );                      // lea rsp, [rsp - 128]
+    emit( code, { 0x9c, 0x50, 0x51, 0x52 } );                            // pushfq; push rax; push rcx; push rdx
+    emit( code, { 0x48, 0xb9 } );                                        // movabs rcx, ring
+    emit_value( code, static_cast< std::uint64_t >( ring ) );
+
+    // reserve a record: rax = head, unless the ring is full
+    emit( code, { 0x48, 0x8b, 0x01 } );                                  // mov rax, [rcx]
+    auto const retry{ code.size() };
+    emit( code, { 0x48, 0x89, 0xc2 } );                                  // mov rdx, rax
+    emit( code, { 0x48, 0x2b, 0x51, TraceRing::tail_offset } );          // sub rdx, [rcx + tail]
+    emit( code, { 0x48, 0x81, 0xfa } );                                  // cmp rdx, capacity
+    emit_value( code, static_cast< std::uint32_t >( TraceRing::capacity ) );
+    emit( code, { 0x0f, 0x83 } );                                        // jae full
+    auto const to_full{ code.size() };
+    emit_value( code, std::int32_t{} );
+    emit( code, { 0x48, 0x8d, 0x50, 0x01 } );                            // lea rdx, [rax + 1]
+    emit( code, { 0xf0, 0x48, 0x0f, 0xb1, 0x11 } );                      // lock cmpxchg [rcx], rdx
+    emit( code, { 0x75 } );                                              // jne retry
+    emit_value( code, static_cast< std::int8_t >( retry - ( code.size() + 1 ) ) );
+
+    // rdx = the record, rax = its sequence number
+    emit( code, { 0x48, 0x89, 0xc2 } );                                  // mov rdx, rax
+    emit( code, { 0x48, 0x81, 0xe2 } );                                  // and rdx, capacity - 1
+    emit_value( code, static_cast< std::uint32_t >( TraceRing::capacity - 1 ) );
+    emit( code, { 0x48, 0xc1, 0xe2, 0x06 } );                            // shl rdx, log2( record_size )
+    emit( code, { 0x48, 0x8d, 0x94, 0x11 } );                            // lea rdx, [rcx + rdx + records]
+    emit_value( code, static_cast< std::uint32_t >( TraceRing::records_offset ) );
+    emit( code, { 0x48, 0xff, 0xc0 } );                                  // inc rax
+    emit( code, { 0x48, 0xc7, 0x42, 0x08 } );                            // mov qword [rdx + 8], id
+    emit_value( code, tp.id );
+
+    // the saved registers come from the stack, rcx is free to move them through
+    for ( std::size_t i{}; i < tp.registers.size(); ++i ) {
+        auto const offset{ static_cast< std::uint8_t >( offsetof( TraceRing::Record, values ) + i * 8 ) };
+        auto const r{ tp.registers[ i ] };
+        auto const reg{ encoding( r ) };
+
+        if ( reg && *reg != 0 && *reg != 1 && *reg != 2 && *reg != 4 ) {
+            emit( code, { static_cast< std::uint8_t >( 0x48 | ( *reg >= 8 ? 0x04 : 0x00 ) ), 0x89,
+                          static_cast< std::uint8_t >( 0x42 | ( ( *reg & 7 ) << 3 ) ), offset } );   // mov [rdx + offset], reg
+            continue;
+        }
+        switch ( r ) {
+            case Register::rdx:    emit( code, { 0x48, 0x8b, 0x0c, 0x24 } ); break;                   // mov rcx, [rsp]
+            case Register::rcx:    emit( code, { 0x48, 0x8b, 0x4c, 0x24, 0x08 } ); break;             // mov rcx, [rsp + 8]
+            case Register::rax:    emit( code, { 0x48, 0x8b, 0x4c, 0x24, 0x10 } ); break;             // mov rcx, [rsp + 16]
+            case Register::eflags: emit( code, { 0x48, 0x8b, 0x4c, 0x24, 0x18 } ); break;             // mov rcx, [rsp + 24]
+            case Register::rsp:    emit( code, { 0x48, 0x8d, 0x8c, 0x24, 0xa0, 0x00, 0x00, 0x00 } ); break; // lea rcx, [rsp + 160]
+            default:
+                emit( code, { 0x48, 0xb9 } );                                                          // movabs rcx, addr
+                emit_value( code, static_cast< std::uint64_t >( tp.addr ) );
+                break;
+        }
+        emit( code, { 0x48, 0x89, 0x4a, offset } );                                                    // mov [rdx + offset], rcx
+    }
+    // publish it, after everything else it holds
+    emit( code, { 0x48, 0x89, 0x02 } );                                  // mov [rdx], rax
+    emit( code, { 0xeb, 0x08 } );                                        // jmp done
+
+    auto const full{ static_cast< std::int32_t >( code.size() - ( to_full + 4 ) ) };
+    std::memcpy( code.data() + to_full, &full, sizeof( full ) );
+    emit( code, { 0xf0, 0x48, 0xff, 0x81 } );                            // lock inc qword [rcx + dropped]
+    emit_value( code, static_cast< std::uint32_t >( TraceRing::dropped_offset ) );
+
+    // done:
+    emit( code, { 0x5a, 0x59, 0x58, 0x9d } );                            // pop rdx; pop rcx; pop rax; popfq
+    emit( code, { 0x48, 0x8d, 0xa4, 0x24, 0x80, 0x00, 0x00, 0x00 } );    // lea rsp, [rsp + 128]
+
+    // the replaced instructions, their rip-relative operands adjusted to the new place
+    std::size_t offset{};
+    for ( auto const & insn : instructions ) {
+        auto const at{ code.size() };
+        code.insert( std::end( code ), std::begin( tp.original ) + offset, std::begin( tp.original ) + offset + insn.length );
+        if ( insn.is_rip_relative() ) {
+            std::int32_t disp{};
+            std::memcpy( &disp, code.data() + at + insn.disp_offset, sizeof( disp ) );
+            auto const moved{ std::int64_t{ disp } + ( tp.addr + static_cast< std::intptr_t >( offset ) ) - ( tp.trampoline + static_cast< std::intptr_t >( at ) ) };
+            if ( !fits_rel32( moved ) ) return false;
+            disp = static_cast< std::int32_t >( moved );
+            std::memcpy( code.data() + at + insn.disp_offset, &disp, sizeof( disp ) );
+        }
+        offset += insn.length;
+    }
+
+    auto const back{ ( tp.addr + static_cast< std::intptr_t >( tp.original.size() ) ) - ( tp.trampoline + static_cast< std::intptr_t >( code.size() ) + 5 ) };
+    if ( !fits_rel32( back ) ) return false;
+    code.push_back( std::byte{ 0xe9 } );
+    append_rel32( code, back );
+    return static_cast< std::intptr_t >( code.size() ) <= Tracepoint::trampoline_size;
+}
@@ -0,0 +1,741 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <elf.h>
+
+#include <sys/user.h>
+
+#include "dwarf.hpp"
+#include "elf.hpp"
+#include "maps.hpp"
+#include "memory.hpp"
+#include "registers.hpp"
+
+// How the caller's value of a register is found, relative to the CFA (the
+// caller's rsp, right before the call)
+enum class RuleKind : std::uint8_t {
+    same_value,       // not touched by this frame, the default
+    undefined,        // lost; in the return address column, the end of the stack
+    offset,           // saved at CFA + value
+    val_offset,       // is CFA + value
+    in_register,      // saved in register `value`
+    expression,       // saved at the address the expression at `value` computes
+    val_expression,   // is what the expression at `value` computes
+};
+
+struct RegisterRule {
+    RuleKind kind{ RuleKind::same_value };
+    std::int64_t value{};
+};
+
+// One row of the CFI table: how to get from a frame at some pc to its caller
+struct UnwindRow {
+    // DWARF registers 0-15 are rax..r15, 16 is the return address, i.e. the caller's rip
+    static constexpr std::size_t register_count{ 17 };
+    static constexpr std::size_t rsp{ 7 };
+    static constexpr std::size_t return_address{ 16 };
+
+    std::uint16_t cfa_register{ rsp };
+    bool cfa_is_expression{};
+    bool is_signal_frame{};
+    std::int64_t cfa_offset{};   // or the position of the expression
+    std::array< RegisterRule, register_count > rules{};
+};
+
+// The registers of one frame by DWARF number, minus the ones the CFI says are lost
+struct FrameRegisters {
+    bool has( std::uint64_t const reg ) const { return reg < UnwindRow::register_count && ( valid >> reg ) & 1; }
+    std::uint64_t operator[]( std::uint64_t const reg ) const { return values[ reg ]; }
+
+    void set( std::uint64_t const reg, std::uint64_t const value ) {
+        values[ reg ] = value;
+        valid |= 1U << reg;
+    }
+    void clear( std::uint64_t const reg ) { valid &= ~( 1U << reg ); }
+
+private:
+    std::array< std::uint64_t, UnwindRow::register_count > values{};
+    std::uint32_t valid{};
+};
+
+namespace unwind_detail
+{
+    // DW_EH_PE_* pointer encodings of .eh_frame and .eh_frame_hdr
+    inline constexpr std::uint8_t pe_omit{ 0xff };
+    inline constexpr std::uint8_t pe_pcrel{ 0x10 };
+    inline constexpr std::uint8_t pe_datarel{ 0x30 };
+    inline constexpr std::uint8_t pe_datarel_sdata4{ 0x3b };
+
+    // `section_addr` is the link-time address of what `r` reads, for pc-relative values
+    inline std::optional< std::uint64_t > read_encoded( DwarfReader & r, std::uint8_t const encoding, std::uint64_t const section_addr, std::uint64_t const data_base = 0 ) {
+        if ( encoding == pe_omit ) return 0;
+
+        auto const field{ section_addr + r.pos };
+        std::uint64_t value{};
+        switch ( encoding & 0x0f ) {
+            case 0x00: value = r.u64(); break;
+            case 0x01: value = r.uleb(); break;
+            case 0x02: value = r.u16(); break;
+            case 0x03: value = r.u32(); break;
+            case 0x04: value = r.u64(); break;
+            case 0x09: value = static_cast< std::uint64_t >( r.sleb() ); break;
+            case 0x0a: value = static_cast< std::uint64_t >( std::int64_t{ static_cast< std::int16_t >( r.u16() ) } ); break;
+            case 0x0b: value = static_cast< std::uint64_t >( std::int64_t{ static_cast< std::int32_t >( r.u32() ) } ); break;
+            case 0x0c: value = r.u64(); break;
+            default: return std::nullopt;
+        }
+        switch ( encoding & 0x70 ) {
+            case 0x00: break;
+            case pe_pcrel: value += field; break;
+            case pe_datarel: value += data_base; break;
+            default: return std::nullopt;
+        }
+        if ( r.failed ) return std::nullopt;
+        return value;
+    }
+
+    // The DWARF expressions CFI uses: PLT entries and signal trampolines compute their CFA
+    // from registers and memory. `initial` is pushed first, if there is one.
+    template< typename Read >
+    std::optional< std::uint64_t > evaluate( std::span< std::byte const > const expression, FrameRegisters const & regs,
+                                             std::optional< std::uint64_t > const initial, Read && read )
+    {
+        std::array< std::uint64_t, 64 > stack{};
+        std::size_t depth{};
+        auto const push{ [&]( std::uint64_t const value ) {
+            if ( depth == stack.size() ) return false;
+            stack[ depth++ ] = value;
+            return true;
+        } };
+        if ( initial ) push( *initial );
+
+        DwarfReader r{ expression };
+        // branches can go backwards, don't let a broken expression spin forever
+        for ( std::size_t steps{}; !r.at_end(); ++steps ) {
+            if ( steps == 1000 ) return std::nullopt;
+
+            auto const op{ r.u8() };
+            if ( op >= 0x30 && op <= 0x4f ) {                  // DW_OP_lit0..31
+                if ( !push( op - 0x30U ) ) return std::nullopt;
+                continue;
+            }
+            if ( ( op >= 0x70 && op <= 0x8f ) || op == 0x92 ) { // DW_OP_breg0..31, DW_OP_bregx
+                auto const reg{ op == 0x92 ? r.uleb() : op - 0x70U };
+                auto const offset{ r.sleb() };
+                if ( !regs.has( reg ) || !push( regs[ reg ] + static_cast< std::uint64_t >( offset ) ) ) return std::nullopt;
+                continue;
+            }
+
+            bool ok{ true };
+            switch ( op ) {
+                case 0x08: ok = push( r.u8() ); break;
+                case 0x09: ok = push( static_cast< std::uint64_t >( std::int64_t{ static_cast< std::int8_t >( r.u8() ) } ) ); break;
+                case 0x0a: ok = push( r.u16() ); break;
+                case 0x0b: ok = push( static_cast< std::uint64_t >( std::int64_t{ static_cast< std::int16_t >( r.u16() ) } ) ); break;
+                case 0x0c: ok = push( r.u32() ); break;
+                case 0x0d: ok = push( static_cast< std::uint64_t >( std::int64_t{ static_cast< std::int32_t >( r.u32() ) } ) ); break;
+                case 0x0e: case 0x0f: ok = push( r.u64() ); break;
+                case 0x10: ok = push( r.uleb() ); break;
+                case 0x11: ok = push( static_cast< std::uint64_t >( r.sleb() ) ); break;
+                case 0x12: ok = depth >= 1 && push( stack[ depth - 1 ] ); break;             // dup
+                case 0x13: ok = depth >= 1; depth -= ok; break;                             // drop
+                case 0x14: ok = depth >= 2 && push( stack[ depth - 2 ] ); break;             // over
+                case 0x16: ok = depth >= 2; if ( ok ) std::swap( stack[ depth - 1 ], stack[ depth - 2 ] ); break;
+                case 0x06:                                                                  // deref
+                case 0x94: {                                                                // deref_size
+                    auto const size{ op == 0x94 ? r.u8() : std::uint8_t{ 8 } };
+                    std::uint64_t value{};
+                    ok = depth >= 1 && size <= 8 && read( stack[ depth - 1 ], value );
+                    if ( ok && size < 8 ) value &= ( std::uint64_t{ 1 } << ( size * 8 ) ) - 1;
+                    if ( ok ) stack[ depth - 1 ] = value;
+                    break;
+                }
+                case 0x1f: ok = depth >= 1; if ( ok ) stack[ depth - 1 ] = -stack[ depth - 1 ]; break;
+                case 0x20: ok = depth >= 1; if ( ok ) stack[ depth - 1 ] = ~stack[ depth - 1 ]; break;
+                case 0x23: ok = depth >= 1; if ( ok ) stack[ depth - 1 ] += r.uleb(); break; // plus_uconst
+                case 0x2f: r.pos += static_cast< std::size_t >( static_cast< std::int16_t >( r.u16() ) ); break;   // skip
+                case 0x28: {                                                                // bra
+                    auto const offset{ static_cast< std::int16_t >( r.u16() ) };
+                    ok = depth >= 1;
+                    if ( ok && stack[ --depth ] != 0 ) r.pos += static_cast< std::size_t >( offset );
+                    break;
+                }
+                case 0x96: break;                                                           // nop
+                case 0x1a: case 0x1c: case 0x1e: case 0x21: case 0x22: case 0x24: case 0x25: case 0x26: case 0x27:
+                case 0x29: case 0x2a: case 0x2b: case 0x2c: case 0x2d: case 0x2e: {
+                    if ( depth < 2 ) return std::nullopt;
+                    auto const b{ stack[ --depth ] };
+                    auto & a{ stack[ depth - 1 ] };
+                    auto const sa{ static_cast< std::int64_t >( a ) };
+                    auto const sb{ static_cast< std::int64_t >( b ) };
+                    switch ( op ) {
+                        case 0x1a: a &= b; break;
+                        case 0x1c: a -= b; break;
+                        case 0x1e: a *= b; break;
+                        case 0x21: a |= b; break;
+                        case 0x22: a += b; break;
+                        case 0x24: a = b < 64 ? a << b : 0; break;
+                        case 0x25: a = b < 64 ? a >> b : 0; break;
+                        case 0x26: a = static_cast< std::uint64_t >( sa >> std::min< std::uint64_t >( b, 63 ) ); break;
+                        case 0x27: a ^= b; break;
+                        case 0x29: a = sa == sb; break;
+                        case 0x2a: a = sa >= sb; break;
+                        case 0x2b: a = sa >  sb; break;
+                        case 0x2c: a = sa <= sb; break;
+                        case 0x2d: a = sa <  sb; break;
+                        case 0x2e: a = sa != sb; break;
+                    }
+                    break;
+                }
+                default:
+                    return std::nullopt;
+            }
+            if ( !ok ) return std::nullopt;
+        }
+
+        if ( r.failed || depth == 0 ) return std::nullopt;
+        return stack[ depth - 1 ];
+    }
+}
+
+// The call frame information of one object file, from its .eh_frame.
+//
+// The FDE covering a pc is found by binary searching the sorted table of
+// .eh_frame_hdr (or an index built by one pass over .eh_frame when there is
+// none), and its CFA program is only run for the pcs that are asked for.
+// CIEs are parsed once, together with their initial rules, and the decoded
+// row of every pc is kept, so unwinding through the same code again is a
+// hash lookup.
+struct FrameTable {
+    FrameTable() = default;
+
+    explicit FrameTable( ElfFile const & elf ) {
+        if ( !elf.is_valid() ) return;
+
+        auto const * const frame{ elf.find_section( ".eh_frame" ) };
+        if ( !frame ) return;
+        eh_frame = elf.contents( *frame );
+        eh_frame_addr = frame->sh_addr;
+
+        if ( auto const * const hdr{ elf.find_section( ".eh_frame_hdr" ) }; hdr && read_header( elf.contents( *hdr ), hdr->sh_addr ) ) return;
+        index_fdes();
+    }
+
+    // the rules at `pc`, a link-time address; nothing if no FDE covers it
+    UnwindRow const * find_row( std::uint64_t const pc ) {
+        if ( auto const it{ rows.find( pc ) }; it != std::end( rows ) ) {
+            return it->second ? &*it->second : nullptr;
+        }
+        if ( rows.size() >= max_cached_rows ) rows.clear();
+
+        std::optional< UnwindRow > row{};
+        if ( auto const fde{ find_fde( pc ) }; fde ) {
+            row = decode_fde( *fde, pc );
+        }
+        auto const & cached{ rows.emplace( pc, std::move( row ) ).first->second };
+        return cached ? &*cached : nullptr;
+    }
+
+    // the bytes of the expression at `position`, where its length is
+    std::span< std::byte const > expression( std::int64_t const position ) const {
+        DwarfReader r{ eh_frame, static_cast< std::size_t >( position ) };
+        auto const length{ r.uleb() };
+        if ( r.failed || length > eh_frame.size() - r.pos ) return {};
+        return eh_frame.subspan( r.pos, length );
+    }
+
+    std::size_t cached_rows() const { return rows.size(); }
+
+private:
+    static constexpr std::size_t max_cached_rows{ 1 << 16 };
+
+    struct Cie {
+        std::uint64_t code_align{ 1 };
+        std::int64_t data_align{};
+        std::uint8_t fde_encoding{};
+        bool has_augmentation_data{};
+        UnwindRow initial{};
+    };
+
+    struct IndexEntry {
+        std::uint64_t begin;
+        std::size_t offset;
+    };
+
+    bool read_header( std::span< std::byte const > const hdr, std::uint64_t const hdr_addr ) {
+        using namespace unwind_detail;
+
+        DwarfReader r{ hdr };
+        auto const version{ r.u8() };
+        auto const frame_encoding{ r.u8() };
+        auto const count_encoding{ r.u8() };
+        auto const table_encoding{ r.u8() };
+        if ( version != 1 || table_encoding != pe_datarel_sdata4 ) return false;
+
+        read_encoded( r, frame_encoding, hdr_addr, hdr_addr );
+        auto const count{ read_encoded( r, count_encoding, hdr_addr, hdr_addr ) };
+        if ( !count || *count > ( hdr.size() - r.pos ) / 8 ) return false;
+
+        // pairs of (initial location, FDE address), both relative to the header
+        header_table = hdr.subspan( r.pos, *count * 8 );
+        header_addr = hdr_addr;
+        return true;
+    }
+
+    void index_fdes() {
+        using namespace unwind_detail;
+
+        DwarfReader r{ eh_frame };
+        while ( !r.at_end() ) {
+            auto const start{ r.pos };
+            bool is_64{};
+            auto const end{ r.unit_length( is_64 ) };
+            if ( end == r.pos || end > eh_frame.size() ) break;
+
+            auto const id_pos{ r.pos };
+            auto const id{ r.offset( is_64 ) };
+            if ( id != 0 && id <= id_pos ) {
+                if ( auto const * const cie{ find_cie( id_pos - id ) }; cie ) {
+                    if ( auto const begin{ read_encoded( r, cie->fde_encoding, eh_frame_addr ) }; begin ) {
+                        index.push_back( { *begin, start } );
+                    }
+                }
+            }
+            r.pos = end;
+        }
+        std::sort( std::begin( index ), std::end( index ), []( auto const & a, auto const & b ) { return a.begin < b.begin; } );
+    }
+
+    // offset in .eh_frame of the last FDE starting at or before `pc`
+    std::optional< std::size_t > find_fde( std::uint64_t const pc ) const {
+        if ( header_table.empty() ) {
+            auto const it{ std::upper_bound( std::begin( index ), std::end( index ), pc, []( auto const p, auto const & e ) { return p < e.begin; } ) };
+            if ( it == std::begin( index ) ) return std::nullopt;
+            return std::prev( it )->offset;
+        }
+
+        auto const entry{ [this]( std::size_t const i, std::size_t const field ) {
+            std::int32_t value{};
+            std::memcpy( &value, header_table.data() + i * 8 + field * 4, sizeof( value ) );
+            return header_addr + static_cast< std::uint64_t >( std::int64_t{ value } );
+        } };
+
+        std::size_t lo{}, hi{ header_table.size() / 8 };
+        while ( lo < hi ) {
+            auto const mid{ lo + ( hi - lo ) / 2 };
+            if ( entry( mid, 0 ) <= pc ) lo = mid + 1;
+            else hi = mid;
+        }
+        if ( lo == 0 ) return std::nullopt;
+
+        auto const fde{ entry( lo - 1, 1 ) };
+        if ( fde < eh_frame_addr || fde - eh_frame_addr >= eh_frame.size() ) return std::nullopt;
+        return fde - eh_frame_addr;
+    }
+
+    Cie const * find_cie( std::size_t const offset ) {
+        if ( auto const it{ cies.find( offset ) }; it != std::end( cies ) ) return &it->second;
+
+        auto cie{ parse_cie( offset ) };
+        if ( !cie ) return nullptr;
+        return &cies.emplace( offset, std::move( *cie ) ).first->second;
+    }
+
+    std::optional< Cie > parse_cie( std::size_t const offset ) {
+        using namespace unwind_detail;
+
+        DwarfReader r{ eh_frame, offset };
+        bool is_64{};
+        auto const end{ r.unit_length( is_64 ) };
+        if ( end > eh_frame.size() || r.offset( is_64 ) != 0 ) return std::nullopt;
+
+        Cie cie{};
+        auto const version{ r.u8() };
+        auto const augmentation{ r.cstr() };
+        // very old gcc put a pointer to its exception table here
+        if ( augmentation.find( "eh" ) != std::string_view::npos ) r.skip( 8 );
+        cie.code_align = r.uleb();
+        cie.data_align = r.sleb();
+        auto const return_register{ version == 1 ? r.u8() : r.uleb() };
+        if ( return_register != UnwindRow::return_address ) return std::nullopt;
+
+        if ( augmentation.starts_with( 'z' ) ) {
+            auto const length{ r.uleb() };
+            auto const data_end{ r.pos + length };
+            for ( auto const c : augmentation.substr( 1 ) ) {
+                if ( c == 'L' ) r.u8();
+                else if ( c == 'P' ) read_encoded( r, r.u8() & 0x7f, eh_frame_addr );
+                else if ( c == 'R' ) cie.fde_encoding = r.u8();
+                else if ( c == 'S' ) cie.initial.is_signal_frame = true;
+                else break;   // the rest cannot be parsed, the length skips it
+            }
+            r.pos = data_end;
+            cie.has_augmentation_data = true;
+        } else if ( !augmentation.empty() && augmentation != "eh" ) {
+            return std::nullopt;
+        }
+
+        UnwindRow initial{ cie.initial };
+        if ( !execute( r, end, cie, 0, ~std::uint64_t{}, initial ) ) return std::nullopt;
+        cie.initial = initial;
+        return cie;
+    }
+
+    std::optional< UnwindRow > decode_fde( std::size_t const offset, std::uint64_t const pc ) {
+        using namespace unwind_detail;
+
+        DwarfReader r{ eh_frame, offset };
+        bool is_64{};
+        auto const end{ r.unit_length( is_64 ) };
+        auto const id_pos{ r.pos };
+        // in .eh_frame this is the distance back to the CIE
+        auto const id{ r.offset( is_64 ) };
+        if ( end > eh_frame.size() || id == 0 || id > id_pos ) return std::nullopt;
+
+        auto const * const cie{ find_cie( id_pos - id ) };
+        if ( !cie ) return std::nullopt;
+
+        auto const begin{ read_encoded( r, cie->fde_encoding, eh_frame_addr ) };
+        auto const range{ read_encoded( r, cie->fde_encoding & 0x0f, 0 ) };
+        if ( !begin || !range || pc < *begin || pc - *begin >= *range ) return std::nullopt;
+        if ( cie->has_augmentation_data ) r.skip( r.uleb() );
+
+        UnwindRow row{ cie->initial };
+        if ( !execute( r, end, *cie, *begin, pc, row ) ) return std::nullopt;
+        return row;
+    }
+
+    // runs a CFA program from `loc` until the row covering `pc` is complete
+    bool execute( DwarfReader r, std::size_t const end, Cie const & cie, std::uint64_t loc, std::uint64_t const pc, UnwindRow & row ) {
+        using namespace unwind_detail;
+
+        std::vector< UnwindRow > remembered{};
+        auto const set_rule{ [&row]( std::uint64_t const reg, RuleKind const kind, std::int64_t const value ) {
+            // vector registers and the like, nothing the unwinder needs
+            if ( reg < UnwindRow::register_count ) row.rules[ reg ] = { kind, value };
+        } };
+        auto const restore{ [&row, &cie]( std::uint64_t const reg ) {
+            if ( reg < UnwindRow::register_count ) row.rules[ reg ] = cie.initial.rules[ reg ];
+        } };
+        auto const advance{ [&loc, &cie, pc]( std::uint64_t const delta ) {
+            loc += delta * cie.code_align;
+            return loc <= pc;
+        } };
+        auto const factored{ [&cie]( std::int64_t const value ) { return value * cie.data_align; } };
+
+        while ( r.pos < end && !r.failed ) {
+            auto const op{ r.u8() };
+            switch ( op >> 6 ) {
+                case 1: if ( !advance( op & 0x3f ) ) return true; continue;
+                case 2: set_rule( op & 0x3f, RuleKind::offset, factored( static_cast< std::int64_t >( r.uleb() ) ) ); continue;
+                case 3: restore( op & 0x3f ); continue;
+            }
+
+            switch ( op ) {
+                case 0x00: break;   // nop
+                case 0x01: {        // set_loc
+                    auto const to{ read_encoded( r, cie.fde_encoding, eh_frame_addr ) };
+                    if ( !to ) return false;
+                    if ( *to > pc ) return true;
+                    loc = *to;
+                    break;
+                }
+                case 0x02: if ( !advance( r.u8() ) ) return true; break;
+                case 0x03: if ( !advance( r.u16() ) ) return true; break;
+                case 0x04: if ( !advance( r.u32() ) ) return true; break;
+                case 0x05: { auto const reg{ r.uleb() }; set_rule( reg, RuleKind::offset, factored( static_cast< std::int64_t >( r.uleb() ) ) ); break; }
+                case 0x06: restore( r.uleb() ); break;
+                case 0x07: set_rule( r.uleb(), RuleKind::undefined, 0 ); break;
+                case 0x08: set_rule( r.uleb(), RuleKind::same_value, 0 ); break;
+                case 0x09: { auto const reg{ r.uleb() }; set_rule( reg, RuleKind::in_register, static_cast< std::int64_t >( r.uleb() ) ); break; }
+                case 0x0a: remembered.push_back( row ); break;
+                case 0x0b:
+                    if ( remembered.empty() ) return false;
+                    row = remembered.back();
+                    remembered.pop_back();
+                    break;
+                case 0x0c:
+                    row.cfa_register = static_cast< std::uint16_t >( r.uleb() );
+                    row.cfa_offset = static_cast< std::int64_t >( r.uleb() );
+                    row.cfa_is_expression = false;
+                    break;
+                case 0x0d: row.cfa_register = static_cast< std::uint16_t >( r.uleb() ); row.cfa_is_expression = false; break;
+                case 0x0e: row.cfa_offset = static_cast< std::int64_t >( r.uleb() ); break;
+                case 0x0f:
+                    row.cfa_is_expression = true;
+                    row.cfa_offset = static_cast< std::int64_t >( r.pos );
+                    r.skip( r.uleb() );
+                    break;
+                case 0x10:
+                case 0x16: {        // expression, val_expression
+                    auto const reg{ r.uleb() };
+                    set_rule( reg, op == 0x10 ? RuleKind::expression : RuleKind::val_expression, static_cast< std::int64_t >( r.pos ) );
+                    r.skip( r.uleb() );
+                    break;
+                }
+                case 0x11: { auto const reg{ r.uleb() }; set_rule( reg, RuleKind::offset, factored( r.sleb() ) ); break; }
+                case 0x12:
+                    row.cfa_register = static_cast< std::uint16_t >( r.uleb() );
+                    row.cfa_offset = factored( r.sleb() );
+                    row.cfa_is_expression = false;
+                    break;
+                case 0x13: row.cfa_offset = factored( r.sleb() ); break;
+                case 0x14: { auto const reg{ r.uleb() }; set_rule( reg, RuleKind::val_offset, factored( static_cast< std::int64_t >( r.uleb() ) ) ); break; }
+                case 0x15: { auto const reg{ r.uleb() }; set_rule( reg, RuleKind::val_offset, factored( r.sleb() ) ); break; }
+                case 0x2e: r.uleb(); break;   // GNU_args_size
+                case 0x2f: { auto const reg{ r.uleb() }; set_rule( reg, RuleKind::offset, -factored( static_cast< std::int64_t >( r.uleb() ) ) ); break; }
+                default:
+                    return false;
+            }
+        }
+        return !r.failed;
+    }
+
+    std::span< std::byte const > eh_frame{};
+    std::uint64_t eh_frame_addr{};
+    std::span< std::byte const > header_table{};
+    std::uint64_t header_addr{};
+    std::vector< IndexEntry > index{};
+    std::unordered_map< std::size_t, Cie > cies{};
+    std::unordered_map< std::uint64_t, std::optional< UnwindRow > > rows{};
+};
+
+// Reads of the tracee's stack during one unwind. They are served from one bulk
+// copy of the stack above the innermost frame, and only a frame outside of it
+// costs another read.
+struct StackWindow {
+    static constexpr std::size_t window_size{ 16 * 1024 };
+
+    void reset( Memory & m ) {
+        memory = &m;
+        length = 0;
+    }
+
+    bool read( std::uint64_t const addr, std::uint64_t & value ) {
+        if ( addr < first || addr - first > length || length - ( addr - first ) < sizeof( value ) ) {
+            if ( !load( addr ) ) return false;
+        }
+        std::memcpy( &value, buffer.data() + ( addr - first ), sizeof( value ) );
+        return true;
+    }
+
+private:
+    bool load( std::uint64_t const addr ) {
+        buffer.resize( window_size );
+        first = addr;
+        length = memory->read_memory( static_cast< std::intptr_t >( addr ), buffer );
+        return length >= sizeof( std::uint64_t );
+    }
+
+    Memory * memory{};
+    std::vector< std::byte > buffer{};
+    std::uint64_t first{};
+    std::size_t length{};
+};
+
+// Walks the stack of a stopped thread with the .eh_frame CFI of the
+// executable and of the libraries its frames are in, and through the saved
+// rbp chain for code without any.
+//
+// Object files are mapped when a frame is first found in them and stay
+// mapped, with their decoded rows, for as long as they are loaded at the same
+// address, so an unwind through known code costs one bulk read of the stack.
+struct Unwinder {
+    // learns where object files are mapped, from /proc/<pid>/maps
+    void refresh( std::span< MemoryRegion const > const regions ) {
+        std::vector< Module > next{};
+        for ( auto const & region : regions ) {
+            if ( !region.path.starts_with( '/' ) ) continue;
+
+            auto const known{ std::find_if( std::begin( next ), std::end( next ), [&region]( auto const & m ) { return m.path == region.path; } ) };
+            if ( known != std::end( next ) ) {
+                known->start = std::min( known->start, region.start );
+                known->end = std::max( known->end, region.end );
+                continue;
+            }
+            next.push_back( Module{ region.path, region.start, region.end, region.offset } );
+        }
+
+        // an object still mapped at the same place keeps what has been decoded of it
+        for ( auto & module : next ) {
+            auto const old{ std::find_if( std::begin( modules ), std::end( modules ), [&module]( auto const & m ) {
+                return m.path == module.path && m.start == module.start;
+            } ) };
+            if ( old != std::end( modules ) && old->loaded ) {
+                auto const end{ module.end };
+                module = std::move( *old );
+                module.end = end;
+            }
+        }
+
+        std::sort( std::begin( next ), std::end( next ), []( auto const & a, auto const & b ) { return a.start < b.start; } );
+        modules = std::move( next );
+    }
+
+    // everything that was learned about the old address space, e.g. after an exec
+    void reset() { modules.clear(); }
+
+    // rip, then the return address of every frame; stops where the CFI says the stack
+    // ends, at a frame that cannot be unwound, or once `out` is full
+    std::size_t unwind( Memory & memory, user_regs_struct const & regs, std::span< std::uint64_t > const out ) {
+        if ( out.empty() ) return 0;
+
+        FrameRegisters frame{};
+        for ( unsigned reg{}; reg < UnwindRow::register_count; ++reg ) {
+            frame.set( reg, get_register_value_from_dwarf_register( regs, reg ) );
+        }
+        stack.reset( memory );
+
+        std::size_t n{};
+        out[ n++ ] = regs.rip;
+        bool is_return_address{};
+
+        while ( n < out.size() ) {
+            auto const pc{ frame[ UnwindRow::return_address ] };
+            // a return address is past the call, and the call can be the last instruction of its function
+            auto const lookup{ is_return_address ? pc - 1 : pc };
+
+            auto * const module{ find_module( lookup ) };
+            auto const * const row{ module ? module->table.find_row( lookup - module->bias ) : nullptr };
+
+            FrameRegisters caller{};
+            if ( !( row ? step( *row, module->table, frame, caller ) : step_frame_pointer( frame, caller ) ) ) break;
+            if ( !caller.has( UnwindRow::return_address ) || caller[ UnwindRow::return_address ] == 0 ) break;
+
+            // the caller's frame is above this one, except when coming out of a signal handler
+            auto const is_signal_frame{ row && row->is_signal_frame };
+            if ( !is_signal_frame && caller[ UnwindRow::rsp ] <= frame[ UnwindRow::rsp ] ) break;
+
+            out[ n++ ] = caller[ UnwindRow::return_address ];
+            // the trampoline of a signal handler resumes at the interrupted instruction itself
+            is_return_address = !is_signal_frame;
+            frame = caller;
+        }
+        return n;
+    }
+
+private:
+    static constexpr std::uint64_t page_mask{ 0xfff };
+
+    struct Module {
+        std::string path{};
+        std::uintptr_t start{};
+        std::uintptr_t end{};
+        std::uint64_t offset{};   // file offset of the lowest mapping
+        bool loaded{};
+        std::uint64_t bias{};     // runtime address - link-time address
+        ElfFile elf{};
+        FrameTable table{};
+    };
+
+    Module * find_module( std::uint64_t const pc ) {
+        auto const it{ std::upper_bound( std::begin( modules ), std::end( modules ), pc, []( auto const p, auto const & m ) { return p < m.start; } ) };
+        if ( it == std::begin( modules ) || pc >= std::prev( it )->end ) return nullptr;
+
+        auto & module{ *std::prev( it ) };
+        if ( !module.loaded ) load( module );
+        return &module;
+    }
+
+    static void load( Module & module ) {
+        module.loaded = true;
+        module.elf = ElfFile{ module.path };
+        if ( !module.elf.is_valid() ) return;
+
+        // the lowest mapping is the start of one of the PT_LOAD segments, page aligned
+        module.bias = module.start - module.offset;
+        for ( auto const & segment : module.elf.segments() ) {
+            if ( segment.p_type == PT_LOAD && ( segment.p_offset & ~page_mask ) == module.offset ) {
+                module.bias = module.start - ( segment.p_vaddr & ~page_mask );
+                break;
+            }
+        }
+        module.table = FrameTable{ module.elf };
+    }
+
+    bool step( UnwindRow const & row, FrameTable const & table, FrameRegisters const & frame, FrameRegisters & caller ) {
+        auto const read{ [this]( std::uint64_t const addr, std::uint64_t & value ) { return stack.read( addr, value ); } };
+
+        std::uint64_t cfa{};
+        if ( row.cfa_is_expression ) {
+            auto const value{ unwind_detail::evaluate( table.expression( row.cfa_offset ), frame, std::nullopt, read ) };
+            if ( !value ) return false;
+            cfa = *value;
+        } else {
+            if ( !frame.has( row.cfa_register ) ) return false;
+            cfa = frame[ row.cfa_register ] + static_cast< std::uint64_t >( row.cfa_offset );
+        }
+
+        // the CFA is the caller's rsp by definition, everything without a rule is left as it was
+        caller = frame;
+        caller.set( UnwindRow::rsp, cfa );
+
+        for ( std::size_t reg{}; reg < UnwindRow::register_count; ++reg ) {
+            auto const & rule{ row.rules[ reg ] };
+            auto const at{ cfa + static_cast< std::uint64_t >( rule.value ) };
+            std::uint64_t value{};
+
+            switch ( rule.kind ) {
+                case RuleKind::same_value:
+                    continue;
+                case RuleKind::undefined:
+                    caller.clear( reg );
+                    continue;
+                case RuleKind::offset:
+                    if ( !stack.read( at, value ) ) return false;
+                    break;
+                case RuleKind::val_offset:
+                    value = at;
+                    break;
+                case RuleKind::in_register:
+                    if ( !frame.has( static_cast< std::uint64_t >( rule.value ) ) ) {
+                        caller.clear( reg );
+                        continue;
+                    }
+                    value = frame[ static_cast< std::uint64_t >( rule.value ) ];
+                    break;
+                case RuleKind::expression:
+                case RuleKind::val_expression: {
+                    auto const result{ unwind_detail::evaluate( table.expression( rule.value ), frame, cfa, read ) };
+                    if ( !result ) return false;
+                    value = *result;
+                    if ( rule.kind == RuleKind::expression && !stack.read( value, value ) ) return false;
+                    break;
+                }
+            }
+            caller.set( reg, value );
+        }
+        return true;
+    }
+
+    // without CFI, the frame is assumed to start with push rbp; mov rbp, rsp
+    bool step_frame_pointer( FrameRegisters const & frame, FrameRegisters & caller ) {
+        constexpr std::uint64_t rbp_column{ 6 };
+        if ( !frame.has( rbp_column ) ) return false;
+
+        auto const rbp{ frame[ rbp_column ] };
+        std::uint64_t saved_rbp{}, return_address{};
+        if ( rbp == 0 || rbp % 8 != 0 ) return false;
+        if ( !stack.read( rbp, saved_rbp ) || !stack.read( rbp + 8, return_address ) ) return false;
+
+        caller = frame;
+        caller.set( rbp_column, saved_rbp );
+        caller.set( UnwindRow::rsp, rbp + 16 );
+        caller.set( UnwindRow::return_address, return_address );
+        return true;
+    }
+
+    std::vector< Module > modules{};
+    StackWindow stack{};
+};
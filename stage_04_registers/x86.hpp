@@ -0,0 +1,252 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+
+// Just enough of an x86-64 decoder to move an instruction somewhere else:
+// its length, where a rip-relative displacement sits inside it, and whether
+// (and how) it changes control flow.
+
+enum class InstructionKind : std::uint8_t {
+    normal,
+    jump_relative,          // jmp rel8/rel32
+    conditional_relative,   // jcc rel8/rel32
+    call_relative,          // call rel32
+    loop_relative,          // loop*/jrcxz, rel8 only, no rel32 form to relocate to
+    call_indirect,          // call r/m64
+    jump_indirect,          // jmp r/m64
+    ret,                    // ret / ret imm16
+    other_control,          // far transfers, iret, int, int3, ...
+};
+
+struct Instruction {
+    std::uint8_t length{};
+    InstructionKind kind{ InstructionKind::normal };
+    std::uint8_t condition{};                    // low nibble of the jcc opcode
+    std::uint8_t disp_offset{};                  // offset of the rip-relative disp32, 0 if none
+    std::int64_t relative{};                     // branch displacement, from the end of the instruction
+    std::uint16_t pop_bytes{};                   // ret imm16
+
+    bool is_rip_relative() const { return disp_offset != 0; }
+};
+
+namespace x86_detail
+{
+    inline bool is_legacy_prefix( std::uint8_t const b ) {
+        switch ( b ) {
+            case 0xf0: case 0xf2: case 0xf3:
+            case 0x2e: case 0x36: case 0x3e: case 0x26: case 0x64: case 0x65:
+            case 0x66: case 0x67:
+                return true;
+        }
+        return false;
+    }
+
+    // one byte opcodes that take a ModRM byte
+    inline bool has_modrm_1( std::uint8_t const op ) {
+        if ( op < 0x40 ) return ( op & 0x07 ) < 0x04;
+        switch ( op ) {
+            case 0x62: case 0x63: case 0x69: case 0x6b:
+            case 0xc0: case 0xc1: case 0xc4: case 0xc5: case 0xc6: case 0xc7:
+            case 0xd0: case 0xd1: case 0xd2: case 0xd3:
+            case 0xf6: case 0xf7: case 0xfe: case 0xff:
+                return true;
+        }
+        return ( op >= 0x80 && op <= 0x8f ) || ( op >= 0xd8 && op <= 0xdf );
+    }
+
+    // two byte (0f xx) opcodes without a ModRM byte
+    inline bool has_no_modrm_2( std::uint8_t const op ) {
+        switch ( op ) {
+            case 0x05: case 0x06: case 0x07: case 0x08: case 0x09: case 0x0b: case 0x0e:
+            case 0x77: case 0xa0: case 0xa1: case 0xa2: case 0xa8: case 0xa9: case 0xaa:
+                return true;
+        }
+        return ( op >= 0x30 && op <= 0x37 ) || ( op >= 0x80 && op <= 0x8f ) || ( op >= 0xc8 && op <= 0xcf );
+    }
+
+    // two byte (0f xx) opcodes followed by an imm8
+    inline bool has_imm8_2( std::uint8_t const op ) {
+        switch ( op ) {
+            case 0x0f: case 0x70: case 0x71: case 0x72: case 0x73:
+            case 0xa4: case 0xac: case 0xba: case 0xc2: case 0xc4: case 0xc5: case 0xc6:
+                return true;
+        }
+        return false;
+    }
+}
+
+// returns nothing for encodings that are invalid in 64-bit mode or run past `code`
+inline std::optional< Instruction > decode_instruction( std::span< std::byte const > const code ) {
+    using namespace x86_detail;
+
+    std::size_t pos{};
+    auto const byte_at{ [&code]( std::size_t const i ) -> std::optional< std::uint8_t > {
+        if ( i >= code.size() || i >= 15 ) return std::nullopt;
+        return std::to_integer< std::uint8_t >( code[ i ] );
+    } };
+
+    bool operand_16{};
+    bool address_32{};
+    std::uint8_t rex{};
+
+    // prefixes; a REX prefix only counts when it comes right before the opcode
+    while ( true ) {
+        auto const b{ byte_at( pos ) };
+        if ( !b ) return std::nullopt;
+        if ( is_legacy_prefix( *b ) ) {
+            operand_16 |= *b == 0x66;
+            address_32 |= *b == 0x67;
+            rex = 0;
+            ++pos;
+        } else if ( ( *b & 0xf0 ) == 0x40 ) {
+            rex = *b;
+            ++pos;
+        } else {
+            break;
+        }
+    }
+    bool const rex_w{ ( rex & 0x08 ) != 0 };
+
+    Instruction insn{};
+    bool modrm{};
+    std::size_t imm{};      // immediate bytes
+    std::size_t rel{};      // branch displacement bytes
+    std::uint8_t map{};     // 0: one byte, 1: 0f, 2: 0f 38, 3: 0f 3a
+    std::uint8_t op{ *byte_at( pos++ ) };
+
+    auto const imm_z{ operand_16 ? 2U : 4U };
+
+    if ( op == 0xc4 || op == 0xc5 || op == 0x62 ) {
+        // VEX / EVEX, always followed by an opcode and a ModRM byte in 64-bit mode
+        std::size_t const payload{ op == 0xc5 ? 1U : op == 0xc4 ? 2U : 3U };
+        auto const p0{ byte_at( pos ) };
+        if ( !p0 ) return std::nullopt;
+        map = op == 0xc5 ? 1 : ( *p0 & 0x03 );
+        pos += payload;
+
+        auto const vop{ byte_at( pos++ ) };
+        if ( !vop ) return std::nullopt;
+        op = *vop;
+        // vzeroupper / vzeroall are the only VEX instructions without ModRM
+        modrm = !( op == 0x77 && map == 1 && payload < 3 );
+        if ( map == 3 || ( map == 1 && has_imm8_2( op ) ) ) imm = 1;
+    } else if ( op == 0x0f ) {
+        auto const op2{ byte_at( pos++ ) };
+        if ( !op2 ) return std::nullopt;
+        op = *op2;
+        map = 1;
+
+        if ( op == 0x38 || op == 0x3a ) {
+            map = op == 0x38 ? 2 : 3;
+            auto const op3{ byte_at( pos++ ) };
+            if ( !op3 ) return std::nullopt;
+            op = *op3;
+            modrm = true;
+            imm = map == 3 ? 1 : 0;
+        } else {
+            modrm = !has_no_modrm_2( op );
+            imm = has_imm8_2( op ) ? 1 : 0;
+            if ( op >= 0x80 && op <= 0x8f ) {
+                rel = 4;
+                insn.kind = InstructionKind::conditional_relative;
+                insn.condition = op & 0x0f;
+            }
+            // ud2, sysenter, sysret and sysexit; a plain syscall returns right after itself and can be moved
+            if ( op == 0x0b || op == 0x34 || op == 0x35 || op == 0x07 ) insn.kind = InstructionKind::other_control;
+        }
+    } else {
+        switch ( op ) {
+            // invalid in 64-bit mode
+            case 0x06: case 0x07: case 0x0e: case 0x16: case 0x17: case 0x1e: case 0x1f:
+            case 0x27: case 0x2f: case 0x37: case 0x3f: case 0x60: case 0x61: case 0x82:
+            case 0x9a: case 0xce: case 0xd4: case 0xd5: case 0xd6: case 0xea:
+                return std::nullopt;
+        }
+
+        modrm = has_modrm_1( op );
+
+        if ( op < 0x40 && ( op & 0x07 ) == 0x04 ) imm = 1;
+        else if ( op < 0x40 && ( op & 0x07 ) == 0x05 ) imm = imm_z;
+        else if ( op >= 0x70 && op <= 0x7f ) {
+            rel = 1;
+            insn.kind = InstructionKind::conditional_relative;
+            insn.condition = op & 0x0f;
+        } else if ( op >= 0xb0 && op <= 0xb7 ) imm = 1;
+        else if ( op >= 0xb8 && op <= 0xbf ) imm = rex_w ? 8 : imm_z;
+        else if ( op >= 0xe0 && op <= 0xe3 ) {
+            rel = 1;
+            insn.kind = InstructionKind::loop_relative;
+        } else if ( op >= 0xa0 && op <= 0xa3 ) imm = address_32 ? 4 : 8;   // moffs
+        else {
+            switch ( op ) {
+                case 0x68: case 0x69: case 0x81: case 0xa9: case 0xc7: imm = imm_z; break;
+                case 0x6a: case 0x6b: case 0x80: case 0x83: case 0xa8: case 0xc0: case 0xc1: case 0xc6:
+                case 0xcd: case 0xe4: case 0xe5: case 0xe6: case 0xe7:
+                    imm = 1;
+                    break;
+                case 0xc2: imm = 2; insn.kind = InstructionKind::ret; break;
+                case 0xc3: insn.kind = InstructionKind::ret; break;
+                case 0xc8: imm = 3; break;
+                case 0xca: imm = 2; insn.kind = InstructionKind::other_control; break;
+                case 0xcb: case 0xcc: case 0xcf: case 0xf1: case 0xf4:
+                    insn.kind = InstructionKind::other_control;
+                    break;
+                case 0xe8: rel = 4; insn.kind = InstructionKind::call_relative; break;
+                case 0xe9: rel = 4; insn.kind = InstructionKind::jump_relative; break;
+                case 0xeb: rel = 1; insn.kind = InstructionKind::jump_relative; break;
+            }
+            if ( op == 0xcd ) insn.kind = InstructionKind::other_control;
+        }
+    }
+
+    if ( modrm ) {
+        auto const m{ byte_at( pos++ ) };
+        if ( !m ) return std::nullopt;
+        auto const mod{ *m >> 6 };
+        auto const reg{ ( *m >> 3 ) & 0x07 };
+        auto const rm{ *m & 0x07 };
+
+        if ( map == 0 && ( op == 0xf6 || op == 0xf7 ) && reg < 2 ) {
+            imm = op == 0xf6 ? 1 : imm_z;   // test r/m, imm
+        }
+        if ( map == 0 && op == 0xff ) {
+            if ( reg == 2 ) insn.kind = InstructionKind::call_indirect;
+            if ( reg == 4 ) insn.kind = InstructionKind::jump_indirect;
+            if ( reg == 3 || reg == 5 ) insn.kind = InstructionKind::other_control;
+        }
+
+        if ( mod != 3 ) {
+            if ( rm == 4 ) {
+                auto const sib{ byte_at( pos++ ) };
+                if ( !sib ) return std::nullopt;
+                if ( mod == 0 && ( *sib & 0x07 ) == 5 ) pos += 4;
+            } else if ( mod == 0 && rm == 5 ) {
+                insn.disp_offset = static_cast< std::uint8_t >( pos );
+                pos += 4;
+            }
+            if ( mod == 1 ) pos += 1;
+            if ( mod == 2 ) pos += 4;
+        }
+    }
+
+    auto const rel_offset{ pos };
+    pos += rel + imm;
+    if ( pos > 15 || pos > code.size() ) return std::nullopt;
+    insn.length = static_cast< std::uint8_t >( pos );
+
+    if ( rel == 1 ) {
+        insn.relative = static_cast< std::int8_t >( std::to_integer< std::uint8_t >( code[ rel_offset ] ) );
+    } else if ( rel == 4 ) {
+        std::int32_t value{};
+        std::memcpy( &value, code.data() + rel_offset, sizeof( value ) );
+        insn.relative = value;
+    }
+    if ( insn.kind == InstructionKind::ret && imm == 2 ) {
+        std::memcpy( &insn.pop_bytes, code.data() + rel_offset, sizeof( insn.pop_bytes ) );
+    }
+    return insn;
+}